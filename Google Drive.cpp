@@ -3,1569 +3,9323 @@
 #include <ctime>
 #include <sstream>
 #include <iomanip>
+#include <bitset>
+#include <cstdint>
+#include <cstring>
+#include <random>
+#include <chrono>
+#include <unordered_map>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <algorithm>
+#include <thread>
+#include <fstream>
+#include <filesystem>
+#include <mutex>
+#include <shared_mutex>
+#include <condition_variable>
+#include <map>
+#include <cmath>
+#include <deque>
+#include <csignal>
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#endif
 using namespace std;
 
-//  User Graph System 
-const int MAX_USERS = 10;
-
-enum Role { ADMIN = 1, EDITOR = 2, VIEWER = 3 };
+// Thread-safe local time: localtime_s on Windows, localtime_r elsewhere
+inline void localTime(time_t t, tm& out)
+{
+#ifdef _WIN32
+    localtime_s(&out, &t);
+#else
+    localtime_r(&t, &out);
+#endif
+}
 
-struct User
+//  Memory Accounting
+enum MemSubsystem
 {
-    string username;
-    string password;
-    string securityQuestion;
-    string logoutTime;
-    Role role = VIEWER;
+    MEM_TREE,      // treenode objects and names
+    MEM_INDEX,     // per-folder AVL index nodes
+    MEM_VERSIONS,  // version nodes and their content
+    MEM_RECYCLE,   // Recycle Bin entries (their versions stay under MEM_VERSIONS)
+    MEM_RECENT,    // recent files cache entries
+    MEM_SYNC,      // cloud sync queue tasks
+    MEM_HASH,      // metadata hash index
+    MEM_SHARING,   // sharing graph matrices
+    MEM_ACL,       // explicit ACL entries
+    MEM_SESSIONS,  // login sessions
+    MEM_SUBSYSTEMS
 };
 
-class Graph
+// Relaxed atomic counters: one uncontended add per allocation or free
+class MemoryStats
 {
-    int** adj;
-    int size;
+    atomic<long long> bytes[MEM_SUBSYSTEMS];
+    atomic<long long> objects[MEM_SUBSYSTEMS];
 
 public:
-    Graph(int n)
+    MemoryStats()
     {
-        size = n;
-        adj = new int* [n];
-        for (int i = 0; i < n; i++)
+        for (int i = 0; i < MEM_SUBSYSTEMS; i++)
         {
-            adj[i] = new int[n];
-            for (int j = 0; j < n; j++)
-            {
-                adj[i][j] = 0;
-            }
+            bytes[i] = 0;
+            objects[i] = 0;
         }
     }
-    ~Graph()
+
+    void add(MemSubsystem sub, size_t n)
     {
-        for (int i = 0; i < size; i++)
-        {
-            delete[] adj[i];
-        }
-        delete[] adj;
+        bytes[sub].fetch_add((long long)n, memory_order_relaxed);
+        objects[sub].fetch_add(1, memory_order_relaxed);
     }
 
-    void addEdge(int u, int v)
+    void remove(MemSubsystem sub, size_t n)
     {
-        adj[u][v] = 1; // Directed edge: permission granted
+        bytes[sub].fetch_sub((long long)n, memory_order_relaxed);
+        objects[sub].fetch_sub(1, memory_order_relaxed);
     }
 
-    void removeEdge(int u, int v)
+    // Size change of an object that stays alive
+    void resize(MemSubsystem sub, size_t oldBytes, size_t newBytes)
     {
-        adj[u][v] = 0;
+        bytes[sub].fetch_add((long long)newBytes - (long long)oldBytes, memory_order_relaxed);
     }
 
-    void displayGraph(const User users[], int userCount) const
+    long long getBytes(MemSubsystem sub) const
     {
-        bool anyConnection = false;
-        for (int i = 0; i < userCount; i++)
-        {
-            for (int j = 0; j < userCount; j++)
-            {
-                if (adj[i][j])
-                {
-                    cout << users[i].username << " (" << getRoleName(users[i].role) << ") --> "
-                        << users[j].username << " (" << getRoleName(users[j].role) << ")\n";
-                    anyConnection = true;
-                }
-            }
-        }
-        if (!anyConnection)
-        {
-            cout << "No sharing connections found." << endl;
-        }
+        return bytes[sub].load(memory_order_relaxed);
     }
 
-    string getRoleName(Role role) const
+    long long getObjects(MemSubsystem sub) const
     {
-        switch (role)
-        {
-        case ADMIN:
-            return "Admin";
-        case EDITOR:
-            return "Editor";
-        case VIEWER:
-            return "Viewer";
-        default:
-            return "Unknown";
-        }
+        return objects[sub].load(memory_order_relaxed);
     }
-};
 
-class UserSystem
-{
-public:
-    User users[MAX_USERS];
-    int userCount;
-    Graph userGraph;
-    UserSystem() : userGraph(MAX_USERS)
+    static const char* name(MemSubsystem sub)
     {
-        userCount = 0;
+        static const char* names[MEM_SUBSYSTEMS] = { "tree", "folder_index", "versions", "recycle_bin",
+            "recent_files", "sync_queue", "hash_index", "sharing_graph", "acl", "sessions" };
+        return names[sub];
     }
+};
 
-    int findUserIndex(const string& uname) const
+MemoryStats memStats;
+
+// Rough per-element overhead of a node-based standard container (links + bucket slot)
+const size_t CONTAINER_NODE_OVERHEAD = 3 * sizeof(void*);
+
+//  Engine Output
+// Messages from the drive engine go through this sink instead of straight to cout. It can
+// write synchronously (interactive use), hand lines to a writer thread (scripted runs), or
+// drop them. Off also skips building the message, see ENGINE_LOG.
+enum LogMode
+{
+    LOG_SYNC,
+    LOG_ASYNC,
+    LOG_OFF
+};
+
+class LogSink
+{
+    atomic<int> mode;
+    mutex lock;
+    condition_variable wake;
+    condition_variable drained; // signalled each time the writer finishes a batch
+    vector<string> queue;
+    thread writer;
+    bool stopping;
+    bool writing; // the writer holds a batch it hasn't finished printing
+
+    void writerLoop()
     {
-        for (int i = 0; i < userCount; i++)
+        vector<string> batch;
+        unique_lock<mutex> guard(lock);
+        while (true)
         {
-            if (users[i].username == uname)
-                return i;
+            wake.wait(guard, [this]() { return stopping || !queue.empty(); });
+            if (queue.empty() && stopping)
+                break;
+            batch.swap(queue);
+            writing = true;
+            guard.unlock();
+            for (size_t i = 0; i < batch.size(); i++)
+                cout.write(batch[i].data(), batch[i].size());
+            cout.flush();
+            batch.clear();
+            guard.lock();
+            writing = false;
+            drained.notify_all();
         }
-        return -1;
     }
 
-    void addUser(string uname, string pass, string secQ, Role role)
+    void stopWriter()
     {
-        try
-        {
-            if (userCount >= MAX_USERS)
-                throw runtime_error("User limit reached.");
-
-            if (findUserIndex(uname) != -1)
-                throw invalid_argument("Username already exists.");
-
-            users[userCount++] = { uname, pass, secQ, "", role };
-            cout << "User added successfully with role: " << userGraph.getRoleName(role) << "\n";
-        }
-        catch (const exception& e)
+        if (!writer.joinable())
+            return;
         {
-            cout << "Error adding user: " << e.what() << endl;
+            lock_guard<mutex> guard(lock);
+            stopping = true;
         }
+        wake.notify_one();
+        writer.join();
     }
 
-    bool login(string uname, string pass)
+public:
+    LogSink() : mode(LOG_SYNC), stopping(false), writing(false) {}
+    ~LogSink()
     {
-        try
-        {
-            int idx = findUserIndex(uname);
-            if (idx == -1 || users[idx].password != pass)
-                throw invalid_argument("Invalid username or password.");
+        stopWriter();
+    }
 
-            cout << "Login successful.\n";
-            return true;
-        }
-        catch (const exception& e)
+    // Switching away from async drains whatever is still queued
+    void setMode(LogMode m)
+    {
+        if (m == mode.load())
+            return;
+        stopWriter();
+        mode.store(m);
+        if (m == LOG_ASYNC)
         {
-            cout << "Login failed: " << e.what() << endl;
-            return false;
+            stopping = false;
+            writer = thread(&LogSink::writerLoop, this);
         }
     }
 
-    void logout(string uname, string time)
+    LogMode getMode() const
     {
-        int idx = findUserIndex(uname);
-        if (idx != -1)
-        {
-            users[idx].logoutTime = time;
-            cout << "User logged out at " << time << endl;
-        }
+        return (LogMode)mode.load(memory_order_relaxed);
     }
 
-    void forgotPassword(string uname, string ans)
+    // Returns once everything written so far is on stdout, so a prompt printed after it
+    // can't be overtaken by queued messages
+    void flush()
     {
-        int idx = findUserIndex(uname);
-        if (idx != -1)
-        {
-            if (users[idx].securityQuestion == ans)
-            {
-                cout << "Enter new password: ";
-                string newpass;
-                cin >> newpass;
-                users[idx].password = newpass;
-                cout << "Password updated.\n";
-            }
-            else
-            {
-                cout << "Security answer incorrect.\n";
-            }
-        }
-        else
+        if (mode.load() == LOG_ASYNC)
         {
-            cout << "Username not found.\n";
+            unique_lock<mutex> guard(lock);
+            drained.wait(guard, [this]() { return queue.empty() && !writing; });
         }
+        cout.flush();
     }
 
-    void shareFile(string from, string to)
+    bool enabled() const
     {
-        try
-        {
-            int u = findUserIndex(from);
-            int v = findUserIndex(to);
-            if (u == -1 || v == -1)
-                throw invalid_argument("One or both users not found.");
-
-            userGraph.addEdge(u, v);
-            cout << "File shared from " << from << " to " << to << endl;
-        }
-        catch (const exception& e)
-        {
-            cout << "Error in file sharing: " << e.what() << endl;
-        }
+        return mode.load(memory_order_relaxed) != LOG_OFF;
     }
 
-    void unshareFile(string from, string to)
+    void write(const string& text)
     {
-        int u = findUserIndex(from);
-        int v = findUserIndex(to);
-        if (u != -1 && v != -1)
-        {
-            userGraph.removeEdge(u, v);
-            cout << "File unshared from " << from << " to " << to << endl;
-        }
-        else
+        int m = mode.load(memory_order_relaxed);
+        if (m == LOG_SYNC)
+            cout.write(text.data(), text.size());
+        else if (m == LOG_ASYNC)
         {
-            cout << "User not found.\n";
+            {
+                lock_guard<mutex> guard(lock);
+                queue.push_back(text);
+            }
+            wake.notify_one();
         }
     }
+};
 
-    void showSharingAccess(string uname) const
+LogSink engineLog;
+
+// One message; handed to the sink when the statement ends
+class LogLine
+{
+    ostringstream buf;
+
+public:
+    ~LogLine()
     {
-        int idx = findUserIndex(uname);
-        if (idx == -1)
-        {
-            cout << "User not found.\n";
-            return;
-        }
-        cout << "\nSharing connections for user: " << uname << endl;
-        userGraph.displayGraph(users, userCount);
+        engineLog.write(buf.str());
     }
 
-    void displayAllUsers() const
+    template <typename T>
+    LogLine& operator<<(const T& value)
     {
-        if (userCount == 0)
-        {
-            cout << "No users in the system.\n";
-            return;
-        }
-        cout << "\nAll Users in the System:\n";
-        cout << "------------------------\n";
-        for (int i = 0; i < userCount; i++)
-        {
-            cout << (i + 1) << ". " << users[i].username << " (" << userGraph.getRoleName(users[i].role) << ")\n";
-        }
+        buf << value;
+        return *this;
     }
 
-    Role getCurrentUserRole(const string& uname) const
+    // endl becomes a plain newline: the sink decides when output is flushed
+    LogLine& operator<<(ostream& (*manip)(ostream&))
     {
-        int idx = findUserIndex(uname);
-        if (idx != -1) 
-            return users[idx].role;
-        return VIEWER; // Default fallback
+        if (manip == static_cast<ostream& (*)(ostream&)>(endl))
+            buf << '\n';
+        else
+            manip(buf);
+        return *this;
     }
 };
 
-struct File
+// Used like cout; with the sink off the message is never formatted
+#define ENGINE_LOG for (bool logOnce = engineLog.enabled(); logOnce; logOnce = false) LogLine()
+
+//  Operation Metrics
+// Call counts and latency histograms for the public engine operations. Each thread records
+// into its own buffer with plain relaxed stores; readers merge all buffers on demand.
+enum OpMetric
 {
-    string name;
-    string content;
-    File(string n, string c)
-    {
-        name = n;
-        content = c;
-    }
+    OP_FOLDER_CREATE_FOLDER,
+    OP_FOLDER_CREATE_FILE,
+    OP_FOLDER_UPDATE_FILE,
+    OP_FOLDER_DELETE_FILE,
+    OP_FOLDER_DELETE_FOLDER,
+    OP_FOLDER_RESTORE_FILE,
+    OP_FOLDER_ROLLBACK_FILE,
+    OP_FOLDER_NAVIGATE,
+    OP_FOLDER_LOOKUP,
+    OP_FOLDER_RESOLVE_PATH,
+    OP_FOLDER_RENAME,
+    OP_FOLDER_MOVE,
+    OP_FOLDER_COPY,
+    OP_FOLDER_BATCH,
+    OP_FOLDER_LIST,
+    OP_FOLDER_SEARCH,
+    OP_FOLDER_ACCESS_FILE,
+    OP_FOLDER_READ_RANGE,
+    OP_FOLDER_WRITE_RANGE,
+    OP_VERSION_ADD,
+    OP_VERSION_ROLLBACK,
+    OP_VERSION_LATEST,
+    OP_VERSION_HISTORY,
+    OP_VERSION_PRUNE,
+    OP_VERSION_COMPACT,
+    OP_VERSION_DIFF,
+    OP_VERSION_MERGE,
+    OP_VERSION_MERGE_BASE,
+    OP_HASH_INSERT,
+    OP_HASH_LOOKUP,
+    OP_HASH_REMOVE,
+    OP_RLE_ENCODE,
+    OP_RLE_DECODE,
+    OP_SYNC_ENQUEUE,
+    OP_SYNC_DRAIN,
+    OP_METRICS
 };
 
-const int MAX_RECYCLE = 10;
-class RecycleBin
+const char* opMetricName(OpMetric op)
+{
+    static const char* const names[OP_METRICS] = {
+        "folder.create_folder", "folder.create_file", "folder.update_file", "folder.delete_file",
+        "folder.delete_folder", "folder.restore_file", "folder.rollback_file", "folder.navigate",
+        "folder.lookup", "folder.resolve_path", "folder.rename", "folder.move", "folder.copy",
+        "folder.batch", "folder.list", "folder.search", "folder.access_file",
+        "folder.read_range", "folder.write_range",
+        "versioning.add", "versioning.rollback", "versioning.latest", "versioning.history",
+        "versioning.prune", "versioning.compact", "versioning.diff", "versioning.merge",
+        "versioning.merge_base",
+        "hashtable.insert", "hashtable.lookup", "hashtable.remove",
+        "rle.encode", "rle.decode", "cloudsync.enqueue", "cloudsync.drain"
+    };
+    return names[op];
+}
+
+// HDR-style log-linear buckets over nanoseconds: exact below 16 ns, then 8 sub-buckets per
+// power of two, so any recorded value is within 12.5% of its bucket's bounds.
+class LatencyHistogram
 {
-    File* bin[MAX_RECYCLE];
-    int top;
 public:
-    RecycleBin()
-    {
-        top = -1;
-        for (int i = 0; i < MAX_RECYCLE; i++)
-        {
-            bin[i] = nullptr;
-        }
-    }
-    ~RecycleBin()
+    static const int LINEAR = 16;
+    static const int SUB_BUCKETS = 8;
+    static const int BUCKETS = LINEAR + (64 - 4) * SUB_BUCKETS;
+
+    static int bucketOf(uint64_t ns)
     {
-        emptyRecycleBin();
+        if (ns < LINEAR)
+            return (int)ns;
+        int exponent = 63;
+        while (!(ns >> exponent))
+            exponent--;
+        int sub = (int)((ns >> (exponent - 3)) & (SUB_BUCKETS - 1));
+        return LINEAR + (exponent - 4) * SUB_BUCKETS + sub;
     }
 
-    bool isEmpty() const
+    // Upper bound of a bucket, used when reporting percentiles
+    static uint64_t bucketLimit(int bucket)
     {
-        return top == -1;
+        if (bucket < LINEAR)
+            return (uint64_t)bucket;
+        int exponent = 4 + (bucket - LINEAR) / SUB_BUCKETS;
+        uint64_t sub = (bucket - LINEAR) % SUB_BUCKETS;
+        return ((SUB_BUCKETS + sub + 1) << (exponent - 3)) - 1;
     }
 
-    bool isFull() const
+    uint64_t counts[BUCKETS];
+    uint64_t total;
+    uint64_t sumNs;
+    uint64_t maxNs;
+
+    LatencyHistogram()
     {
-        return top == MAX_RECYCLE - 1;
+        clear();
     }
 
-    void push(File* file)
+    void clear()
     {
-        try
-        {
-            if (!file)
-                throw invalid_argument("Cannot push a null file.");
-
-            if (isFull())
-            {
-                cout << "Recycle Bin full. Deleting oldest file.\n";
-                delete bin[0];
-                for (int i = 0; i < top; i++)
-                    bin[i] = bin[i + 1];
-                top--;
-            }
-            bin[++top] = file;
-        }
-        catch (const exception& e)
-        {
-            cout << "Recycle Bin Error: " << e.what() << endl;
-        }
+        memset(counts, 0, sizeof(counts));
+        total = sumNs = maxNs = 0;
     }
 
-    File* pop()
+    uint64_t percentile(double p) const
     {
-        if (isEmpty())
+        if (total == 0)
+            return 0;
+        uint64_t rank = (uint64_t)ceil(p * total), seen = 0;
+        for (int b = 0; b < BUCKETS; b++)
         {
-            cout << "Recycle Bin is empty.\n";
-            return nullptr;
+            seen += counts[b];
+            if (seen >= rank && counts[b] > 0)
+                return min(bucketLimit(b), maxNs);
         }
-        File* file = bin[top];
-        top--;
-        cout << "Restoring file '" << file->name << "' from Recycle Bin.\n";
-        return file;
+        return maxNs;
     }
+};
 
-    File* restoreFileByName(const string& filename)
+class OpMetrics
+{
+    // Written only by its thread; atomics keep the concurrent merge well-defined
+    struct ThreadBuffer
     {
-        if (isEmpty())
-        {
-            cout << "Recycle Bin is empty.\n";
-            return nullptr;
-        }
-        for (int i = 0; i <= top; i++)
+        atomic<uint64_t> counts[OP_METRICS][LatencyHistogram::BUCKETS];
+        atomic<uint64_t> sumNs[OP_METRICS];
+        atomic<uint64_t> maxNs[OP_METRICS];
+
+        ThreadBuffer()
         {
-            if (bin[i]->name == filename)
+            for (int op = 0; op < OP_METRICS; op++)
             {
-                File* file = bin[i];
-                for (int j = i; j < top; j++)
-                {
-                    bin[j] = bin[j + 1];
-                }
-                bin[top] = nullptr;
-                top--;
-                cout << "Restoring file '" << file->name << "' from Recycle Bin.\n";
-                return file;
+                for (int b = 0; b < LatencyHistogram::BUCKETS; b++)
+                    counts[op][b].store(0, memory_order_relaxed);
+                sumNs[op].store(0, memory_order_relaxed);
+                maxNs[op].store(0, memory_order_relaxed);
             }
         }
-        cout << "File '" << filename << "' not found in Recycle Bin.\n";
-        return nullptr;
-    }
+    };
 
-    void viewRecycleBin() const
+    static void bump(atomic<uint64_t>& a, uint64_t by)
     {
-        if (isEmpty())
-        {
-            cout << "Recycle Bin is empty.\n";
-            return;
-        }
-        cout << "Files in Recycle Bin:\n";
-        for (int i = 0; i <= top; i++)
-        {
-            cout << (i + 1) << ". " << bin[i]->name << endl;
-        }
+        a.store(a.load(memory_order_relaxed) + by, memory_order_relaxed);
     }
 
-    void emptyRecycleBin()
+    atomic<bool> active;
+    mutex registryLock;
+    vector<unique_ptr<ThreadBuffer>> buffers; // kept after their thread exits so totals survive
+
+    ThreadBuffer& local()
     {
-        if (isEmpty())
-        {
-            cout << "Recycle Bin is already empty.\n";
-            return;
-        }
-        for (int i = 0; i <= top; i++)
+        thread_local ThreadBuffer* mine = nullptr;
+        if (mine == nullptr)
         {
-            if (bin[i] != nullptr)
-            {
-                delete bin[i];
-                bin[i] = nullptr;
-            }
+            lock_guard<mutex> guard(registryLock);
+            buffers.push_back(unique_ptr<ThreadBuffer>(new ThreadBuffer()));
+            mine = buffers.back().get();
         }
-        top = -1;
-        cout << "Recycle Bin emptied successfully.\n";
+        return *mine;
     }
-};
 
-const int MAX_RECENT = 5;
-class RecentFiles
-{
-    File* recent[MAX_RECENT];
-    int front, rear, size;
 public:
-    RecentFiles()
+    OpMetrics() : active(true) {}
+
+    bool enabled() const
     {
-        front = 0;
-        rear = -1;
-        size = 0;
-        for (int i = 0; i < MAX_RECENT; i++)
-        {
-            recent[i] = nullptr;
-        }
+        return active.load(memory_order_relaxed);
     }
-    ~RecentFiles()
+
+    void setEnabled(bool on)
     {
-        for (int i = 0; i < MAX_RECENT; i++)
-        {
-            recent[i] = nullptr;
-        }
+        active.store(on, memory_order_relaxed);
     }
 
-    void accessFile(File* file)
+    void record(OpMetric op, uint64_t ns)
     {
-        if (size == MAX_RECENT)
-        {
-            front = (front + 1) % MAX_RECENT;
-            size--;
-        }
-        rear = (rear + 1) % MAX_RECENT;
-        recent[rear] = file;
-        size++;
-        cout << "Accessed file: " << file->name << endl;
+        ThreadBuffer& buf = local();
+        bump(buf.counts[op][LatencyHistogram::bucketOf(ns)], 1);
+        bump(buf.sumNs[op], ns);
+        if (ns > buf.maxNs[op].load(memory_order_relaxed))
+            buf.maxNs[op].store(ns, memory_order_relaxed);
     }
 
-    void viewRecentFiles() const
+    LatencyHistogram snapshot(OpMetric op)
     {
-        if (size == 0)
+        LatencyHistogram h;
+        lock_guard<mutex> guard(registryLock);
+        for (size_t t = 0; t < buffers.size(); t++)
         {
-            cout << "No recent files accessed.\n";
-            return;
+            ThreadBuffer& buf = *buffers[t];
+            for (int b = 0; b < LatencyHistogram::BUCKETS; b++)
+            {
+                uint64_t c = buf.counts[op][b].load(memory_order_relaxed);
+                h.counts[b] += c;
+                h.total += c;
+            }
+            h.sumNs += buf.sumNs[op].load(memory_order_relaxed);
+            h.maxNs = max(h.maxNs, buf.maxNs[op].load(memory_order_relaxed));
         }
-        cout << "Recently Accessed Files:\n";
-        for (int i = 0; i < size; i++)
+        return h;
+    }
+
+    // Not synchronized with recording threads; a call racing a reset may survive it
+    void reset()
+    {
+        lock_guard<mutex> guard(registryLock);
+        for (size_t t = 0; t < buffers.size(); t++)
         {
-            int index = (front + i) % MAX_RECENT;
-            if (recent[index] != nullptr)
+            for (int op = 0; op < OP_METRICS; op++)
             {
-                cout << (i + 1) << ". " << recent[index]->name << endl;
+                for (int b = 0; b < LatencyHistogram::BUCKETS; b++)
+                    buffers[t]->counts[op][b].store(0, memory_order_relaxed);
+                buffers[t]->sumNs[op].store(0, memory_order_relaxed);
+                buffers[t]->maxNs[op].store(0, memory_order_relaxed);
             }
         }
     }
-};
 
-struct VersionNode
-{
-    int versionNumber;
-    string content;
-    VersionNode* next;
-    VersionNode* prev;
-    string timestamp;
-    VersionNode(int vNum, const string& text)
+    // One line per operation that has been called: count, mean and percentiles in microseconds
+    void dump(ostream& out, bool json)
     {
-        versionNumber = vNum;
-        content = text;
-        next = nullptr;
-        prev = nullptr;
-        time_t now = time(0);
-        tm ltm;
-        localtime_s(&ltm, &now); // Fixed unsafe localtime call
-        stringstream ss;
-        ss << 1900 + ltm.tm_year << "-"
-            << setw(2) << setfill('0') << 1 + ltm.tm_mon << "-"
-            << setw(2) << setfill('0') << ltm.tm_mday << " "
-            << setw(2) << setfill('0') << ltm.tm_hour << ":"
-            << setw(2) << setfill('0') << ltm.tm_min << ":"
-            << setw(2) << setfill('0') << ltm.tm_sec;
-        timestamp = ss.str();
+        out << fixed << setprecision(2);
+        if (json)
+            out << "{";
+        else
+            out << left << setw(24) << "operation" << right << setw(10) << "calls" << setw(10) << "mean_us"
+                << setw(10) << "p50_us" << setw(10) << "p99_us" << setw(10) << "p999_us" << setw(11) << "max_us" << "\n";
+        bool first = true;
+        for (int op = 0; op < OP_METRICS; op++)
+        {
+            LatencyHistogram h = snapshot((OpMetric)op);
+            if (h.total == 0)
+                continue;
+            double mean = h.sumNs / 1000.0 / h.total;
+            if (json)
+                out << (first ? "" : ",") << "\"" << opMetricName((OpMetric)op) << "\":{\"calls\":" << h.total
+                    << ",\"mean_us\":" << mean << ",\"p50_us\":" << h.percentile(0.5) / 1000.0
+                    << ",\"p99_us\":" << h.percentile(0.99) / 1000.0 << ",\"p999_us\":" << h.percentile(0.999) / 1000.0
+                    << ",\"max_us\":" << h.maxNs / 1000.0 << "}";
+            else
+                out << left << setw(24) << opMetricName((OpMetric)op) << right << setw(10) << h.total << setw(10) << mean
+                    << setw(10) << h.percentile(0.5) / 1000.0 << setw(10) << h.percentile(0.99) / 1000.0
+                    << setw(10) << h.percentile(0.999) / 1000.0 << setw(11) << h.maxNs / 1000.0 << "\n";
+            first = false;
+        }
+        if (json)
+            out << "}";
+        out << endl;
+        out.unsetf(ios::fixed);
+        out << left;
+        out.unsetf(ios::adjustfield);
     }
 };
 
-class FileVersioning
+OpMetrics opMetrics;
+
+// Times the enclosing scope; with metrics off it costs one relaxed load
+class OpTimer
 {
-private:
-    VersionNode* head;
-    VersionNode* currentVersion;
-    int versionCounter;
+    OpMetric op;
+    bool timing;
+    chrono::steady_clock::time_point start;
+
 public:
-    FileVersioning()
+    OpTimer(OpMetric o, bool when = true) : op(o), timing(when && opMetrics.enabled())
     {
-        head = nullptr;
-        currentVersion = nullptr;
-        versionCounter = 0;
+        if (timing)
+            start = chrono::steady_clock::now();
     }
-    ~FileVersioning()
+    ~OpTimer()
     {
-        VersionNode* temp = head;
-        while (temp != nullptr)
-        {
-            VersionNode* next = temp->next;
-            delete temp;
-            temp = next;
-        }
+        if (timing)
+            opMetrics.record(op, chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count());
     }
+};
 
-    void addVersion(const string& content)
+//  Epoch-Based Reclamation
+// Lock-free readers announce themselves in a per-thread record for the length of an
+// EpochGuard. A writer that unlinks memory a reader might still be walking retires it instead
+// of deleting it; it is freed once every reader active at that point has left.
+class EpochReclaimer
+{
+    struct alignas(64) Record
     {
-        versionCounter++;
-        VersionNode* newNode = new VersionNode(versionCounter, content);
-        if (head == nullptr)
-        {
-            head = newNode;
-        }
-        else {
-            newNode->next = head;
-            head->prev = newNode;
-            head = newNode;
-        }
-        currentVersion = newNode;
-        cout << "Added version " << versionCounter << " at " << newNode->timestamp << "\n";
-    }
+        atomic<uint64_t> active; // epoch the thread entered in, 0 while outside
+        atomic<bool> claimed;    // owned by a live thread
+        Record* next;
+    };
 
-    void rollbackToVersion(int versionNumber)
+    struct Retired
     {
-        VersionNode* temp = head;
-        while (temp != nullptr && temp->versionNumber != versionNumber)
-        {
-            temp = temp->next;
-        }
-        if (temp == nullptr)
-        {
-            cout << "Version " << versionNumber << " not found.\n";
-            return;
-        }
-        currentVersion = temp;
-        cout << "Rolled back to version " << versionNumber << " from " << temp->timestamp << "\n";
-    }
+        void* ptr;
+        void (*destroy)(void*);
+        uint64_t epoch;
+    };
 
-    void viewHistory() const
+    // Releases the thread's record for reuse when the thread exits
+    struct ThreadSlot
     {
-        if (head == nullptr)
-        {
-            cout << "No version history available.\n";
-            return;
-        }
-        VersionNode* temp = head;
-        cout << "\n----- File Version History -----\n";
-        while (temp != nullptr)
+        Record* record = nullptr;
+        int depth = 0;
+        ~ThreadSlot()
         {
-            cout << "Version " << temp->versionNumber;
-            if (temp == currentVersion)
-                cout << " (Current)";
-            cout << " - " << temp->timestamp << "\n";
-            cout << "Content: " << temp->content << "\n";
-            cout << "----------------------------\n";
-            temp = temp->next;
+            if (record != nullptr)
+                record->claimed.store(false, memory_order_release);
         }
-    }
+    };
 
-    string getLatestContent() const
-    {
-        if (currentVersion != nullptr)
-            return currentVersion->content;
-        else
-            return "";
-    }
+    static const size_t COLLECT_BATCH = 64;
 
-    int getCurrentVersionNumber() const
-    {
-        if (currentVersion != nullptr)
-            return currentVersion->versionNumber;
-        else
-            return 0;
-    }
-};
+    atomic<uint64_t> epoch;
+    atomic<Record*> records; // push-only; records are reused, never freed
+    mutex retiredLock;
+    vector<Retired> retired;
 
-struct treenode
-{
-    string name;
-    treenode* firstchild;
-    treenode* nextsibling;
-    treenode* parent;
-    FileVersioning* fileVersion;
-    bool isFolder;
-    treenode(string n, bool isDir = true)
+    static ThreadSlot& slot()
     {
-        name = n;
-        firstchild = nullptr;
-        nextsibling = nullptr;
-        parent = nullptr;
-        fileVersion = nullptr;
-        isFolder = isDir;
+        static thread_local ThreadSlot mine;
+        return mine;
     }
-    ~treenode()
+
+    Record* claim()
     {
-        if (firstchild != nullptr)
+        for (Record* r = records.load(memory_order_acquire); r != nullptr; r = r->next)
         {
-            delete firstchild;
+            bool expected = false;
+            if (!r->claimed.load(memory_order_relaxed) && r->claimed.compare_exchange_strong(expected, true))
+                return r;
         }
-        if (fileVersion != nullptr)
+        Record* r = new Record();
+        r->active.store(0, memory_order_relaxed);
+        r->claimed.store(true, memory_order_relaxed);
+        r->next = records.load(memory_order_relaxed);
+        while (!records.compare_exchange_weak(r->next, r))
         {
-            delete fileVersion;
         }
+        return r;
     }
-};
-
-class AVLTree
-{
-private:
-    struct AVLNode
-    {
-        string key;
-        int height;
-        AVLNode* left;
-        AVLNode* right;
-
-        AVLNode(string k) : key(k), height(1), left(nullptr), right(nullptr) {}
-    };
 
-    AVLNode* root;
-
-    int height(AVLNode* N)
+    // Oldest epoch any reader is still inside, or the current one when none is
+    uint64_t oldestActive() const
     {
-        if (N == nullptr)
-            return 0;
-        return N->height;
+        uint64_t oldest = epoch.load();
+        for (Record* r = records.load(memory_order_acquire); r != nullptr; r = r->next)
+        {
+            uint64_t e = r->active.load();
+            if (e != 0 && e < oldest)
+                oldest = e;
+        }
+        return oldest;
     }
 
-    int getBalance(AVLNode* N)
+public:
+    EpochReclaimer() : epoch(1), records(nullptr) {}
+
+    ~EpochReclaimer()
     {
-        if (N == nullptr)
-            return 0;
-        return height(N->left) - height(N->right);
+        for (size_t i = 0; i < retired.size(); i++)
+            retired[i].destroy(retired[i].ptr);
+        Record* r = records.load();
+        while (r != nullptr)
+        {
+            Record* next = r->next;
+            delete r;
+            r = next;
+        }
     }
 
-    AVLNode* rightRotate(AVLNode* y)
+    // Guards nest; only the outermost one publishes the thread's epoch
+    void enter()
     {
-        AVLNode* x = y->left;
-        AVLNode* T2 = x->right;
-
-        x->right = y;
-        y->left = T2;
-
-        y->height = max(height(y->left), height(y->right)) + 1;
-        x->height = max(height(x->left), height(x->right)) + 1;
-
-        return x;
+        ThreadSlot& s = slot();
+        if (s.depth++ > 0)
+            return;
+        if (s.record == nullptr)
+            s.record = claim();
+        // Sequentially consistent so the announcement is visible before any shared pointer is read
+        s.record->active.store(epoch.load());
+        atomic_thread_fence(memory_order_seq_cst);
     }
 
-    AVLNode* leftRotate(AVLNode* x)
+    void exit()
     {
-        AVLNode* y = x->right;
-        AVLNode* T2 = y->left;
-
-        y->left = x;
-        x->right = T2;
-
-        x->height = max(height(x->left), height(x->right)) + 1;
-        y->height = max(height(y->left), height(y->right)) + 1;
-
-        return y;
+        ThreadSlot& s = slot();
+        if (--s.depth == 0)
+            s.record->active.store(0, memory_order_release);
     }
 
-    AVLNode* insert(AVLNode* node, string key)
+    // Call after 'p' is unreachable from shared structures
+    template <typename T>
+    void retire(T* p)
     {
-        if (node == nullptr)
-            return new AVLNode(key);
-
-        if (key < node->key)
-            node->left = insert(node->left, key);
-        else if (key > node->key)
-            node->right = insert(node->right, key);
-        else
-            return node; // Equal keys not allowed
-
-        node->height = 1 + max(height(node->left), height(node->right));
-
-        int balance = getBalance(node);
-
-        // Left Left Case
-        if (balance > 1 && key < node->left->key)
-            return rightRotate(node);
-
-        // Right Right Case
-        if (balance < -1 && key > node->right->key)
-            return leftRotate(node);
-
-        // Left Right Case
-        if (balance > 1 && key > node->left->key)
-        {
-            node->left = leftRotate(node->left);
-            return rightRotate(node);
-        }
-
-        // Right Left Case
-        if (balance < -1 && key < node->right->key)
+        if (p == nullptr)
+            return;
+        Retired r = { p, [](void* q) { delete static_cast<T*>(q); }, epoch.load() };
+        vector<Retired> ready;
         {
-            node->right = rightRotate(node->right);
-            return leftRotate(node);
+            lock_guard<mutex> guard(retiredLock);
+            retired.push_back(r);
+            if (retired.size() < COLLECT_BATCH)
+                return;
+            collectLocked(ready);
         }
-
-        return node;
+        for (size_t i = 0; i < ready.size(); i++)
+            ready[i].destroy(ready[i].ptr);
     }
 
-    void inOrder(AVLNode* node)
+    // Frees whatever no reader can still see
+    void collect()
     {
-        if (node != nullptr)
+        vector<Retired> ready;
         {
-            inOrder(node->left);
-            cout << node->key << " ";
-            inOrder(node->right);
+            lock_guard<mutex> guard(retiredLock);
+            collectLocked(ready);
         }
+        for (size_t i = 0; i < ready.size(); i++)
+            ready[i].destroy(ready[i].ptr);
     }
 
-    AVLNode* search(AVLNode* root, string key)
+    size_t pending()
     {
-        if (root == nullptr || root->key == key)
-            return root;
-
-        if (root->key < key)
-            return search(root->right, key);
-
-        return search(root->left, key);
+        lock_guard<mutex> guard(retiredLock);
+        return retired.size();
     }
 
-    void cleanup(AVLNode* node)
+private:
+    // Advancing the epoch lets readers that enter from now on be told apart from those that
+    // might hold retired pointers: anything retired before an epoch older than every
+    // active reader is unreachable.
+    void collectLocked(vector<Retired>& ready)
     {
-        if (node != nullptr)
+        epoch.fetch_add(1);
+        atomic_thread_fence(memory_order_seq_cst);
+        uint64_t oldest = oldestActive();
+        size_t kept = 0;
+        for (size_t i = 0; i < retired.size(); i++)
         {
-            cleanup(node->left);
-            cleanup(node->right);
-            delete node;
+            if (retired[i].epoch < oldest)
+                ready.push_back(retired[i]);
+            else
+                retired[kept++] = retired[i];
         }
-    }
-
-public:
-    AVLTree() : root(nullptr) {}
-
-    ~AVLTree()
-    {
-        cleanup(root);
-    }
-
-    void insert(string key)
-    {
-        root = insert(root, key);
-        cout << "Added '" << key << "' to optimized index.\n";
-    }
-
-    bool search(string key)
-    {
-        AVLNode* result = search(root, key);
-        return result != nullptr;
-    }
-
-    void display()
-    {
-        cout << "AVL Tree (Balanced Index): ";
-        inOrder(root);
-        cout << endl;
+        retired.resize(kept);
     }
 };
 
-void garbageCollection()
-{
-    cout << "Running garbage collection to optimize file system..." << endl;
-    cout << "Garbage collection completed. File system optimized." << endl;
-}
+EpochReclaimer epochs;
 
-class Folder
+class EpochGuard
 {
 public:
-    treenode* root;
-    treenode* currentfolder;
-    Folder(string rootName)
+    EpochGuard()
     {
-        root = new treenode(rootName);
-        currentfolder = root;
+        epochs.enter();
     }
-    ~Folder()
+    ~EpochGuard()
     {
-        delete root;
+        epochs.exit();
     }
+    EpochGuard(const EpochGuard&) = delete;
+};
 
-    bool isEmpty() const
+//  Password Hashing (PBKDF2-HMAC-SHA256)
+class PasswordHasher
+{
+    static uint32_t rotr(uint32_t x, int n)
     {
-        return root == nullptr;
+        return (x >> n) | (x << (32 - n));
     }
 
-    void optimizeStructure()
+    struct Sha256
     {
-        cout << "Optimizing folder structure using AVL balancing...\n";
-        AVLTree optimizedIndex;
+        uint32_t h[8];
+        unsigned char block[64];
+        size_t blockLen;
+        uint64_t totalLen;
 
-        // we'll add current folder contents to AVL tree
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
+        Sha256()
         {
-            optimizedIndex.insert(child->name);
-            child = child->nextsibling;
+            static const uint32_t init[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+                                              0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19 };
+            memcpy(h, init, sizeof(h));
+            blockLen = 0;
+            totalLen = 0;
         }
 
-        optimizedIndex.display();
-        garbageCollection();
-        cout << "Folder structure optimization complete.\n";
-    }
-
-    void createFolder(string foldername)
-    {
-        treenode* existing = findChildByName(currentfolder, foldername);
-        if (existing != nullptr && existing->isFolder)
+        void compress(const unsigned char* p)
         {
-            cout << "Folder '" << foldername << "' already exists in current directory." << endl;
-            return;
+            static const uint32_t k[64] = {
+                0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+                0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+                0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+                0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+                0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+                0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+                0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+                0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2 };
+            uint32_t w[64];
+            for (int i = 0; i < 16; i++)
+            {
+                w[i] = (uint32_t)p[i * 4] << 24 | (uint32_t)p[i * 4 + 1] << 16 |
+                    (uint32_t)p[i * 4 + 2] << 8 | (uint32_t)p[i * 4 + 3];
+            }
+            for (int i = 16; i < 64; i++)
+            {
+                uint32_t s0 = rotr(w[i - 15], 7) ^ rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+                uint32_t s1 = rotr(w[i - 2], 17) ^ rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+                w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+            }
+            uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4], f = h[5], g = h[6], hh = h[7];
+            for (int i = 0; i < 64; i++)
+            {
+                uint32_t t1 = hh + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+                uint32_t t2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+                hh = g; g = f; f = e; e = d + t1;
+                d = c; c = b; b = a; a = t1 + t2;
+            }
+            h[0] += a; h[1] += b; h[2] += c; h[3] += d;
+            h[4] += e; h[5] += f; h[6] += g; h[7] += hh;
         }
-        treenode* newfolder = new treenode(foldername, true);
-        newfolder->parent = currentfolder;
-        if (currentfolder->firstchild == nullptr)
+
+        void update(const unsigned char* data, size_t len)
         {
-            currentfolder->firstchild = newfolder;
+            totalLen += len;
+            while (len > 0)
+            {
+                size_t take = min(len, (size_t)64 - blockLen);
+                memcpy(block + blockLen, data, take);
+                blockLen += take;
+                data += take;
+                len -= take;
+                if (blockLen == 64)
+                {
+                    compress(block);
+                    blockLen = 0;
+                }
+            }
         }
-        else
+
+        void finish(unsigned char out[32])
         {
-            treenode* sibling = currentfolder->firstchild;
-            while (sibling->nextsibling != nullptr)
+            uint64_t bits = totalLen * 8;
+            block[blockLen++] = 0x80;
+            if (blockLen > 56)
+            {
+                memset(block + blockLen, 0, 64 - blockLen);
+                compress(block);
+                blockLen = 0;
+            }
+            memset(block + blockLen, 0, 56 - blockLen);
+            for (int i = 0; i < 8; i++)
+                block[56 + i] = (unsigned char)(bits >> (56 - 8 * i));
+            compress(block);
+            for (int i = 0; i < 8; i++)
             {
-                sibling = sibling->nextsibling;
+                out[i * 4] = (unsigned char)(h[i] >> 24);
+                out[i * 4 + 1] = (unsigned char)(h[i] >> 16);
+                out[i * 4 + 2] = (unsigned char)(h[i] >> 8);
+                out[i * 4 + 3] = (unsigned char)h[i];
             }
-            sibling->nextsibling = newfolder;
         }
-        cout << "Folder '" << foldername << "' created successfully." << endl;
-    }
+    };
 
-    void createFile(string filename, const string& content)
+    // HMAC key pads are hashed once up front so each PBKDF2 round costs two compressions
+    struct HmacKey
     {
-        treenode* existing = findChildByName(currentfolder, filename);
-        if (existing != nullptr && !existing->isFolder)
+        Sha256 inner, outer;
+        HmacKey(const string& key)
         {
-            cout << "File '" << filename << "' already exists in current directory." << endl;
-            cout << "Would you like to update its content? If yes then enter(Y/y), otherwise anything: ";
-            char choice;
-            cin >> choice;
-            cin.ignore();
-            if (choice == 'y' || choice == 'Y')
+            unsigned char k[64] = { 0 };
+            if (key.size() > 64)
             {
-                updateFile(filename, content);
-                return;
+                Sha256 kh;
+                kh.update((const unsigned char*)key.data(), key.size());
+                kh.finish(k);
             }
             else
             {
-                return;
+                memcpy(k, key.data(), key.size());
+            }
+            unsigned char ipad[64], opad[64];
+            for (int i = 0; i < 64; i++)
+            {
+                ipad[i] = k[i] ^ 0x36;
+                opad[i] = k[i] ^ 0x5c;
             }
+            inner.update(ipad, 64);
+            outer.update(opad, 64);
         }
-        treenode* newfile = new treenode(filename, false);
-        newfile->fileVersion = new FileVersioning();
-        newfile->fileVersion->addVersion(content);
-        newfile->parent = currentfolder;
-        if (currentfolder->firstchild == nullptr)
+
+        void mac(const unsigned char* data, size_t len, unsigned char out[32]) const
         {
-            currentfolder->firstchild = newfile;
+            Sha256 in = inner;
+            in.update(data, len);
+            unsigned char tmp[32];
+            in.finish(tmp);
+            Sha256 ou = outer;
+            ou.update(tmp, 32);
+            ou.finish(out);
         }
-        else
+    };
+
+    static string toHex(const unsigned char* data, size_t len)
+    {
+        static const char digits[] = "0123456789abcdef";
+        string hex(len * 2, '0');
+        for (size_t i = 0; i < len; i++)
         {
-            treenode* sibling = currentfolder->firstchild;
-            while (sibling->nextsibling != nullptr)
-            {
-                sibling = sibling->nextsibling;
-            }
-            sibling->nextsibling = newfile;
+            hex[i * 2] = digits[data[i] >> 4];
+            hex[i * 2 + 1] = digits[data[i] & 15];
         }
-        cout << "File '" << filename << "' created successfully." << endl;
+        return hex;
     }
 
-    treenode* findChildByName(treenode* parent, string name) const
+public:
+    static const int DEFAULT_ITERATIONS = 10000;
+
+    static string randomHex(size_t bytes)
     {
-        treenode* child = parent->firstchild;
-        while (child != nullptr)
+        static random_device rd;
+        unsigned char buf[32];
+        string hex;
+        while (bytes > 0)
         {
-            if (child->name == name)
-            {
-                return child;
-            }
-            child = child->nextsibling;
+            size_t take = min(bytes, sizeof(buf));
+            for (size_t i = 0; i < take; i++)
+                buf[i] = (unsigned char)(rd() & 0xff);
+            hex += toHex(buf, take);
+            bytes -= take;
         }
-        return nullptr;
+        return hex;
     }
 
-    bool navigateToFolder(string folderName)
+    // PBKDF2-HMAC-SHA256 producing a single 32-byte block
+    static string pbkdf2(const string& password, const string& salt, int iterations)
     {
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
+        HmacKey key(password);
+        string first = salt;
+        first += string("\0\0\0\1", 4);
+        unsigned char u[32], result[32];
+        key.mac((const unsigned char*)first.data(), first.size(), u);
+        memcpy(result, u, 32);
+        for (int i = 1; i < iterations; i++)
         {
-            if (child->name == folderName && child->isFolder)
-            {
-                currentfolder = child;
-                cout << "Changed directory to: " << folderName << endl;
-                return true;
-            }
-            child = child->nextsibling;
+            key.mac(u, 32, u);
+            for (int j = 0; j < 32; j++)
+                result[j] ^= u[j];
         }
-        cout << "Folder '" << folderName << "' not found." << endl;
-        return false;
+        return toHex(result, 32);
     }
 
-    bool navigateUp()
+    // Encoded as "pbkdf2$<iterations>$<salt>$<hash>"
+    static string hash(const string& password, int iterations)
     {
-        if (currentfolder->parent != nullptr)
-        {
-            currentfolder = currentfolder->parent;
-            cout << "Changed directory to parent folder." << endl;
-            return true;
-        }
-        cout << "Already at root directory." << endl;
-        return false;
+        string salt = randomHex(16);
+        return "pbkdf2$" + to_string(iterations) + "$" + salt + "$" + pbkdf2(password, salt, iterations);
     }
 
-    bool deleteFolder(string folderName)
+    static int iterationsOf(const string& encoded)
     {
-        treenode* prev = nullptr;
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
-        {
-            if (child->name == folderName && child->isFolder)
-            {
-                if (prev == nullptr)
-                {
-                    currentfolder->firstchild = child->nextsibling;
-                }
-                else
-                {
-                    prev->nextsibling = child->nextsibling;
-                }
-                treenode* next = child->nextsibling;
-                child->nextsibling = nullptr;
-                delete child;
-                cout << "Folder '" << folderName << "' deleted successfully." << endl;
-                return true;
-            }
-            prev = child;
-            child = child->nextsibling;
-        }
-        cout << "Folder '" << folderName << "' not found." << endl;
-        return false;
+        size_t a = encoded.find('$');
+        size_t b = encoded.find('$', a + 1);
+        if (a == string::npos || b == string::npos)
+            return 0;
+        return atoi(encoded.substr(a + 1, b - a - 1).c_str());
     }
 
-    void deleteFile(string filename, RecycleBin& recycle)
+    static bool verify(const string& password, const string& encoded)
     {
-        treenode* prev = nullptr;
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
+        size_t a = encoded.find('$');
+        size_t b = (a == string::npos) ? a : encoded.find('$', a + 1);
+        size_t c = (b == string::npos) ? b : encoded.find('$', b + 1);
+        if (c == string::npos)
+            return false;
+        int iterations = atoi(encoded.substr(a + 1, b - a - 1).c_str());
+        if (iterations <= 0)
+            return false;
+        string expected = encoded.substr(c + 1);
+        string actual = pbkdf2(password, encoded.substr(b + 1, c - b - 1), iterations);
+        if (actual.size() != expected.size())
+            return false;
+        // Constant-time comparison
+        unsigned char diff = 0;
+        for (size_t i = 0; i < actual.size(); i++)
+            diff |= (unsigned char)(actual[i] ^ expected[i]);
+        return diff == 0;
+    }
+};
+
+//  User Graph System 
+const int MAX_USERS = 10;
+const int MAX_GROUPS = 10;
+// Users occupy vertices [0, MAX_USERS), sharing groups the vertices after them
+const int MAX_VERTICES = MAX_USERS + MAX_GROUPS;
+
+typedef bitset<MAX_VERTICES> VertexSet;
+
+enum Role { ADMIN = 1, EDITOR = 2, VIEWER = 3 };
+
+struct User
+{
+    string username;
+    string password;         // PasswordHasher encoding, never plain text
+    string securityQuestion; // hashed the same way as the password
+    string logoutTime;
+    Role role = VIEWER;
+};
+
+class Graph
+{
+    int** adj;
+    int size;
+    VertexSet* out;   // adj rows as bitsets
+    VertexSet* reach; // transitive closure: reach[u][v] means v can reach u's files
+
+    // Rebuilds one closure row by a bitset BFS over the direct edges
+    void recomputeRow(int u)
+    {
+        VertexSet visited = out[u];
+        VertexSet frontier = visited;
+        while (frontier.any())
         {
-            if (child->name == filename && !child->isFolder && child->fileVersion != nullptr)
+            VertexSet next;
+            for (int i = 0; i < size; i++)
             {
-                File* file = new File(child->name, child->fileVersion->getLatestContent());
-                recycle.push(file);
-                if (prev == nullptr)
-                {
-                    currentfolder->firstchild = child->nextsibling;
-                }
-                else
-                {
-                    prev->nextsibling = child->nextsibling;
-                }
-                treenode* next = child->nextsibling;
-                child->nextsibling = nullptr;
-                delete child;
-                cout << "File '" << filename << "' deleted and moved to Recycle Bin." << endl;
-                return;
+                if (frontier.test(i))
+                    next |= out[i];
             }
-            prev = child;
-            child = child->nextsibling;
+            frontier = next & ~visited;
+            visited |= next;
         }
-        cout << "File '" << filename << "' not found." << endl;
+        reach[u] = visited;
     }
 
-    void restoreFile(string filename, RecycleBin& recycle)
+public:
+    Graph(int n)
     {
-        File* file = recycle.restoreFileByName(filename);
-        if (file != nullptr)
+        if (n > MAX_VERTICES)
+            throw invalid_argument("Graph size exceeds MAX_VERTICES.");
+        size = n;
+        adj = new int* [n];
+        for (int i = 0; i < n; i++)
         {
-            createFile(file->name, file->content);
-            delete file;
+            adj[i] = new int[n];
+            for (int j = 0; j < n; j++)
+            {
+                adj[i][j] = 0;
+            }
         }
+        out = new VertexSet[n];
+        reach = new VertexSet[n];
+        memStats.add(MEM_SHARING, graphBytes());
     }
 
-    void listCurrent() const
+    size_t graphBytes() const
     {
-        if (currentfolder == nullptr)
+        return size * (sizeof(int*) + size * sizeof(int)) + 2 * size * sizeof(VertexSet);
+    }
+    ~Graph()
+    {
+        for (int i = 0; i < size; i++)
         {
-            cout << "Error: No current folder selected." << endl;
-            return;
+            delete[] adj[i];
         }
+        delete[] adj;
+        delete[] out;
+        delete[] reach;
+        memStats.remove(MEM_SHARING, graphBytes());
+    }
 
-        treenode* child = currentfolder->firstchild;
-        if (child == nullptr)
-        {
-            cout << "Empty folder." << endl;
+    void addEdge(int u, int v)
+    {
+        if (adj[u][v])
             return;
-        }
+        adj[u][v] = 1; // Directed edge: permission granted
+        out[u].set(v);
 
-        cout << "\nCurrent directory: ";
-        string path = "";
-        treenode* temp = currentfolder;
-        while (temp != nullptr)
+        // Everything that reached u now also reaches v and all v reaches
+        VertexSet gained = reach[v];
+        gained.set(v);
+        for (int x = 0; x < size; x++)
         {
-            if (temp->parent != nullptr)
-            {
-                path = temp->name + "/" + path;
-            }
-            else
-            {
-                path = temp->name + path;
-            }
-            temp = temp->parent;
+            if (x == u || reach[x].test(u))
+                reach[x] |= gained;
         }
-        cout << path << endl;
+    }
 
-        cout << "Contents:\n------------------------" << endl;
-        int folderCount = 0, fileCount = 0;
-        child = currentfolder->firstchild;
+    void removeEdge(int u, int v)
+    {
+        if (!adj[u][v])
+            return;
+        adj[u][v] = 0;
+        out[u].reset(v);
 
-        while (child != nullptr)
+        // Only rows that could route through u may lose reachability
+        VertexSet affected;
+        for (int x = 0; x < size; x++)
         {
-            if (child->isFolder)
-            {
-                cout << "[Folder] " << child->name << endl;
-                folderCount++;
-            }
-            child = child->nextsibling;
+            if (x == u || reach[x].test(u))
+                affected.set(x);
+        }
+        for (int x = 0; x < size; x++)
+        {
+            if (affected.test(x))
+                recomputeRow(x);
         }
+    }
 
-        child = currentfolder->firstchild;
-        while (child != nullptr)
+    bool hasEdge(int u, int v) const
+    {
+        return adj[u][v] != 0;
+    }
+
+    // O(1): answered from the cached closure
+    bool canReach(int u, int v) const
+    {
+        return reach[u].test(v);
+    }
+
+    const VertexSet& reachableFrom(int u) const
+    {
+        return reach[u];
+    }
+
+    void displayGraph(const User users[], int userCount) const
+    {
+        bool anyConnection = false;
+        for (int i = 0; i < userCount; i++)
         {
-            if (!child->isFolder)
+            for (int j = 0; j < userCount; j++)
             {
-                cout << "[File] " << child->name;
-                if (child->fileVersion != nullptr)
+                if (adj[i][j])
                 {
-                    cout << " (Version: " << child->fileVersion->getCurrentVersionNumber() << ")";
+                    ENGINE_LOG << users[i].username << " (" << getRoleName(users[i].role) << ") --> "
+                        << users[j].username << " (" << getRoleName(users[j].role) << ")\n";
+                    anyConnection = true;
                 }
-                cout << endl;
-                fileCount++;
             }
-            child = child->nextsibling;
         }
+        if (!anyConnection)
+        {
+            ENGINE_LOG << "No sharing connections found." << endl;
+        }
+    }
+
+    string getRoleName(Role role) const
+    {
+        switch (role)
+        {
+        case ADMIN:
+            return "Admin";
+        case EDITOR:
+            return "Editor";
+        case VIEWER:
+            return "Viewer";
+        default:
+            return "Unknown";
+        }
+    }
+};
+
+class UserSystem
+{
+public:
+    User users[MAX_USERS];
+    int userCount;
+    string groups[MAX_GROUPS];
+    int groupCount;
+    Graph userGraph;
+    int hashIterations; // work factor for new and upgraded password hashes
+
+    struct Session
+    {
+        int user;
+        time_t lastUsed;
+    };
+    static const int SESSION_IDLE_SECONDS = 1800;
+    unordered_map<string, Session> sessions;
+    mutex sessionLock; // sessions are checked on every command, from any thread
 
-        cout << "------------------------" << endl;
-        cout << folderCount << " folder(s), " << fileCount << " file(s)" << endl;
+    UserSystem() : userGraph(MAX_VERTICES)
+    {
+        userCount = 0;
+        groupCount = 0;
+        hashIterations = PasswordHasher::DEFAULT_ITERATIONS;
     }
 
-    void preOrderTraversal(treenode* node, int depth = 0) const
+    void setHashIterations(int iterations)
     {
-        if (node == nullptr) return;
-        for (int i = 0; i < depth; i++)
+        if (iterations < 1)
+            throw invalid_argument("Work factor must be at least 1 iteration.");
+        hashIterations = iterations;
+    }
+
+    int findGroupIndex(const string& gname) const
+    {
+        for (int i = 0; i < groupCount; i++)
         {
-            cout << "  ";
+            if (groups[i] == gname)
+                return i;
         }
-        if (node->isFolder)
+        return -1;
+    }
+
+    int groupVertex(int groupIdx) const
+    {
+        return MAX_USERS + groupIdx;
+    }
+
+    int findUserIndex(const string& uname) const
+    {
+        for (int i = 0; i < userCount; i++)
         {
-            cout << "[+] " << node->name << "/" << endl;
+            if (users[i].username == uname)
+                return i;
         }
-        else
+        return -1;
+    }
+
+    void addUser(string uname, string pass, string secQ, Role role)
+    {
+        try
         {
-            cout << "[-] " << node->name << endl;
+            if (userCount >= MAX_USERS)
+                throw runtime_error("User limit reached.");
+
+            if (findUserIndex(uname) != -1)
+                throw invalid_argument("Username already exists.");
+
+            users[userCount++] = { uname, PasswordHasher::hash(pass, hashIterations),
+                PasswordHasher::hash(secQ, hashIterations), "", role };
+            ENGINE_LOG << "User added successfully with role: " << userGraph.getRoleName(role) << "\n";
         }
-        treenode* child = node->firstchild;
-        while (child != nullptr)
+        catch (const exception& e)
         {
-            preOrderTraversal(child, depth + 1);
-            child = child->nextsibling;
+            ENGINE_LOG << "Error adding user: " << e.what() << endl;
         }
     }
 
-    void listAllFolders() const
+    // Pays the slow hash once and returns a session token, or "" on failure
+    string authenticate(const string& uname, const string& pass)
     {
-        cout << "\nComplete Directory Structure:\n=============================" << endl;
-        preOrderTraversal(root);
-        cout << "=============================" << endl;
+        int idx = findUserIndex(uname);
+        if (idx == -1 || !PasswordHasher::verify(pass, users[idx].password))
+            return "";
+
+        // Transparently upgrade hashes made with an older work factor
+        if (PasswordHasher::iterationsOf(users[idx].password) != hashIterations)
+            users[idx].password = PasswordHasher::hash(pass, hashIterations);
+
+        string token = PasswordHasher::randomHex(16);
+        Session session = { idx, time(0) };
+        lock_guard<mutex> guard(sessionLock);
+        sessions[token] = session;
+        memStats.add(MEM_SESSIONS, sessionBytes(token));
+        return token;
     }
 
-    void updateFile(string filename, const string& newContent)
+    string login(string uname, string pass)
     {
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
+        try
         {
-            if (child->name == filename && !child->isFolder && child->fileVersion != nullptr)
-            {
-                child->fileVersion->addVersion(newContent);
-                cout << "File '" << filename << "' updated successfully." << endl;
-                return;
-            }
-            child = child->nextsibling;
+            string token = authenticate(uname, pass);
+            if (token.empty())
+                throw invalid_argument("Invalid username or password.");
+
+            ENGINE_LOG << "Login successful.\n";
+            return token;
+        }
+        catch (const exception& e)
+        {
+            ENGINE_LOG << "Login failed: " << e.what() << endl;
+            return "";
         }
-        cout << "File '" << filename << "' not found in current directory." << endl;
     }
 
-    void viewFileHistory(string filename)
+    // Cheap per-operation authorization: a hash lookup, no password work
+    int sessionUser(const string& token)
     {
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
+        lock_guard<mutex> guard(sessionLock);
+        unordered_map<string, Session>::iterator it = sessions.find(token);
+        if (it == sessions.end())
+            return -1;
+        time_t now = time(0);
+        if (now - it->second.lastUsed > SESSION_IDLE_SECONDS)
         {
-            if (child->name == filename && !child->isFolder && child->fileVersion != nullptr)
-            {
-                child->fileVersion->viewHistory();
-                return;
-            }
-            child = child->nextsibling;
+            memStats.remove(MEM_SESSIONS, sessionBytes(it->first));
+            sessions.erase(it);
+            return -1;
         }
-        cout << "File '" << filename << "' not found in current directory." << endl;
+        it->second.lastUsed = now;
+        return it->second.user;
     }
 
-    void rollbackFile(string filename, int versionNumber)
+    void endSession(const string& token)
     {
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
-        {
-            if (child->name == filename && !child->isFolder && child->fileVersion != nullptr)
-            {
-                child->fileVersion->rollbackToVersion(versionNumber);
-                return;
-            }
-            child = child->nextsibling;
-        }
-        cout << "File '" << filename << "' not found in current directory." << endl;
+        lock_guard<mutex> guard(sessionLock);
+        if (sessions.erase(token) > 0)
+            memStats.remove(MEM_SESSIONS, sessionBytes(token));
     }
 
-    treenode* accessFile(string filename, RecentFiles& recent)
+    static size_t sessionBytes(const string& token)
     {
-        treenode* child = currentfolder->firstchild;
-        while (child != nullptr)
+        return sizeof(pair<const string, Session>) + token.capacity() + CONTAINER_NODE_OVERHEAD;
+    }
+
+    void logout(string uname, string time)
+    {
+        int idx = findUserIndex(uname);
+        if (idx != -1)
         {
-            if (child->name == filename && !child->isFolder && child->fileVersion != nullptr)
+            users[idx].logoutTime = time;
+            // Drop every session the user still holds
+            lock_guard<mutex> guard(sessionLock);
+            for (unordered_map<string, Session>::iterator it = sessions.begin(); it != sessions.end();)
             {
-                File* fileObj = new File(child->name, child->fileVersion->getLatestContent());
-                recent.accessFile(fileObj);
-                return child;
+                if (it->second.user == idx)
+                {
+                    memStats.remove(MEM_SESSIONS, sessionBytes(it->first));
+                    it = sessions.erase(it);
+                }
+                else
+                    ++it;
             }
-            child = child->nextsibling;
+            ENGINE_LOG << "User logged out at " << time << endl;
         }
-        cout << "File '" << filename << "' not found in current directory." << endl;
-        return nullptr;
     }
 
-    string getCurrentPath() const
+    void forgotPassword(string uname, string ans)
     {
-        string path = "";
-        treenode* temp = currentfolder;
-        while (temp != nullptr)
+        int idx = findUserIndex(uname);
+        if (idx != -1)
         {
-            if (temp->parent != nullptr)
+            if (PasswordHasher::verify(ans, users[idx].securityQuestion))
             {
-                path = temp->name + "/" + path;
+                cout << "Enter new password: ";
+                string newpass;
+                cin >> newpass;
+                users[idx].password = PasswordHasher::hash(newpass, hashIterations);
+                ENGINE_LOG << "Password updated.\n";
             }
             else
             {
-                path = temp->name + path;
+                ENGINE_LOG << "Security answer incorrect.\n";
             }
-            temp = temp->parent;
         }
-        return path;
+        else
+        {
+            ENGINE_LOG << "Username not found.\n";
+        }
     }
 
-    void searchFile(string filename, treenode* node = nullptr) const
+    void shareFile(string from, string to)
     {
-        if (node == nullptr)
+        try
         {
-            node = root;
-            cout << "Searching for file '" << filename << "'..." << endl;
-        }
-        treenode* child = node->firstchild;
-        while (child != nullptr)
+            int u = findUserIndex(from);
+            int v = findUserIndex(to);
+            if (u == -1 || v == -1)
+                throw invalid_argument("One or both users not found.");
+
+            userGraph.addEdge(u, v);
+            ENGINE_LOG << "File shared from " << from << " to " << to << endl;
+        }
+        catch (const exception& e)
         {
-            if (!child->isFolder && child->name == filename)
-            {
-                string path = "";
-                treenode* temp = child->parent;
-                while (temp != nullptr)
-                {
-                    if (temp->parent != nullptr)
-                    {
-                        path = temp->name + "/" + path;
-                    }
-                    else
-                    {
-                        path = temp->name + path;
-                    }
-                    temp = temp->parent;
-                }
-                cout << "Found: " << path << filename << endl;
-            }
-            if (child->isFolder)
-            {
-                searchFile(filename, child);
-            }
-            child = child->nextsibling;
+            ENGINE_LOG << "Error in file sharing: " << e.what() << endl;
         }
     }
-};
 
-class FileCompression
-{
-public:
-    // Run-Length Encoding (RLE)
-    static string encodeRLE(const string& input)
+    void unshareFile(string from, string to)
     {
-        string encoded;
-        if (input.empty()) return encoded;
-
-        char currentChar = input[0];
-        int count = 1;
-
-        for (int i = 1; i < input.length(); i++)
+        int u = findUserIndex(from);
+        int v = findUserIndex(to);
+        if (u != -1 && v != -1)
         {
-            if (input[i] == currentChar)
-            {
-                count++;
-            }
-            else
-            {
-                encoded += to_string(count) + currentChar;
-                currentChar = input[i];
-                count = 1;
-            }
+            userGraph.removeEdge(u, v);
+            ENGINE_LOG << "File unshared from " << from << " to " << to << endl;
+        }
+        else
+        {
+            ENGINE_LOG << "User not found.\n";
         }
-
-        encoded += to_string(count) + currentChar;
-        cout << "File compressed using RLE.\n";
-        return encoded;
     }
 
-    static string decodeRLE(const string& input)
+    void createGroup(const string& gname)
     {
-        string decoded;
-        string countStr;
+        try
+        {
+            if (groupCount >= MAX_GROUPS)
+                throw runtime_error("Group limit reached.");
+            if (findGroupIndex(gname) != -1)
+                throw invalid_argument("Group already exists.");
 
-        for (int i = 0; i < input.length(); i++)
+            groups[groupCount++] = gname;
+            ENGINE_LOG << "Group '" << gname << "' created.\n";
+        }
+        catch (const exception& e)
         {
-            if (isdigit(input[i]))
-            {
-                countStr += input[i];
-            }
-            else
-            {
-                int count = stoi(countStr);
-                for (int j = 0; j < count; j++)
-                {
-                    decoded += input[i];
-                }
-                countStr = "";
-            }
+            ENGINE_LOG << "Error creating group: " << e.what() << endl;
         }
-
-        cout << "File decompressed from RLE.\n";
-        return decoded;
     }
 
-    // Dictionary-based compression replacement 
-    static string encodeDictionary(const string& input)
+    void addUserToGroup(const string& gname, const string& uname)
     {
-        cout << "Dictionary-based compression unavailable. Using RLE instead." << endl;
-        return encodeRLE(input);
+        int g = findGroupIndex(gname);
+        int u = findUserIndex(uname);
+        if (g == -1 || u == -1)
+        {
+            ENGINE_LOG << "Group or user not found.\n";
+            return;
+        }
+        // Group -> member edge: whatever is shared with the group reaches the member
+        userGraph.addEdge(groupVertex(g), u);
+        ENGINE_LOG << uname << " added to group '" << gname << "'.\n";
     }
 
-    static string compressFile(const string& content, bool useRLE = true)
+    void removeUserFromGroup(const string& gname, const string& uname)
     {
-        return encodeRLE(content);
+        int g = findGroupIndex(gname);
+        int u = findUserIndex(uname);
+        if (g == -1 || u == -1)
+        {
+            ENGINE_LOG << "Group or user not found.\n";
+            return;
+        }
+        userGraph.removeEdge(groupVertex(g), u);
+        ENGINE_LOG << uname << " removed from group '" << gname << "'.\n";
     }
-};
 
-class CloudSync
-{
-private:
-    struct SyncTask
+    void shareWithGroup(const string& from, const string& gname)
     {
-        string operation; // "upload", "download", "delete"
-        string filename;
-        string content;
-        string timestamp;
-
-        SyncTask(string op, string file, string cont = "")
-            : operation(op), filename(file), content(cont)
+        int u = findUserIndex(from);
+        int g = findGroupIndex(gname);
+        if (u == -1 || g == -1)
         {
-            // Set timestamp
-            time_t now = time(0);
-            tm ltm;
-            localtime_s(&ltm, &now);
-            stringstream ss;
-            ss << 1900 + ltm.tm_year << "-"
-                << setw(2) << setfill('0') << 1 + ltm.tm_mon << "-"
-                << setw(2) << setfill('0') << ltm.tm_mday << " "
-                << setw(2) << setfill('0') << ltm.tm_hour << ":"
-                << setw(2) << setfill('0') << ltm.tm_min << ":"
-                << setw(2) << setfill('0') << ltm.tm_sec;
-            timestamp = ss.str();
+            ENGINE_LOG << "User or group not found.\n";
+            return;
         }
-    };
-
-    const int MAX_QUEUE_SIZE = 100;
-    SyncTask* queue[100];
-    int front, rear, count;
-    bool isRunning;
+        userGraph.addEdge(u, groupVertex(g));
+        ENGINE_LOG << "File shared from " << from << " to group '" << gname << "'" << endl;
+    }
 
-public:
-    CloudSync() : front(0), rear(-1), count(0), isRunning(false)
+    void expandGroup(const string& gname) const
     {
-        for (int i = 0; i < MAX_QUEUE_SIZE; i++)
+        int g = findGroupIndex(gname);
+        if (g == -1)
         {
-            queue[i] = nullptr;
+            ENGINE_LOG << "Group not found.\n";
+            return;
         }
+        ENGINE_LOG << "Members of group '" << gname << "':\n";
+        printReachableUsers(groupVertex(g));
     }
 
-    ~CloudSync()
+    // True if 'viewer' can reach files owned by 'owner' through any share chain
+    bool hasTransitiveAccess(const string& owner, const string& viewer) const
     {
-        for (int i = 0; i < MAX_QUEUE_SIZE; i++)
+        int o = findUserIndex(owner);
+        int v = findUserIndex(viewer);
+        if (o == -1 || v == -1)
+            return false;
+        return o == v || userGraph.canReach(o, v);
+    }
+
+    void printReachableUsers(int vertex) const
+    {
+        const VertexSet& r = userGraph.reachableFrom(vertex);
+        bool any = false;
+        for (int i = 0; i < userCount; i++)
         {
-            if (queue[i] != nullptr)
+            if (i != vertex && r.test(i))
             {
-                delete queue[i];
+                ENGINE_LOG << "  " << users[i].username << " (" << userGraph.getRoleName(users[i].role) << ")\n";
+                any = true;
             }
         }
+        if (!any)
+        {
+            ENGINE_LOG << "  (none)\n";
+        }
     }
 
-    void addSyncTask(const string& operation, const string& filename, const string& content = "")
+    void showSharingAccess(string uname) const
     {
-        if (count == MAX_QUEUE_SIZE)
+        int idx = findUserIndex(uname);
+        if (idx == -1)
         {
-            cout << "Sync queue is full. Waiting for tasks to complete." << endl;
+            ENGINE_LOG << "User not found.\n";
             return;
         }
+        ENGINE_LOG << "\nSharing connections for user: " << uname << endl;
+        userGraph.displayGraph(users, userCount);
+        ENGINE_LOG << "\nUsers who can reach " << uname << "'s files (direct, re-shared or via groups):\n";
+        printReachableUsers(idx);
+    }
 
-        rear = (rear + 1) % MAX_QUEUE_SIZE;
-        queue[rear] = new SyncTask(operation, filename, content);
-        count++;
-
-        cout << "Added " << operation << " task for file '" << filename << "' to sync queue." << endl;
-
-        // Start background sync if not already running
-        if (!isRunning)
+    void displayAllUsers() const
+    {
+        if (userCount == 0)
         {
-            startSync();
+            ENGINE_LOG << "No users in the system.\n";
+            return;
+        }
+        ENGINE_LOG << "\nAll Users in the System:\n";
+        ENGINE_LOG << "------------------------\n";
+        for (int i = 0; i < userCount; i++)
+        {
+            ENGINE_LOG << (i + 1) << ". " << users[i].username << " (" << userGraph.getRoleName(users[i].role) << ")\n";
         }
     }
 
-    void startSync()
+    Role getCurrentUserRole(const string& uname) const
     {
-        isRunning = true;
-        cout << "Background sync started.\n";
-        processSyncQueue();
+        int idx = findUserIndex(uname);
+        if (idx != -1) 
+            return users[idx].role;
+        return VIEWER; // Default fallback
     }
+};
 
-    void processSyncQueue()
+// One piece of a file's content. Versions that didn't change a piece share it.
+struct ContentExtent
+{
+    const string bytes;
+    ContentExtent(string&& b) : bytes(move(b))
     {
-        while (count > 0)
-        {
-            SyncTask* task = queue[front];
-            front = (front + 1) % MAX_QUEUE_SIZE;
-            count--;
-
-            // Simulate cloud operations
-            cout << "Syncing: " << task->operation << " file '" << task->filename
-                << "' at " << task->timestamp << endl;
-
-            // Simulate some processing time
-            cout << "Sync completed for file '" << task->filename << "'.\n";
-
-            delete task;
-        }
-
-        isRunning = false;
-        cout << "All sync tasks completed.\n";
+        memStats.add(MEM_VERSIONS, footprint());
+    }
+    ~ContentExtent()
+    {
+        memStats.remove(MEM_VERSIONS, footprint());
     }
-};
 
-class FileHashTable
-{
-private:
-    static const int TABLE_SIZE = 100;
-    struct FileMetadata
+    size_t footprint() const
     {
-        string name;
-        string path;
-        string owner;
-        string type;
-        long size;
-        string creationDate;
-        FileMetadata* next; // For collision handling
+        return sizeof(ContentExtent) + bytes.capacity();
+    }
+};
 
-        FileMetadata(string n, string p, string o, string t, long s, string d)
-            : name(n), path(p), owner(o), type(t), size(s), creationDate(d), next(nullptr) {
-        }
+typedef shared_ptr<const ContentExtent> ExtentRef;
 
-    };
+// Immutable content of one version, as a run of extents of at most EXTENT_SIZE bytes.
+// Copies of a file share the blob, and a ranged write makes a new blob that shares
+// every extent it doesn't touch, so editing a few bytes of a large file costs one extent.
+struct ContentBlob
+{
+    static const size_t EXTENT_SIZE = 64 * 1024;
 
-    FileMetadata* table[TABLE_SIZE];
+    const vector<ExtentRef> extents; // none empty
+    const vector<size_t> starts;     // offset of each extent
+    const size_t length;
 
-    // Hash function
-    int hashFunction(const string& filename) const
+private:
+    static vector<ExtentRef> split(string&& b)
     {
-        int hash = 0;
-        for (int i = 0; i < filename.length(); i++)
+        vector<ExtentRef> out;
+        if (b.size() <= EXTENT_SIZE)
         {
-            char c = filename[i];
-            hash = (hash * 31 + c) % TABLE_SIZE;
+            // Small content keeps its buffer: nothing is copied
+            if (!b.empty())
+                out.push_back(make_shared<const ContentExtent>(move(b)));
+            return out;
         }
-        return hash;
+        out.reserve((b.size() + EXTENT_SIZE - 1) / EXTENT_SIZE);
+        for (size_t at = 0; at < b.size(); at += EXTENT_SIZE)
+            out.push_back(make_shared<const ContentExtent>(b.substr(at, EXTENT_SIZE)));
+        return out;
     }
 
-public:
-    FileHashTable()
+    static vector<size_t> offsetsOf(const vector<ExtentRef>& e)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
+        vector<size_t> out(e.size());
+        size_t at = 0;
+        for (size_t i = 0; i < e.size(); i++)
         {
-            table[i] = nullptr;
+            out[i] = at;
+            at += e[i]->bytes.size();
         }
+        return out;
     }
 
-    ~FileHashTable()
+    static size_t lengthOf(const vector<ExtentRef>& e)
     {
-        for (int i = 0; i < TABLE_SIZE; i++)
-        {
-            FileMetadata* current = table[i];
-            while (current != nullptr)
-            {
-                FileMetadata* temp = current;
-                current = current->next;
-                delete temp;
-            }
-        }
+        size_t total = 0;
+        for (size_t i = 0; i < e.size(); i++)
+            total += e[i]->bytes.size();
+        return total;
     }
 
-    void insert(const string& filename, const string& path, const string& owner,
-        const string& type, long size, const string& date)
+public:
+    ContentBlob(const string& b) : ContentBlob(string(b)) {}
+    ContentBlob(string&& b) : ContentBlob(split(move(b))) {}
+    ContentBlob(vector<ExtentRef>&& e) : extents(move(e)), starts(offsetsOf(extents)), length(lengthOf(extents))
     {
-        int index = hashFunction(filename);
-        FileMetadata* newFile = new FileMetadata(filename, path, owner, type, size, date);
+        memStats.add(MEM_VERSIONS, footprint());
+    }
+    ~ContentBlob()
+    {
+        memStats.remove(MEM_VERSIONS, footprint());
+    }
 
-        if (table[index] == nullptr)
-        {
-            table[index] = newFile;
-        }
-        else
-        {
-            // Handle collision using chaining
-            FileMetadata* current = table[index];
-            while (current->next != nullptr)
-            {
-                current = current->next;
-            }
-            current->next = newFile;
-        }
-        cout << "File indexed in hash table.\n";
+    size_t size() const
+    {
+        return length;
     }
 
-    FileMetadata* lookup(const string& filename) const
+    // The extent holding byte 'offset' (offset < size())
+    size_t locate(size_t offset) const
     {
-        int index = hashFunction(filename);
-        FileMetadata* current = table[index];
+        return (size_t)(upper_bound(starts.begin(), starts.end(), offset) - starts.begin()) - 1;
+    }
 
-        while (current != nullptr)
+    // Visits up to 'len' bytes from 'offset' as views into the extents, in order
+    template <typename Visit>
+    void forEachRange(size_t offset, size_t len, Visit visit) const
+    {
+        if (offset >= length || len == 0)
+            return;
+        len = min(len, length - offset);
+        for (size_t i = locate(offset); i < extents.size() && len > 0; i++)
         {
-            if (current->name == filename)
-            {
-                return current;
-            }
-            current = current->next;
+            string_view piece(extents[i]->bytes);
+            size_t from = offset - starts[i];
+            size_t take = min(piece.size() - from, len);
+            visit(piece.substr(from, take));
+            offset += take;
+            len -= take;
         }
-        return nullptr;
     }
 
-    void removeFile(const string& filename)
+    // Up to 'len' bytes from 'offset'; copies only that range
+    string read(size_t offset, size_t len) const
     {
-        int index = hashFunction(filename);
-        FileMetadata* current = table[index];
-        FileMetadata* prev = nullptr;
+        string out;
+        if (offset < length)
+            out.reserve(min(len, length - offset));
+        forEachRange(offset, len, [&](string_view piece) { out.append(piece); });
+        return out;
+    }
 
-        while (current != nullptr)
-        {
-            if (current->name == filename)
+    // Whether 'len' bytes from 'offset' match 'len' bytes of 'other' from 'otherOffset'
+    bool equalRange(size_t offset, const ContentBlob& other, size_t otherOffset, size_t len) const
+    {
+        if (offset + len > length || otherOffset + len > other.length)
+            return false;
+        bool same = true;
+        forEachRange(offset, len, [&](string_view piece) {
+            size_t at = otherOffset;
+            otherOffset += piece.size();
+            if (!same)
+                return;
+            other.forEachRange(at, piece.size(), [&](string_view theirs) {
+                if (same && memcmp(piece.data(), theirs.data(), theirs.size()) != 0)
+                    same = false;
+                piece.remove_prefix(theirs.size());
+            });
+        });
+        return same;
+    }
+
+    // The whole content in one string; prefer forEachExtent where a copy isn't needed
+    string str() const
+    {
+        return read(0, length);
+    }
+
+    template <typename Visit>
+    void forEachExtent(Visit visit) const
+    {
+        for (size_t i = 0; i < extents.size(); i++)
+            visit(string_view(extents[i]->bytes));
+    }
+
+    // A new blob with 'data' written at 'offset' (at most size(), so no holes). Extents wholly
+    // before or after the range are shared; the ones it overlaps are rebuilt, and the
+    // rebuilt run is re-split so no extent grows past EXTENT_SIZE.
+    shared_ptr<const ContentBlob> write(size_t offset, string_view data) const
+    {
+        size_t first = offset < length ? locate(offset) : extents.size();
+        // An append tops up a short last extent instead of starting a tiny new one
+        if (first == extents.size() && first > 0 && extents[first - 1]->bytes.size() < EXTENT_SIZE)
+            first--;
+        size_t end = offset + data.size();
+        size_t last = first < extents.size() ? first + 1 : first;
+        while (last < extents.size() && starts[last] < end)
+            last++;
+
+        string merged;
+        size_t runStart = first < extents.size() ? starts[first] : length;
+        for (size_t i = first; i < last; i++)
+            merged += extents[i]->bytes;
+        merged.replace(offset - runStart, min(data.size(), merged.size() - (offset - runStart)), data.data(), data.size());
+
+        vector<ExtentRef> out(extents.begin(), extents.begin() + first);
+        for (size_t at = 0; at < merged.size(); at += EXTENT_SIZE)
+            out.push_back(make_shared<const ContentExtent>(merged.substr(at, EXTENT_SIZE)));
+        out.insert(out.end(), extents.begin() + last, extents.end());
+        return make_shared<const ContentBlob>(move(out));
+    }
+
+    // The blob alone; extents account for their own bytes
+    size_t footprint() const
+    {
+        return sizeof(ContentBlob) + extents.capacity() * sizeof(ExtentRef) + starts.capacity() * sizeof(size_t);
+    }
+
+    // What freeing this blob would give back: itself and the extents nobody else holds
+    size_t exclusiveFootprint() const
+    {
+        size_t bytes = footprint();
+        for (size_t i = 0; i < extents.size(); i++)
+        {
+            if (extents[i].use_count() == 1)
+                bytes += extents[i]->footprint();
+        }
+        return bytes;
+    }
+
+    // Unused string capacity in extents nobody else holds
+    size_t slackBytes() const
+    {
+        size_t slack = 0;
+        for (size_t i = 0; i < extents.size(); i++)
+        {
+            if (extents[i].use_count() == 1)
+                slack += extents[i]->bytes.capacity() - extents[i]->bytes.size();
+        }
+        return slack;
+    }
+};
+
+// Immutable once made, so readers pass it around by reference count instead of copying
+typedef shared_ptr<const ContentBlob> ContentRef;
+
+// Takes the bytes over without copying them; every empty content shares one blob
+ContentRef makeContent(string bytes)
+{
+    static const ContentRef empty = make_shared<const ContentBlob>(string());
+    if (bytes.empty())
+        return empty;
+    return make_shared<const ContentBlob>(move(bytes));
+}
+
+// Assembles new content from ranges of existing blobs: a range that covers a whole extent
+// reuses it, and only partial ranges and literal bytes are copied
+class ContentBuilder
+{
+    vector<ExtentRef> extents;
+    string pending;
+
+    void flush()
+    {
+        if (pending.empty())
+            return;
+        extents.push_back(make_shared<const ContentExtent>(move(pending)));
+        pending.clear();
+    }
+
+public:
+    void append(string_view bytes)
+    {
+        while (!bytes.empty())
+        {
+            size_t take = min(ContentBlob::EXTENT_SIZE - pending.size(), bytes.size());
+            pending.append(bytes.substr(0, take));
+            bytes.remove_prefix(take);
+            if (pending.size() == ContentBlob::EXTENT_SIZE)
+                flush();
+        }
+    }
+
+    void append(const ContentBlob& blob, size_t offset, size_t len)
+    {
+        if (len == 0 || offset >= blob.size())
+            return;
+        len = min(len, blob.size() - offset);
+        for (size_t i = blob.locate(offset); i < blob.extents.size() && len > 0; i++)
+        {
+            const string& piece = blob.extents[i]->bytes;
+            size_t from = offset - blob.starts[i];
+            size_t take = min(piece.size() - from, len);
+            if (from == 0 && take == piece.size())
+            {
+                flush();
+                extents.push_back(blob.extents[i]);
+            }
+            else
+                append(string_view(piece).substr(from, take));
+            offset += take;
+            len -= take;
+        }
+    }
+
+    ContentRef finish()
+    {
+        flush();
+        if (extents.empty())
+            return makeContent(string());
+        return make_shared<const ContentBlob>(move(extents));
+    }
+};
+
+//  Version Diff and Merge
+// Diffs two versions line by line (byte by byte when either looks binary) and merges two
+// edits of a common base. Extents the versions share are skipped without being read; the
+// rest is tokenized in place, equal tokens get equal ids, and Myers' linear-space algorithm
+// runs on the ids. Content is only copied into the output.
+class ContentDiff
+{
+public:
+    // One changed region. Starts and counts are in lines (bytes for binary content) and
+    // 0-based; offsets and lengths are in bytes.
+    struct Hunk
+    {
+        size_t oldStart, oldCount, newStart, newCount;
+        size_t oldOffset, oldLength, newOffset, newLength;
+    };
+
+    struct Result
+    {
+        ContentRef from, to;
+        bool binary = false;
+        size_t removed = 0; // lines, or bytes for binary content
+        size_t added = 0;
+        vector<Hunk> hunks;
+    };
+
+    struct MergeResult
+    {
+        ContentRef content; // null when binary content conflicts: there are no markers for it
+        size_t conflicts = 0;
+    };
+
+private:
+    static const size_t BINARY_SNIFF = 8000;
+    // Past this many edits in one split the region is reported as replaced outright, which
+    // keeps badly diverged inputs from going quadratic
+    static const long long MAX_BISECT_EDITS = 4096;
+
+    struct Sequence
+    {
+        vector<uint32_t> ids;
+        vector<size_t> starts; // line mode: offset of each line, then one past the last
+    };
+
+    // Gives equal lines equal ids; lines are compared in place, never copied. Open
+    // addressing over one flat array, since a big file interns a line per slot.
+    class Interner
+    {
+        struct Rep
+        {
+            uint64_t hash;
+            const ContentBlob* blob;
+            size_t offset;
+            size_t length;
+        };
+        vector<uint32_t> slots; // id + 1, 0 when empty
+        vector<Rep> reps;
+
+        void grow()
+        {
+            vector<uint32_t> bigger(slots.empty() ? 1024 : slots.size() * 2, 0);
+            size_t mask = bigger.size() - 1;
+            for (size_t id = 0; id < reps.size(); id++)
+            {
+                size_t at = reps[id].hash & mask;
+                while (bigger[at] != 0)
+                    at = (at + 1) & mask;
+                bigger[at] = (uint32_t)id + 1;
+            }
+            slots.swap(bigger);
+        }
+
+    public:
+        uint32_t intern(uint64_t hash, const ContentBlob& blob, size_t offset, size_t length)
+        {
+            if ((reps.size() + 1) * 2 > slots.size())
+                grow();
+            size_t mask = slots.size() - 1;
+            size_t at = hash & mask;
+            for (; slots[at] != 0; at = (at + 1) & mask)
+            {
+                const Rep& r = reps[slots[at] - 1];
+                if (r.hash == hash && r.length == length && r.blob->equalRange(r.offset, blob, offset, length))
+                    return slots[at] - 1;
+            }
+            Rep r = { hash, &blob, offset, length };
+            reps.push_back(r);
+            slots[at] = (uint32_t)reps.size();
+            return slots[at] - 1;
+        }
+    };
+
+    static void tokenizeLines(const ContentBlob& blob, size_t lo, size_t hi, Interner& ids, Sequence& seq)
+    {
+        const uint64_t FNV_OFFSET = 1469598103934665603ULL, FNV_PRIME = 1099511628211ULL;
+        uint64_t hash = FNV_OFFSET;
+        size_t start = lo, at = lo;
+        blob.forEachRange(lo, hi - lo, [&](string_view piece) {
+            for (size_t i = 0; i < piece.size(); i++)
+            {
+                hash = (hash ^ (unsigned char)piece[i]) * FNV_PRIME;
+                at++;
+                if (piece[i] == '\n')
+                {
+                    seq.starts.push_back(start);
+                    seq.ids.push_back(ids.intern(hash, blob, start, at - start));
+                    start = at;
+                    hash = FNV_OFFSET;
+                }
+            }
+        });
+        if (start < hi)
+        {
+            seq.starts.push_back(start);
+            seq.ids.push_back(ids.intern(hash, blob, start, hi - start));
+        }
+        seq.starts.push_back(hi);
+    }
+
+    static void tokenizeBytes(const ContentBlob& blob, size_t lo, size_t hi, Sequence& seq)
+    {
+        seq.ids.reserve(hi - lo);
+        blob.forEachRange(lo, hi - lo, [&](string_view piece) {
+            for (size_t i = 0; i < piece.size(); i++)
+                seq.ids.push_back((unsigned char)piece[i]);
+        });
+    }
+
+    // Marks the tokens of 'a' removed and of 'b' added by a shortest edit script
+    class Myers
+    {
+        const vector<uint32_t>& a;
+        const vector<uint32_t>& b;
+
+        void replaceAll(size_t a0, size_t a1, size_t b0, size_t b1)
+        {
+            fill(oldChanged.begin() + a0, oldChanged.begin() + a1, 1);
+            fill(newChanged.begin() + b0, newChanged.begin() + b1, 1);
+        }
+
+        // Finds a point on an optimal path through the middle of the edit graph by running
+        // the search from both ends at once (Myers 1986, section 4b)
+        bool bisect(size_t a0, size_t a1, size_t b0, size_t b1, long long& splitX, long long& splitY) const
+        {
+            long long n = (long long)(a1 - a0), m = (long long)(b1 - b0);
+            long long limit = min((n + m + 1) / 2, (long long)MAX_BISECT_EDITS);
+            long long vOff = limit + 1, vLen = 2 * limit + 3;
+            vector<long long> v1(vLen, -1), v2(vLen, -1);
+            v1[vOff + 1] = 0;
+            v2[vOff + 1] = 0;
+            long long delta = n - m;
+            bool front = delta % 2 != 0; // which direction can detect the overlap first
+            long long k1start = 0, k1end = 0, k2start = 0, k2end = 0;
+            for (long long d = 0; d < limit; d++)
+            {
+                for (long long k1 = -d + k1start; k1 <= d - k1end; k1 += 2)
+                {
+                    long long off1 = vOff + k1;
+                    long long x1 = (k1 == -d || (k1 != d && v1[off1 - 1] < v1[off1 + 1])) ? v1[off1 + 1] : v1[off1 - 1] + 1;
+                    long long y1 = x1 - k1;
+                    while (x1 < n && y1 < m && a[a0 + x1] == b[b0 + y1])
+                    {
+                        x1++;
+                        y1++;
+                    }
+                    v1[off1] = x1;
+                    if (x1 > n)
+                        k1end += 2;
+                    else if (y1 > m)
+                        k1start += 2;
+                    else if (front)
+                    {
+                        long long off2 = vOff + delta - k1;
+                        if (off2 >= 0 && off2 < vLen && v2[off2] != -1 && x1 >= n - v2[off2])
+                        {
+                            splitX = x1;
+                            splitY = y1;
+                            return true;
+                        }
+                    }
+                }
+                for (long long k2 = -d + k2start; k2 <= d - k2end; k2 += 2)
+                {
+                    long long off2 = vOff + k2;
+                    long long x2 = (k2 == -d || (k2 != d && v2[off2 - 1] < v2[off2 + 1])) ? v2[off2 + 1] : v2[off2 - 1] + 1;
+                    long long y2 = x2 - k2;
+                    while (x2 < n && y2 < m && a[a1 - 1 - x2] == b[b1 - 1 - y2])
+                    {
+                        x2++;
+                        y2++;
+                    }
+                    v2[off2] = x2;
+                    if (x2 > n)
+                        k2end += 2;
+                    else if (y2 > m)
+                        k2start += 2;
+                    else if (!front)
+                    {
+                        long long off1 = vOff + delta - k2;
+                        if (off1 >= 0 && off1 < vLen && v1[off1] != -1 && v1[off1] >= n - x2)
+                        {
+                            splitX = v1[off1];
+                            splitY = v1[off1] - (off1 - vOff);
+                            return true;
+                        }
+                    }
+                }
+            }
+            return false;
+        }
+
+    public:
+        vector<char> oldChanged, newChanged;
+
+        Myers(const vector<uint32_t>& from, const vector<uint32_t>& to)
+            : a(from), b(to), oldChanged(from.size(), 0), newChanged(to.size(), 0) {}
+
+        void compare(size_t a0, size_t a1, size_t b0, size_t b1)
+        {
+            while (a0 < a1 && b0 < b1 && a[a0] == b[b0])
+            {
+                a0++;
+                b0++;
+            }
+            while (a0 < a1 && b0 < b1 && a[a1 - 1] == b[b1 - 1])
+            {
+                a1--;
+                b1--;
+            }
+            if (a0 == a1 || b0 == b1)
+            {
+                replaceAll(a0, a1, b0, b1);
+                return;
+            }
+            long long x, y;
+            if (!bisect(a0, a1, b0, b1, x, y) || (x == 0 && y == 0) ||
+                (x == (long long)(a1 - a0) && y == (long long)(b1 - b0)))
+            {
+                replaceAll(a0, a1, b0, b1);
+                return;
+            }
+            compare(a0, a0 + x, b0, b0 + y);
+            compare(a0 + x, a1, b0 + y, b1);
+        }
+    };
+
+    // Start of the line holding byte 'offset'
+    static size_t lineStart(const ContentBlob& blob, size_t offset)
+    {
+        if (offset == 0 || blob.size() == 0)
+            return 0;
+        offset = min(offset, blob.size());
+        for (size_t i = blob.locate(offset - 1) + 1; i-- > 0;)
+        {
+            string_view piece(blob.extents[i]->bytes);
+            size_t at = piece.substr(0, offset - blob.starts[i]).rfind('\n');
+            if (at != string_view::npos)
+                return blob.starts[i] + at + 1;
+        }
+        return 0;
+    }
+
+    // Start of the line after the one holding byte 'offset'
+    static size_t nextLine(const ContentBlob& blob, size_t offset)
+    {
+        if (offset >= blob.size())
+            return blob.size();
+        for (size_t i = blob.locate(offset); i < blob.extents.size(); i++)
+        {
+            string_view piece(blob.extents[i]->bytes);
+            size_t at = piece.find('\n', offset > blob.starts[i] ? offset - blob.starts[i] : 0);
+            if (at != string_view::npos)
+                return blob.starts[i] + at + 1;
+        }
+        return blob.size();
+    }
+
+    static size_t countLines(const ContentBlob& blob, size_t offset, size_t len)
+    {
+        size_t lines = 0;
+        char last = '\n';
+        blob.forEachRange(offset, len, [&](string_view piece) {
+            lines += count(piece.begin(), piece.end(), '\n');
+            last = piece.back();
+        });
+        return lines + (last != '\n' ? 1 : 0);
+    }
+
+    static void appendLines(string& out, const ContentBlob& blob, size_t offset, size_t len, char prefix)
+    {
+        bool atLineStart = true;
+        blob.forEachRange(offset, len, [&](string_view piece) {
+            while (!piece.empty())
+            {
+                if (atLineStart)
+                    out += prefix;
+                size_t nl = piece.find('\n');
+                size_t take = nl == string_view::npos ? piece.size() : nl + 1;
+                out.append(piece.substr(0, take));
+                atLineStart = nl != string_view::npos;
+                piece.remove_prefix(take);
+            }
+        });
+        if (!atLineStart)
+            out += "\n\\ No newline at end of file\n";
+    }
+
+    static string hunkRange(size_t start, size_t count)
+    {
+        if (count == 0)
+            return to_string(start) + ",0";
+        return to_string(start + 1) + (count == 1 ? "" : "," + to_string(count));
+    }
+
+public:
+    // Content with a NUL byte near the start is treated as binary, as git does
+    static bool isBinary(const ContentBlob& blob)
+    {
+        bool binary = false;
+        blob.forEachRange(0, BINARY_SNIFF, [&](string_view piece) {
+            if (piece.find('\0') != string_view::npos)
+                binary = true;
+        });
+        return binary;
+    }
+
+    static Result diff(ContentRef from, ContentRef to)
+    {
+        return diff(from, to, isBinary(*from) || isBinary(*to));
+    }
+
+    static Result diff(ContentRef from, ContentRef to, bool binary)
+    {
+        OpTimer timer(OP_VERSION_DIFF);
+        Result r;
+        r.from = from;
+        r.to = to;
+        r.binary = binary;
+        const ContentBlob& a = *from;
+        const ContentBlob& b = *to;
+
+        // Leading and trailing extents both versions hold are equal without looking
+        size_t shared = min(a.extents.size(), b.extents.size());
+        size_t head = 0, prefix = 0;
+        while (head < shared && a.extents[head] == b.extents[head])
+            prefix += a.extents[head++]->bytes.size();
+        size_t tail = 0, suffix = 0;
+        while (tail < shared - head && a.extents[a.extents.size() - 1 - tail] == b.extents[b.extents.size() - 1 - tail])
+            suffix += a.extents[a.extents.size() - 1 - tail++]->bytes.size();
+
+        size_t lo = prefix, hiA = a.size() - suffix, hiB = b.size() - suffix;
+        size_t baseLine = lo;
+        if (!binary)
+        {
+            // Widen to whole lines. The bytes past hiA and hiB are the same in both, so both
+            // ends move by the same amount; only the byte before each end can differ, and a
+            // line break there on one side says nothing about the other
+            lo = lineStart(a, lo);
+            size_t widen = 0;
+            if (hiA < a.size() && (lineStart(a, hiA) != hiA || lineStart(b, hiB) != hiB))
+                widen = nextLine(a, hiA) - hiA;
+            hiA += widen;
+            hiB += widen;
+            baseLine = lo == 0 ? 0 : countLines(a, 0, lo);
+        }
+
+        Sequence sa, sb;
+        if (binary)
+        {
+            tokenizeBytes(a, lo, hiA, sa);
+            tokenizeBytes(b, lo, hiB, sb);
+        }
+        else
+        {
+            Interner ids;
+            tokenizeLines(a, lo, hiA, ids, sa);
+            tokenizeLines(b, lo, hiB, ids, sb);
+        }
+
+        Myers myers(sa.ids, sb.ids);
+        myers.compare(0, sa.ids.size(), 0, sb.ids.size());
+
+        size_t n = sa.ids.size(), m = sb.ids.size();
+        size_t i = 0, j = 0;
+        while (i < n || j < m)
+        {
+            if ((i < n && myers.oldChanged[i]) || (j < m && myers.newChanged[j]))
+            {
+                size_t si = i, sj = j;
+                while (i < n && myers.oldChanged[i])
+                    i++;
+                while (j < m && myers.newChanged[j])
+                    j++;
+                Hunk h;
+                h.oldStart = baseLine + si;
+                h.oldCount = i - si;
+                h.newStart = baseLine + sj;
+                h.newCount = j - sj;
+                h.oldOffset = binary ? lo + si : sa.starts[si];
+                h.oldLength = binary ? i - si : sa.starts[i] - sa.starts[si];
+                h.newOffset = binary ? lo + sj : sb.starts[sj];
+                h.newLength = binary ? j - sj : sb.starts[j] - sb.starts[sj];
+                r.removed += h.oldCount;
+                r.added += h.newCount;
+                r.hunks.push_back(h);
+            }
+            else
+            {
+                i++;
+                j++;
+            }
+        }
+        return r;
+    }
+
+    // Unified diff text with 'context' unchanged lines around each change
+    static string unified(const Result& r, size_t context = 3)
+    {
+        string out;
+        if (r.binary)
+        {
+            if (!r.hunks.empty())
+                out += "Binary content differs\n";
+            for (size_t h = 0; h < r.hunks.size(); h++)
+                out += "@@ -" + to_string(r.hunks[h].oldOffset) + "," + to_string(r.hunks[h].oldLength) +
+                    " +" + to_string(r.hunks[h].newOffset) + "," + to_string(r.hunks[h].newLength) + " @@\n";
+            return out;
+        }
+        const ContentBlob& a = *r.from;
+        const ContentBlob& b = *r.to;
+        for (size_t g = 0; g < r.hunks.size();)
+        {
+            // Hunks whose context would touch are shown together
+            size_t e = g;
+            while (e + 1 < r.hunks.size() && r.hunks[e + 1].oldStart - (r.hunks[e].oldStart + r.hunks[e].oldCount) <= 2 * context)
+                e++;
+            const Hunk& first = r.hunks[g];
+            const Hunk& last = r.hunks[e];
+            size_t before = min(context, first.oldStart);
+            size_t oldBegin = first.oldOffset;
+            for (size_t k = 0; k < before; k++)
+                oldBegin = lineStart(a, oldBegin - 1);
+            size_t oldEnd = last.oldOffset + last.oldLength;
+            for (size_t k = 0; k < context; k++)
+                oldEnd = nextLine(a, oldEnd);
+            size_t newBegin = first.newOffset - (first.oldOffset - oldBegin);
+            size_t newEnd = last.newOffset + last.newLength + (oldEnd - last.oldOffset - last.oldLength);
+
+            out += "@@ -" + hunkRange(first.oldStart - before, countLines(a, oldBegin, oldEnd - oldBegin)) +
+                " +" + hunkRange(first.newStart - before, countLines(b, newBegin, newEnd - newBegin)) + " @@\n";
+            size_t at = oldBegin;
+            for (size_t h = g; h <= e; h++)
+            {
+                appendLines(out, a, at, r.hunks[h].oldOffset - at, ' ');
+                appendLines(out, a, r.hunks[h].oldOffset, r.hunks[h].oldLength, '-');
+                appendLines(out, b, r.hunks[h].newOffset, r.hunks[h].newLength, '+');
+                at = r.hunks[h].oldOffset + r.hunks[h].oldLength;
+            }
+            appendLines(out, a, at, oldEnd - at, ' ');
+            g = e + 1;
+        }
+        return out;
+    }
+
+    // diff3-style merge: a region changed on one side only takes that side; a region both
+    // changed the same way is taken once; anything else is a conflict, written between
+    // <<<<<<< / ======= / >>>>>>> markers. Unchanged stretches reuse the base's extents.
+    static MergeResult merge(ContentRef base, ContentRef ours, ContentRef theirs)
+    {
+        OpTimer timer(OP_VERSION_MERGE);
+        bool binary = isBinary(*base) || isBinary(*ours) || isBinary(*theirs);
+        Result a = diff(base, ours, binary);
+        Result b = diff(base, theirs, binary);
+        MergeResult result;
+        ContentBuilder out;
+        size_t i = 0, j = 0, pos = 0;
+        long long shiftA = 0, shiftB = 0; // how far each side has moved content so far
+        while (i < a.hunks.size() || j < b.hunks.size())
+        {
+            // A group starts at the earliest hunk and takes in every hunk, from either side,
+            // that overlaps or touches it
+            size_t firstA = i, firstB = j;
+            bool fromA = j == b.hunks.size() || (i < a.hunks.size() && a.hunks[i].oldOffset <= b.hunks[j].oldOffset);
+            const Hunk& seed = fromA ? a.hunks[i++] : b.hunks[j++];
+            size_t groupStart = seed.oldOffset, groupEnd = seed.oldOffset + seed.oldLength;
+            for (;;)
+            {
+                if (i < a.hunks.size() && a.hunks[i].oldOffset <= groupEnd)
+                {
+                    groupEnd = max(groupEnd, a.hunks[i].oldOffset + a.hunks[i].oldLength);
+                    i++;
+                }
+                else if (j < b.hunks.size() && b.hunks[j].oldOffset <= groupEnd)
+                {
+                    groupEnd = max(groupEnd, b.hunks[j].oldOffset + b.hunks[j].oldLength);
+                    j++;
+                }
+                else
+                    break;
+            }
+            long long growA = 0, growB = 0;
+            for (size_t k = firstA; k < i; k++)
+                growA += (long long)a.hunks[k].newLength - (long long)a.hunks[k].oldLength;
+            for (size_t k = firstB; k < j; k++)
+                growB += (long long)b.hunks[k].newLength - (long long)b.hunks[k].oldLength;
+            size_t oursStart = groupStart + shiftA, oursLength = groupEnd - groupStart + growA;
+            size_t theirsStart = groupStart + shiftB, theirsLength = groupEnd - groupStart + growB;
+
+            out.append(*base, pos, groupStart - pos);
+            if (j == firstB)
+                out.append(*ours, oursStart, oursLength);
+            else if (i == firstA)
+                out.append(*theirs, theirsStart, theirsLength);
+            else if (oursLength == theirsLength && ours->equalRange(oursStart, *theirs, theirsStart, oursLength))
+                out.append(*ours, oursStart, oursLength);
+            else
+            {
+                result.conflicts++;
+                out.append("<<<<<<< ours\n");
+                out.append(*ours, oursStart, oursLength);
+                if (oursLength > 0 && ours->read(oursStart + oursLength - 1, 1) != "\n")
+                    out.append("\n");
+                out.append("=======\n");
+                out.append(*theirs, theirsStart, theirsLength);
+                if (theirsLength > 0 && theirs->read(theirsStart + theirsLength - 1, 1) != "\n")
+                    out.append("\n");
+                out.append(">>>>>>> theirs\n");
+            }
+            shiftA += growA;
+            shiftB += growB;
+            pos = groupEnd;
+        }
+        out.append(*base, pos, base->size() - pos);
+        if (!(binary && result.conflicts > 0))
+            result.content = out.finish();
+        return result;
+    }
+};
+
+// One version of a file. Versions form a DAG: 'parent' is the version this one was written
+// on top of and 'mergeParent' the branch tip merged into it, if any. 'jump' is a skip
+// pointer along first parents (Myers' skew-binary scheme), so any ancestor, and the nearest
+// common ancestor of two versions, is reached in O(log depth) steps with one pointer a node.
+struct VersionNode
+{
+    int versionNumber;
+    ContentRef data;
+    VersionNode* parent;
+    VersionNode* mergeParent;
+    VersionNode* jump;
+    int depth;    // first-parent distance from the oldest held ancestor
+    int children; // versions written on top of this one
+    string timestamp;
+    VersionNode(int vNum, ContentRef content)
+    {
+        versionNumber = vNum;
+        data = move(content);
+        parent = nullptr;
+        mergeParent = nullptr;
+        jump = this;
+        depth = 0;
+        children = 0;
+        time_t now = time(0);
+        tm ltm;
+        localTime(now, ltm);
+        stringstream ss;
+        ss << 1900 + ltm.tm_year << "-"
+            << setw(2) << setfill('0') << 1 + ltm.tm_mon << "-"
+            << setw(2) << setfill('0') << ltm.tm_mday << " "
+            << setw(2) << setfill('0') << ltm.tm_hour << ":"
+            << setw(2) << setfill('0') << ltm.tm_min << ":"
+            << setw(2) << setfill('0') << ltm.tm_sec;
+        timestamp = ss.str();
+        memStats.add(MEM_VERSIONS, footprint());
+    }
+    // Same version, unlinked; the caller places it with setParent
+    VersionNode(const VersionNode& other)
+        : versionNumber(other.versionNumber), data(other.data), parent(nullptr), mergeParent(nullptr),
+        jump(this), depth(0), children(0), timestamp(other.timestamp)
+    {
+        memStats.add(MEM_VERSIONS, footprint());
+    }
+    ~VersionNode()
+    {
+        memStats.remove(MEM_VERSIONS, footprint());
+    }
+
+    // Links this node under 'p' (null for the oldest). Its jump goes past its parent's jump
+    // whenever the parent's jump and that jump's jump span the same distance, which keeps
+    // every jump a power-of-two-like stride.
+    void setParent(VersionNode* p)
+    {
+        parent = p;
+        if (p == nullptr)
+        {
+            depth = 0;
+            jump = this;
+            return;
+        }
+        depth = p->depth + 1;
+        VersionNode* j = p->jump;
+        jump = p->depth - j->depth == j->depth - j->jump->depth ? j->jump : p;
+        p->children++;
+    }
+
+    // First-parent ancestor at depth 'd', which must not exceed this node's
+    VersionNode* ancestorAt(int d)
+    {
+        VersionNode* v = this;
+        while (v->depth > d)
+            v = v->jump->depth >= d ? v->jump : v->parent;
+        return v;
+    }
+
+    // Nearest version both descend from along first parents, null if none
+    static VersionNode* commonAncestor(VersionNode* a, VersionNode* b)
+    {
+        if (a == nullptr || b == nullptr)
+            return nullptr;
+        if (a->depth > b->depth)
+            a = a->ancestorAt(b->depth);
+        else
+            b = b->ancestorAt(a->depth);
+        // Equal depths from here on, so the jumps land at equal depths too
+        while (a != b)
+        {
+            if (a->parent == nullptr)
+                return nullptr;
+            if (a->jump != b->jump)
+            {
+                a = a->jump;
+                b = b->jump;
+            }
+            else
+            {
+                a = a->parent;
+                b = b->parent;
+            }
+        }
+        return a;
+    }
+
+    // The node itself; its blob accounts for its own bytes
+    size_t footprint() const
+    {
+        return sizeof(VersionNode) + timestamp.capacity();
+    }
+
+    // Bytes that would be freed with this node: the blob counts only if nobody shares it,
+    // and of its extents only those no other blob holds
+    size_t exclusiveBytes() const
+    {
+        return footprint() + (data.use_count() == 1 ? data->exclusiveFootprint() : 0);
+    }
+};
+
+const char* const MAIN_BRANCH = "main";
+
+// A file's versions with named branches. A branch is only a name for a tip: forking copies
+// nothing, and both lines share every version before the fork. Versions stay addressable
+// by number whichever branch wrote them, and the current version is the tip of the current
+// branch. Rolling back moves that tip, so the next version forks from the one rolled back
+// to and the versions after it keep their place in the graph.
+//
+// Writers hold the file's directory latch. The current version is also read without one
+// (latest() and friends, inside an EpochGuard), so it is published with a release
+// store and nodes a reader may still be on are retired rather than deleted.
+class FileVersioning
+{
+private:
+    struct Branch
+    {
+        VersionNode* tip = nullptr;
+        map<string, int> mergedFrom; // branch merged in -> number of its tip at the time
+    };
+
+    vector<VersionNode*> chain; // every held version, in version number order
+    map<string, Branch> branches;
+    string currentBranch;
+    atomic<VersionNode*> currentVersion;
+    int versionCounter;
+    int versionCount;  // versions currently held
+    size_t totalBytes; // content bytes across them
+
+    VersionNode* find(int versionNumber) const
+    {
+        auto it = lower_bound(chain.begin(), chain.end(), versionNumber,
+            [](const VersionNode* v, int number) { return v->versionNumber < number; });
+        return it != chain.end() && (*it)->versionNumber == versionNumber ? *it : nullptr;
+    }
+
+    // Moves the current branch, and with it the current version, to 'node'
+    void setTip(VersionNode* node)
+    {
+        branches[currentBranch].tip = node;
+        currentVersion.store(node, memory_order_release);
+    }
+
+    VersionNode* newVersion(ContentRef content, VersionNode* mergeParent)
+    {
+        versionCounter++;
+        totalBytes += content->size();
+        VersionNode* node = new VersionNode(versionCounter, move(content));
+        node->setParent(currentVersion.load(memory_order_relaxed));
+        node->mergeParent = mergeParent;
+        chain.push_back(node);
+        versionCount++;
+        setTip(node);
+        return node;
+    }
+
+    // New nodes for every version, linked the same way; returns old node -> copy. Parents
+    // are older than their children, so each one is copied before it is needed.
+    unordered_map<const VersionNode*, VersionNode*> copyNodes(vector<VersionNode*>& copies) const
+    {
+        unordered_map<const VersionNode*, VersionNode*> moved;
+        moved[nullptr] = nullptr;
+        for (VersionNode* v : chain)
+        {
+            VersionNode* copy = new VersionNode(*v);
+            copy->setParent(moved[v->parent]);
+            copy->mergeParent = moved[v->mergeParent];
+            moved[v] = copy;
+            copies.push_back(copy);
+        }
+        return moved;
+    }
+
+public:
+    FileVersioning()
+    {
+        currentBranch = MAIN_BRANCH;
+        currentVersion = nullptr;
+        versionCounter = 0;
+        versionCount = 0;
+        totalBytes = 0;
+    }
+    ~FileVersioning()
+    {
+        for (VersionNode* v : chain)
+            delete v;
+    }
+
+    // Shares the blob; nothing is copied
+    void addVersion(ContentRef content, bool announce = true)
+    {
+        OpTimer timer(OP_VERSION_ADD);
+        VersionNode* node = newVersion(move(content), nullptr);
+        if (announce)
+            ENGINE_LOG << "Added version " << node->versionNumber << " at " << node->timestamp << "\n";
+    }
+
+    // A version on the current branch that takes in 'branch' as its second parent. Later
+    // merges of that branch start from the tip recorded here.
+    void addMergeVersion(ContentRef content, const string& branch)
+    {
+        OpTimer timer(OP_VERSION_ADD);
+        VersionNode* theirs = branches.at(branch).tip;
+        branches[currentBranch].mergedFrom[branch] = theirs->versionNumber;
+        newVersion(move(content), theirs);
+    }
+
+    bool rollbackToVersion(int versionNumber)
+    {
+        OpTimer timer(OP_VERSION_ROLLBACK);
+        VersionNode* target = find(versionNumber);
+        if (target == nullptr)
+        {
+            ENGINE_LOG << "Version " << versionNumber << " not found.\n";
+            return false;
+        }
+        // Merges recorded on this branch may no longer be behind its tip
+        branches[currentBranch].mergedFrom.clear();
+        setTip(target);
+        ENGINE_LOG << "Rolled back to version " << versionNumber << " from " << target->timestamp << "\n";
+        return true;
+    }
+
+    // Moves the current branch ahead to a version that descends from its tip
+    bool fastForward(int versionNumber)
+    {
+        VersionNode* target = find(versionNumber);
+        VersionNode* current = currentVersion.load(memory_order_relaxed);
+        if (target == nullptr || VersionNode::commonAncestor(current, target) != current)
+            return false;
+        setTip(target);
+        return true;
+    }
+
+    // Starts branch 'name' at a held version, the current one for 0
+    bool createBranch(const string& name, int fromVersion = 0)
+    {
+        if (name.empty() || branches.count(name) != 0)
+            return false;
+        VersionNode* from = fromVersion == 0 ? currentVersion.load(memory_order_relaxed) : find(fromVersion);
+        if (from == nullptr)
+            return false;
+        branches[name].tip = from;
+        return true;
+    }
+
+    bool switchBranch(const string& name)
+    {
+        auto it = branches.find(name);
+        if (it == branches.end())
+            return false;
+        currentBranch = name;
+        currentVersion.store(it->second.tip, memory_order_release);
+        return true;
+    }
+
+    // The versions only this branch reached stay until pruned
+    bool deleteBranch(const string& name)
+    {
+        auto it = branches.find(name);
+        if (name == currentBranch || it == branches.end())
+            return false;
+        branches.erase(it);
+        for (auto& b : branches)
+            b.second.mergedFrom.erase(name);
+        return true;
+    }
+
+    const string& getCurrentBranch() const
+    {
+        return currentBranch;
+    }
+
+    // Tip version of a branch, 0 if there is no such branch
+    int branchTip(const string& name) const
+    {
+        auto it = branches.find(name);
+        return it != branches.end() ? it->second.tip->versionNumber : 0;
+    }
+
+    // (branch, tip version) in name order
+    vector<pair<string, int>> branchTips() const
+    {
+        vector<pair<string, int>> tips;
+        for (const auto& b : branches)
+            tips.push_back(make_pair(b.first, b.second.tip->versionNumber));
+        return tips;
+    }
+
+    // Nearest version both descend from along first parents, 0 if they share none
+    int commonAncestor(int a, int b) const
+    {
+        OpTimer timer(OP_VERSION_MERGE_BASE);
+        VersionNode* base = VersionNode::commonAncestor(find(a), find(b));
+        return base != nullptr ? base->versionNumber : 0;
+    }
+
+    // Base for merging 'branch' into the current branch, 0 if they share no history. After
+    // an earlier merge between the two, the tip taken in then is a closer base than the fork.
+    int mergeBase(const string& branch) const
+    {
+        OpTimer timer(OP_VERSION_MERGE_BASE);
+        auto ours = branches.find(currentBranch);
+        auto theirs = branches.find(branch);
+        if (ours == branches.end() || theirs == branches.end())
+            return 0;
+        VersionNode* best = VersionNode::commonAncestor(ours->second.tip, theirs->second.tip);
+        auto consider = [&best](VersionNode* candidate)
+        {
+            if (candidate != nullptr && (best == nullptr || candidate->depth > best->depth))
+                best = candidate;
+        };
+        auto taken = ours->second.mergedFrom.find(branch);
+        if (taken != ours->second.mergedFrom.end())
+            consider(VersionNode::commonAncestor(find(taken->second), theirs->second.tip));
+        taken = theirs->second.mergedFrom.find(currentBranch);
+        if (taken != theirs->second.mergedFrom.end())
+            consider(VersionNode::commonAncestor(find(taken->second), ours->second.tip));
+        return best != nullptr ? best->versionNumber : 0;
+    }
+
+    void viewHistory() const
+    {
+        OpTimer timer(OP_VERSION_HISTORY);
+        if (chain.empty())
+        {
+            ENGINE_LOG << "No version history available.\n";
+            return;
+        }
+        unordered_map<const VersionNode*, string> labels;
+        for (const auto& b : branches)
+            labels[b.second.tip] += (labels[b.second.tip].empty() ? "" : ", ") + b.first;
+        ENGINE_LOG << "\n----- File Version History (branch " << currentBranch << ") -----\n";
+        for (size_t i = chain.size(); i-- > 0;)
+        {
+            const VersionNode* v = chain[i];
+            ENGINE_LOG << "Version " << v->versionNumber;
+            if (v == currentVersion.load(memory_order_relaxed))
+                ENGINE_LOG << " (Current)";
+            auto label = labels.find(v);
+            if (label != labels.end())
+                ENGINE_LOG << " [" << label->second << "]";
+            ENGINE_LOG << " - " << v->timestamp << "\n";
+            // What changed rather than the whole content: a long history of a large file
+            // used to print every byte of every version
+            if (v->parent != nullptr)
+            {
+                ContentDiff::Result changes = ContentDiff::diff(v->parent->data, v->data);
+                ENGINE_LOG << "Changes: +" << changes.added << " -" << changes.removed
+                    << (changes.binary ? " bytes" : " lines") << " vs version " << v->parent->versionNumber;
+            }
+            else
+                ENGINE_LOG << "Initial version";
+            ENGINE_LOG << ", " << v->data->size() << " bytes\n";
+            if (v->mergeParent != nullptr)
+                ENGINE_LOG << "Merged in version " << v->mergeParent->versionNumber << "\n";
+            ENGINE_LOG << "----------------------------\n";
+        }
+    }
+
+    void addVersion(string content, bool announce = true)
+    {
+        addVersion(makeContent(move(content)), announce);
+    }
+
+    // Content of any held version, or null when it has been pruned or never existed.
+    // Callers hold the file's directory latch, as for rollbackToVersion.
+    ContentRef contentOf(int versionNumber) const
+    {
+        VersionNode* v = find(versionNumber);
+        return v != nullptr ? v->data : nullptr;
+    }
+
+    // First parent of a held version, 0 for the oldest or an unknown version
+    int parentOf(int versionNumber) const
+    {
+        VersionNode* v = find(versionNumber);
+        return v != nullptr && v->parent != nullptr ? v->parent->versionNumber : 0;
+    }
+
+    // The current content without copying it: the blob stays alive for as long as the
+    // caller holds the reference, whatever happens to the version chain meanwhile
+    ContentRef latest() const
+    {
+        int versionNumber;
+        return latest(versionNumber);
+    }
+
+    // Content and number of the same version, for readers that hold no latch
+    ContentRef latest(int& versionNumber) const
+    {
+        OpTimer timer(OP_VERSION_LATEST);
+        EpochGuard guard;
+        VersionNode* current = currentVersion.load(memory_order_acquire);
+        versionNumber = current != nullptr ? current->versionNumber : 0;
+        return current != nullptr ? current->data : makeContent(string());
+    }
+
+    int getCurrentVersionNumber() const
+    {
+        EpochGuard guard;
+        VersionNode* current = currentVersion.load(memory_order_acquire);
+        if (current != nullptr)
+            return current->versionNumber;
+        else
+            return 0;
+    }
+
+    int getVersionCount() const
+    {
+        return versionCount;
+    }
+
+    // Content bytes held across every version
+    size_t getTotalBytes() const
+    {
+        return totalBytes;
+    }
+
+    size_t getLatestSize() const
+    {
+        EpochGuard guard;
+        VersionNode* current = currentVersion.load(memory_order_acquire);
+        return current != nullptr ? current->data->size() : 0;
+    }
+
+    // Keeps the newest 'keep' versions plus those that hold the graph's shape: branch tips,
+    // forks and recorded merge points. The rest are unlinked and their children attached to
+    // the nearest kept ancestor. Returns content bytes freed.
+    size_t pruneVersions(int keep)
+    {
+        OpTimer timer(OP_VERSION_PRUNE);
+        keep = max(keep, 0);
+        if (chain.size() <= (size_t)keep)
+            return 0;
+        unordered_map<const VersionNode*, bool> pinned;
+        for (const auto& b : branches)
+        {
+            pinned[b.second.tip] = true;
+            for (const auto& m : b.second.mergedFrom)
+                pinned[find(m.second)] = true;
+        }
+        unordered_map<const VersionNode*, VersionNode*> replacement; // dropped -> kept ancestor
+        auto resolve = [&replacement](VersionNode* v)
+        {
+            auto it = replacement.find(v);
+            return it != replacement.end() ? it->second : v;
+        };
+        size_t firstKept = chain.size() - keep;
+        size_t freed = 0;
+        vector<VersionNode*> kept;
+        vector<VersionNode*> dropped;
+        for (size_t i = 0; i < chain.size(); i++)
+        {
+            VersionNode* v = chain[i];
+            if (i < firstKept && v->children < 2 && pinned.count(v) == 0)
+            {
+                replacement[v] = resolve(v->parent);
+                freed += v->exclusiveBytes();
+                totalBytes -= v->data->size();
+                versionCount--;
+                dropped.push_back(v);
+            }
+            else
+                kept.push_back(v);
+        }
+        if (dropped.empty())
+            return 0;
+        // Oldest first, so every parent is relinked before its children
+        for (VersionNode* v : kept)
+            v->children = 0;
+        for (VersionNode* v : kept)
+        {
+            v->setParent(resolve(v->parent));
+            v->mergeParent = resolve(v->mergeParent);
+        }
+        chain.swap(kept);
+        for (VersionNode* v : dropped)
+            epochs.retire(v);
+        return freed;
+    }
+
+    // Reallocates every version, oldest first, re-copying unshared content into tight
+    // buffers, so that one file's versions sit close together again; returns the slack
+    // bytes given back
+    size_t compact()
+    {
+        OpTimer timer(OP_VERSION_COMPACT);
+        size_t before = 0, after = 0;
+        vector<VersionNode*> copies;
+        unordered_map<const VersionNode*, VersionNode*> moved = copyNodes(copies);
+        for (size_t i = 0; i < chain.size(); i++)
+        {
+            if (chain[i]->data.use_count() != 2) // the old node and its copy only
+                continue;
+            // Re-copy the extents no other version shares; shared ones stay as they are
+            vector<ExtentRef> tight;
+            bool rebuilt = false;
+            for (const ExtentRef& e : chain[i]->data->extents)
+            {
+                if (e.use_count() == 1 && e->bytes.capacity() > e->bytes.size())
+                {
+                    before += e->bytes.capacity();
+                    tight.push_back(make_shared<const ContentExtent>(string(e->bytes)));
+                    after += tight.back()->bytes.capacity();
+                    rebuilt = true;
+                }
+                else
+                    tight.push_back(e);
+            }
+            if (rebuilt)
+                copies[i]->data = make_shared<const ContentBlob>(move(tight));
+        }
+        for (auto& b : branches)
+            b.second.tip = moved[b.second.tip];
+        chain.swap(copies);
+        currentVersion.store(moved[currentVersion.load(memory_order_relaxed)], memory_order_release);
+        // Only once the old current version is unreachable
+        for (VersionNode* v : copies)
+            epochs.retire(v);
+        return before > after ? before - after : 0;
+    }
+
+    size_t footprint() const
+    {
+        // Versions share extents; each is counted once per file
+        size_t bytes = sizeof(FileVersioning) + chain.capacity() * sizeof(VersionNode*);
+        unordered_map<const ContentExtent*, bool> seen;
+        for (const VersionNode* v : chain)
+        {
+            bytes += v->footprint() + v->data->footprint();
+            for (const ExtentRef& e : v->data->extents)
+            {
+                if (seen.emplace(e.get(), true).second)
+                    bytes += e->footprint();
+            }
+        }
+        for (const auto& b : branches)
+        {
+            bytes += sizeof(pair<const string, Branch>) + b.first.capacity() + CONTAINER_NODE_OVERHEAD;
+            bytes += b.second.mergedFrom.size() * (sizeof(pair<const string, int>) + CONTAINER_NODE_OVERHEAD);
+        }
+        return bytes;
+    }
+
+    // Unused string capacity across unshared content
+    size_t getSlackBytes() const
+    {
+        size_t slack = 0;
+        for (const VersionNode* v : chain)
+        {
+            if (v->data.use_count() == 1)
+                slack += v->data->slackBytes();
+        }
+        return slack;
+    }
+
+    // (version number, content) from oldest to newest; the current version is not marked
+    vector<pair<int, ContentRef>> versions() const
+    {
+        vector<pair<int, ContentRef>> all;
+        for (const VersionNode* v : chain)
+            all.push_back(make_pair(v->versionNumber, v->data));
+        return all;
+    }
+
+    // Copy-on-write clone: new version nodes and branches, same content blobs, no bytes copied
+    FileVersioning* clone() const
+    {
+        FileVersioning* copy = new FileVersioning();
+        unordered_map<const VersionNode*, VersionNode*> moved = copyNodes(copy->chain);
+        for (const auto& b : branches)
+        {
+            Branch& branch = copy->branches[b.first];
+            branch.tip = moved[b.second.tip];
+            branch.mergedFrom = b.second.mergedFrom;
+        }
+        copy->currentBranch = currentBranch;
+        copy->currentVersion.store(moved[currentVersion.load(memory_order_relaxed)], memory_order_relaxed);
+        copy->versionCounter = versionCounter;
+        copy->versionCount = versionCount;
+        copy->totalBytes = totalBytes;
+        return copy;
+    }
+};
+
+// A deleted file keeps its whole version chain and where it came from
+struct RecycleEntry
+{
+    string name;
+    string originalPath;
+    FileVersioning* history;
+    int owner;
+    time_t deletedAt;
+    size_t bytes;
+    RecycleEntry* older;    // deletion order
+    RecycleEntry* newer;
+    RecycleEntry* sameNamePrev; // per-name chain, oldest first
+    RecycleEntry* sameNameNext;
+
+    RecycleEntry(const string& n, const string& path, FileVersioning* h, int o = -1)
+        : name(n), originalPath(path), history(h), owner(o), deletedAt(time(0)),
+        older(nullptr), newer(nullptr), sameNamePrev(nullptr), sameNameNext(nullptr)
+    {
+        bytes = h != nullptr ? h->getTotalBytes() : 0;
+        memStats.add(MEM_RECYCLE, footprint());
+    }
+    ~RecycleEntry()
+    {
+        delete history;
+        memStats.remove(MEM_RECYCLE, footprint());
+    }
+
+    size_t footprint() const
+    {
+        return sizeof(RecycleEntry) + name.capacity() + originalPath.capacity() + CONTAINER_NODE_OVERHEAD;
+    }
+};
+
+class RecycleBin
+{
+    struct NameChain
+    {
+        RecycleEntry* oldest = nullptr;
+        RecycleEntry* newest = nullptr;
+    };
+
+    RecycleEntry* oldest;
+    RecycleEntry* newest;
+    unordered_map<string, NameChain> byName;
+    int count;
+    size_t totalBytes;
+    long maxAgeSeconds;  // 0 = keep forever
+    size_t maxTotalBytes; // 0 = no size budget
+
+    // O(1): unlinks from both the deletion-order list and the per-name chain
+    void unlink(RecycleEntry* e)
+    {
+        if (e->older) e->older->newer = e->newer; else oldest = e->newer;
+        if (e->newer) e->newer->older = e->older; else newest = e->older;
+
+        unordered_map<string, NameChain>::iterator it = byName.find(e->name);
+        if (e->sameNamePrev) e->sameNamePrev->sameNameNext = e->sameNameNext; else it->second.oldest = e->sameNameNext;
+        if (e->sameNameNext) e->sameNameNext->sameNamePrev = e->sameNamePrev; else it->second.newest = e->sameNamePrev;
+        if (it->second.oldest == nullptr)
+            byName.erase(it);
+
+        e->older = e->newer = e->sameNamePrev = e->sameNameNext = nullptr;
+        count--;
+        totalBytes -= e->bytes;
+    }
+
+public:
+    RecycleBin()
+    {
+        oldest = newest = nullptr;
+        count = 0;
+        totalBytes = 0;
+        maxAgeSeconds = 0;
+        maxTotalBytes = 0;
+    }
+    ~RecycleBin()
+    {
+        emptyRecycleBin();
+    }
+
+    bool isEmpty() const
+    {
+        return count == 0;
+    }
+
+    int size() const
+    {
+        return count;
+    }
+
+    size_t bytesUsed() const
+    {
+        return totalBytes;
+    }
+
+    void setRetention(long ageSeconds, size_t budgetBytes)
+    {
+        maxAgeSeconds = ageSeconds;
+        maxTotalBytes = budgetBytes;
+        purgeExpired();
+    }
+
+    void push(RecycleEntry* entry)
+    {
+        try
+        {
+            if (!entry)
+                throw invalid_argument("Cannot push a null file.");
+
+            entry->older = newest;
+            if (newest) newest->newer = entry; else oldest = entry;
+            newest = entry;
+
+            NameChain& chain = byName[entry->name];
+            if (chain.newest == nullptr)
+            {
+                chain.oldest = chain.newest = entry;
+            }
+            else
+            {
+                entry->sameNamePrev = chain.newest;
+                chain.newest->sameNameNext = entry;
+                chain.newest = entry;
+            }
+            count++;
+            totalBytes += entry->bytes;
+            purgeExpired();
+        }
+        catch (const exception& e)
+        {
+            ENGINE_LOG << "Recycle Bin Error: " << e.what() << endl;
+        }
+    }
+
+    // Drops entries that are too old or beyond the size budget, oldest first.
+    // Cheap enough to call on every operation: it stops at the first entry it keeps.
+    // Returns the content bytes freed.
+    size_t purgeExpired()
+    {
+        size_t freed = 0;
+        time_t now = time(0);
+        while (oldest != nullptr &&
+            ((maxAgeSeconds > 0 && now - oldest->deletedAt > maxAgeSeconds) ||
+                (maxTotalBytes > 0 && totalBytes > maxTotalBytes)))
+        {
+            RecycleEntry* e = oldest;
+            unlink(e);
+            freed += e->bytes;
+            delete e;
+        }
+        return freed;
+    }
+
+    RecycleEntry* pop()
+    {
+        if (isEmpty())
+        {
+            ENGINE_LOG << "Recycle Bin is empty.\n";
+            return nullptr;
+        }
+        RecycleEntry* entry = newest;
+        unlink(entry);
+        ENGINE_LOG << "Restoring file '" << entry->name << "' from Recycle Bin.\n";
+        return entry;
+    }
+
+    const RecycleEntry* peekByName(const string& filename) const
+    {
+        unordered_map<string, NameChain>::const_iterator it = byName.find(filename);
+        return it == byName.end() ? nullptr : it->second.newest;
+    }
+
+    // O(1): the most recently deleted file with this name
+    RecycleEntry* restoreFileByName(const string& filename)
+    {
+        if (isEmpty())
+        {
+            ENGINE_LOG << "Recycle Bin is empty.\n";
+            return nullptr;
+        }
+        unordered_map<string, NameChain>::iterator it = byName.find(filename);
+        if (it == byName.end())
+        {
+            ENGINE_LOG << "File '" << filename << "' not found in Recycle Bin.\n";
+            return nullptr;
+        }
+        RecycleEntry* entry = it->second.newest;
+        unlink(entry);
+        ENGINE_LOG << "Restoring file '" << entry->name << "' from Recycle Bin.\n";
+        return entry;
+    }
+
+    void viewRecycleBin() const
+    {
+        if (isEmpty())
+        {
+            ENGINE_LOG << "Recycle Bin is empty.\n";
+            return;
+        }
+        ENGINE_LOG << "Files in Recycle Bin:\n";
+        int i = 1;
+        for (RecycleEntry* e = newest; e != nullptr; e = e->older, i++)
+        {
+            ENGINE_LOG << i << ". " << e->name << "  (from " << e->originalPath << ", "
+                << (e->history ? e->history->getVersionCount() : 0) << " version(s), "
+                << e->bytes << " bytes)" << endl;
+        }
+        ENGINE_LOG << count << " file(s), " << totalBytes << " bytes";
+        if (maxAgeSeconds > 0)
+            ENGINE_LOG << ", max age " << maxAgeSeconds << "s";
+        if (maxTotalBytes > 0)
+            ENGINE_LOG << ", budget " << maxTotalBytes << " bytes";
+        ENGINE_LOG << endl;
+    }
+
+    void emptyRecycleBin()
+    {
+        if (isEmpty())
+        {
+            ENGINE_LOG << "Recycle Bin is already empty.\n";
+            return;
+        }
+        while (oldest != nullptr)
+        {
+            RecycleEntry* e = oldest;
+            oldest = e->newer;
+            delete e;
+        }
+        newest = nullptr;
+        byName.clear();
+        count = 0;
+        totalBytes = 0;
+        ENGINE_LOG << "Recycle Bin emptied successfully.\n";
+    }
+};
+
+struct treenode;
+
+// Ordered index of one folder's children, keyed by (name, kind) with folders first on
+// equal names. Nodes carry subtree sizes, so rank lookups and pagination are O(log n).
+class AVLTree
+{
+private:
+    struct AVLNode
+    {
+        string key;
+        bool isFolder;
+        treenode* value;
+        int height;
+        int size;
+        AVLNode* left;
+        AVLNode* right;
+
+        AVLNode(const string& k, bool folder, treenode* v)
+            : key(k), isFolder(folder), value(v), height(1), size(1), left(nullptr), right(nullptr)
+        {
+            memStats.add(MEM_INDEX, sizeof(AVLNode) + key.capacity());
+        }
+        ~AVLNode()
+        {
+            memStats.remove(MEM_INDEX, sizeof(AVLNode) + key.capacity());
+        }
+    };
+
+    AVLNode* root;
+
+    static int height(AVLNode* N)
+    {
+        if (N == nullptr)
+            return 0;
+        return N->height;
+    }
+
+    static int sizeOf(AVLNode* N)
+    {
+        if (N == nullptr)
+            return 0;
+        return N->size;
+    }
+
+    static void update(AVLNode* N)
+    {
+        N->height = max(height(N->left), height(N->right)) + 1;
+        N->size = sizeOf(N->left) + sizeOf(N->right) + 1;
+    }
+
+    static int getBalance(AVLNode* N)
+    {
+        if (N == nullptr)
+            return 0;
+        return height(N->left) - height(N->right);
+    }
+
+    // <0, 0, >0 like strcmp; folders sort before files with the same name
+    static int compare(const string& key, bool isFolder, const AVLNode* node)
+    {
+        int c = key.compare(node->key);
+        if (c != 0)
+            return c;
+        if (isFolder == node->isFolder)
+            return 0;
+        return isFolder ? -1 : 1;
+    }
+
+    static AVLNode* rightRotate(AVLNode* y)
+    {
+        AVLNode* x = y->left;
+        AVLNode* T2 = x->right;
+
+        x->right = y;
+        y->left = T2;
+
+        update(y);
+        update(x);
+
+        return x;
+    }
+
+    static AVLNode* leftRotate(AVLNode* x)
+    {
+        AVLNode* y = x->right;
+        AVLNode* T2 = y->left;
+
+        y->left = x;
+        x->right = T2;
+
+        update(x);
+        update(y);
+
+        return y;
+    }
+
+    static AVLNode* rebalance(AVLNode* node)
+    {
+        update(node);
+        int balance = getBalance(node);
+
+        // Left Left / Left Right Case
+        if (balance > 1)
+        {
+            if (getBalance(node->left) < 0)
+                node->left = leftRotate(node->left);
+            return rightRotate(node);
+        }
+
+        // Right Right / Right Left Case
+        if (balance < -1)
+        {
+            if (getBalance(node->right) > 0)
+                node->right = rightRotate(node->right);
+            return leftRotate(node);
+        }
+
+        return node;
+    }
+
+    AVLNode* insert(AVLNode* node, const string& key, bool isFolder, treenode* value, bool& added)
+    {
+        if (node == nullptr)
+        {
+            added = true;
+            return new AVLNode(key, isFolder, value);
+        }
+
+        int c = compare(key, isFolder, node);
+        if (c < 0)
+            node->left = insert(node->left, key, isFolder, value, added);
+        else if (c > 0)
+            node->right = insert(node->right, key, isFolder, value, added);
+        else
+            return node; // Equal keys not allowed
+
+        return rebalance(node);
+    }
+
+    AVLNode* erase(AVLNode* node, const string& key, bool isFolder, bool& removed)
+    {
+        if (node == nullptr)
+            return nullptr;
+
+        int c = compare(key, isFolder, node);
+        if (c < 0)
+        {
+            node->left = erase(node->left, key, isFolder, removed);
+        }
+        else if (c > 0)
+        {
+            node->right = erase(node->right, key, isFolder, removed);
+        }
+        else
+        {
+            removed = true;
+            if (node->left == nullptr || node->right == nullptr)
+            {
+                AVLNode* child = node->left ? node->left : node->right;
+                delete node;
+                return child;
+            }
+            // Replace with the in-order successor, then remove that from the right subtree
+            AVLNode* succ = node->right;
+            while (succ->left != nullptr)
+                succ = succ->left;
+            size_t oldCapacity = node->key.capacity();
+            node->key = succ->key;
+            memStats.resize(MEM_INDEX, oldCapacity, node->key.capacity());
+            node->isFolder = succ->isFolder;
+            node->value = succ->value;
+            bool dummy = false;
+            node->right = erase(node->right, succ->key, succ->isFolder, dummy);
+        }
+
+        return rebalance(node);
+    }
+
+    static size_t footprint(const AVLNode* node)
+    {
+        if (node == nullptr)
+            return 0;
+        return sizeof(AVLNode) + node->key.capacity() + footprint(node->left) + footprint(node->right);
+    }
+
+    void cleanup(AVLNode* node)
+    {
+        if (node != nullptr)
+        {
+            cleanup(node->left);
+            cleanup(node->right);
+            delete node;
+        }
+    }
+
+public:
+    // In-order cursor; the stack holds the current node and the ancestors still to visit
+    class Iterator
+    {
+        vector<AVLNode*> stack;
+        friend class AVLTree;
+
+    public:
+        bool valid() const
+        {
+            return !stack.empty();
+        }
+
+        treenode* operator*() const
+        {
+            return stack.back()->value;
+        }
+
+        const string& key() const
+        {
+            return stack.back()->key;
+        }
+
+        void next()
+        {
+            AVLNode* node = stack.back()->right;
+            stack.pop_back();
+            while (node != nullptr)
+            {
+                stack.push_back(node);
+                node = node->left;
+            }
+        }
+    };
+
+    AVLTree() : root(nullptr) {}
+
+    ~AVLTree()
+    {
+        cleanup(root);
+    }
+
+    bool insert(const string& key, bool isFolder, treenode* value)
+    {
+        bool added = false;
+        root = insert(root, key, isFolder, value, added);
+        return added;
+    }
+
+    bool erase(const string& key, bool isFolder)
+    {
+        bool removed = false;
+        root = erase(root, key, isFolder, removed);
+        return removed;
+    }
+
+    treenode* search(const string& key, bool isFolder) const
+    {
+        AVLNode* node = root;
+        while (node != nullptr)
+        {
+            int c = compare(key, isFolder, node);
+            if (c == 0)
+                return node->value;
+            node = c < 0 ? node->left : node->right;
+        }
+        return nullptr;
+    }
+
+    // First entry with this name, folder or file
+    treenode* search(const string& key) const
+    {
+        Iterator it = lowerBound(key);
+        if (it.valid() && it.key() == key)
+            return *it;
+        return nullptr;
+    }
+
+    int size() const
+    {
+        return sizeOf(root);
+    }
+
+    int getHeight() const
+    {
+        return height(root);
+    }
+
+    size_t footprint() const
+    {
+        return footprint(root);
+    }
+
+    Iterator begin() const
+    {
+        return at(0);
+    }
+
+    // First entry whose name is >= key
+    Iterator lowerBound(const string& key) const
+    {
+        Iterator it;
+        AVLNode* node = root;
+        while (node != nullptr)
+        {
+            if (node->key >= key)
+            {
+                it.stack.push_back(node);
+                node = node->left;
+            }
+            else
+            {
+                node = node->right;
+            }
+        }
+        return it;
+    }
+
+    // Entry at zero-based position 'rank' in sorted order
+    Iterator at(int rank) const
+    {
+        Iterator it;
+        AVLNode* node = root;
+        while (node != nullptr)
+        {
+            int leftSize = sizeOf(node->left);
+            if (rank < leftSize)
+            {
+                it.stack.push_back(node);
+                node = node->left;
+            }
+            else if (rank == leftSize)
+            {
+                it.stack.push_back(node);
+                break;
+            }
+            else
+            {
+                rank -= leftSize + 1;
+                node = node->right;
+            }
+        }
+        if (node == nullptr)
+            it.stack.clear();
+        return it;
+    }
+
+    void display() const
+    {
+        ENGINE_LOG << "AVL Tree (Balanced Index): ";
+        for (Iterator it = begin(); it.valid(); it.next())
+            ENGINE_LOG << it.key() << " ";
+        ENGINE_LOG << endl;
+        ENGINE_LOG << size() << " entries, height " << getHeight() << endl;
+    }
+};
+
+// Hash index of one folder's children for name lookups that take no latch. Readers walk it
+// inside an EpochGuard; writers hold the folder's directory latch (or the whole drive) and
+// publish with release stores. Growing builds a fresh table with fresh entries and retires
+// the old ones, so a reader is never led off its chain.
+class ChildTable
+{
+    struct Entry
+    {
+        const string name;
+        const bool isFolder;
+        treenode* const node;
+        const size_t hash;
+        atomic<Entry*> next;
+
+        Entry(const string& n, bool folder, treenode* v, size_t h, Entry* after)
+            : name(n), isFolder(folder), node(v), hash(h), next(after)
+        {
+            memStats.add(MEM_INDEX, footprint());
+        }
+        ~Entry()
+        {
+            memStats.remove(MEM_INDEX, footprint());
+        }
+
+        size_t footprint() const
+        {
+            return sizeof(Entry) + name.capacity();
+        }
+    };
+
+    struct Buckets
+    {
+        const size_t mask;
+        atomic<Entry*>* heads;
+
+        Buckets(size_t size) : mask(size - 1), heads(new atomic<Entry*>[size])
+        {
+            for (size_t i = 0; i < size; i++)
+                heads[i].store(nullptr, memory_order_relaxed);
+            memStats.add(MEM_INDEX, footprint());
+        }
+        ~Buckets()
+        {
+            memStats.remove(MEM_INDEX, footprint());
+            delete[] heads;
+        }
+
+        size_t footprint() const
+        {
+            return sizeof(Buckets) + (mask + 1) * sizeof(atomic<Entry*>);
+        }
+    };
+
+    // A retired table takes its entries with it
+    struct Generation
+    {
+        Buckets* buckets;
+        ~Generation()
+        {
+            for (size_t i = 0; i <= buckets->mask; i++)
+            {
+                Entry* e = buckets->heads[i].load(memory_order_relaxed);
+                while (e != nullptr)
+                {
+                    Entry* next = e->next.load(memory_order_relaxed);
+                    delete e;
+                    e = next;
+                }
+            }
+            delete buckets;
+        }
+    };
+
+    static const size_t INITIAL_BUCKETS = 4;
+
+    atomic<Buckets*> table;
+    size_t count; // writers only
+
+    static size_t hashOf(const string& name, bool isFolder)
+    {
+        return std::hash<string>()(name) * 2 + (isFolder ? 1 : 0);
+    }
+
+    void grow()
+    {
+        Buckets* old = table.load(memory_order_relaxed);
+        Buckets* bigger = new Buckets((old->mask + 1) * 2);
+        for (size_t i = 0; i <= old->mask; i++)
+        {
+            for (Entry* e = old->heads[i].load(memory_order_relaxed); e != nullptr; e = e->next.load(memory_order_relaxed))
+            {
+                atomic<Entry*>& head = bigger->heads[e->hash & bigger->mask];
+                head.store(new Entry(e->name, e->isFolder, e->node, e->hash, head.load(memory_order_relaxed)), memory_order_relaxed);
+            }
+        }
+        table.store(bigger, memory_order_release);
+        Generation* retiredTable = new Generation();
+        retiredTable->buckets = old;
+        epochs.retire(retiredTable);
+    }
+
+public:
+    ChildTable() : table(new Buckets(INITIAL_BUCKETS)), count(0) {}
+
+    // Only once no reader can reach the folder
+    ~ChildTable()
+    {
+        Generation last;
+        last.buckets = table.load(memory_order_relaxed);
+    }
+
+    void insert(const string& name, bool isFolder, treenode* node)
+    {
+        if (count + 1 > (table.load(memory_order_relaxed)->mask + 1) * 2)
+            grow();
+        Buckets* b = table.load(memory_order_relaxed);
+        size_t h = hashOf(name, isFolder);
+        atomic<Entry*>& head = b->heads[h & b->mask];
+        head.store(new Entry(name, isFolder, node, h, head.load(memory_order_relaxed)), memory_order_release);
+        count++;
+    }
+
+    void erase(const string& name, bool isFolder)
+    {
+        Buckets* b = table.load(memory_order_relaxed);
+        size_t h = hashOf(name, isFolder);
+        atomic<Entry*>* link = &b->heads[h & b->mask];
+        for (Entry* e = link->load(memory_order_relaxed); e != nullptr; e = link->load(memory_order_relaxed))
+        {
+            if (e->hash == h && e->isFolder == isFolder && e->name == name)
+            {
+                link->store(e->next.load(memory_order_relaxed), memory_order_release);
+                epochs.retire(e);
+                count--;
+                return;
+            }
+            link = &e->next;
+        }
+    }
+
+    // Lock-free; the node stays valid for as long as the caller keeps it from being freed
+    // (the shared structure latch, see Folder)
+    treenode* find(const string& name, bool isFolder) const
+    {
+        EpochGuard guard;
+        Buckets* b = table.load(memory_order_acquire);
+        size_t h = hashOf(name, isFolder);
+        for (Entry* e = b->heads[h & b->mask].load(memory_order_acquire); e != nullptr; e = e->next.load(memory_order_acquire))
+        {
+            if (e->hash == h && e->isFolder == isFolder && e->name == name)
+                return e->node;
+        }
+        return nullptr;
+    }
+
+    // Either kind, folders first, matching AVLTree::search(key)
+    treenode* find(const string& name) const
+    {
+        treenode* folder = find(name, true);
+        return folder != nullptr ? folder : find(name, false);
+    }
+
+    // Buckets and entries; the table itself is counted with its folder. Writers only.
+    size_t footprint() const
+    {
+        Buckets* b = table.load(memory_order_relaxed);
+        size_t bytes = b->footprint();
+        for (size_t i = 0; i <= b->mask; i++)
+        {
+            for (Entry* e = b->heads[i].load(memory_order_relaxed); e != nullptr; e = e->next.load(memory_order_relaxed))
+                bytes += e->footprint();
+        }
+        return bytes;
+    }
+};
+
+// One owner's part of a subtree's files, as charged to that owner's quota
+struct OwnerShare
+{
+    int owner;
+    long long files;
+    long long versions;
+    long long bytes; // content across all versions
+};
+
+// Aggregates kept on every folder for its whole subtree, updated on each mutation
+struct SubtreeStats
+{
+    long long files = 0;
+    long long folders = 0;      // folders below, not counting the folder itself
+    long long versions = 0;
+    long long latestBytes = 0;  // current-version content
+    long long historyBytes = 0; // content across all versions
+    time_t newestMtime = 0;
+    vector<OwnerShare> owners;  // the same files split by owner, sorted by owner; none at zero
+
+    void addShare(int owner, long long f, long long v, long long b)
+    {
+        if (f == 0 && v == 0 && b == 0)
+            return;
+        size_t i = 0;
+        while (i < owners.size() && owners[i].owner < owner)
+            i++;
+        if (i == owners.size() || owners[i].owner != owner)
+            owners.insert(owners.begin() + i, OwnerShare{ owner, 0, 0, 0 });
+        owners[i].files += f;
+        owners[i].versions += v;
+        owners[i].bytes += b;
+        if (owners[i].files == 0 && owners[i].versions == 0 && owners[i].bytes == 0)
+            owners.erase(owners.begin() + i);
+    }
+
+    // Everything but newestMtime, which only ever moves forward
+    void add(const SubtreeStats& delta, int sign)
+    {
+        files += sign * delta.files;
+        folders += sign * delta.folders;
+        versions += sign * delta.versions;
+        latestBytes += sign * delta.latestBytes;
+        historyBytes += sign * delta.historyBytes;
+        for (size_t i = 0; i < delta.owners.size(); i++)
+        {
+            const OwnerShare& o = delta.owners[i];
+            addShare(o.owner, sign * o.files, sign * o.versions, sign * o.bytes);
+        }
+    }
+};
+
+// Soft limits warn, hard limits reject the write. 0 means unlimited.
+struct QuotaLimits
+{
+    long long softBytes = 0, hardBytes = 0;
+    long long softVersions = 0, hardVersions = 0;
+    long long softFiles = 0, hardFiles = 0;
+
+    // Name of the first limit the given usage goes over, or nullptr
+    const char* exceeded(long long files, long long versions, long long bytes, bool hard) const
+    {
+        long long fileLimit = hard ? hardFiles : softFiles;
+        long long versionLimit = hard ? hardVersions : softVersions;
+        long long byteLimit = hard ? hardBytes : softBytes;
+        if (byteLimit > 0 && bytes > byteLimit)
+            return "storage bytes";
+        if (versionLimit > 0 && versions > versionLimit)
+            return "version count";
+        if (fileLimit > 0 && files > fileLimit)
+            return "file count";
+        return nullptr;
+    }
+};
+
+// Operations checked by AccessControl::canAccess
+enum Permission
+{
+    PERM_READ = 1,
+    PERM_WRITE = 2,
+    PERM_DELETE = 4,
+    PERM_SHARE = 8,
+    PERM_ALL = 15
+};
+
+const int PERM_BITS = 4;
+static_assert(MAX_USERS * PERM_BITS <= 64, "Per-node permission cache must fit in 64 bits");
+
+// Explicit ACL entry on a node: replaces the inherited mask of one user for the subtree
+struct AclEntry
+{
+    int user;
+    unsigned char mask;
+    AclEntry* next;
+    AclEntry(int u, unsigned char m, AclEntry* n) : user(u), mask(m), next(n)
+    {
+        memStats.add(MEM_ACL, sizeof(AclEntry));
+    }
+    ~AclEntry()
+    {
+        memStats.remove(MEM_ACL, sizeof(AclEntry));
+    }
+};
+
+struct treenode
+{
+    string name;
+    treenode* firstchild;
+    treenode* nextsibling;
+    treenode* prevsibling;
+    treenode* parent;
+    FileVersioning* fileVersion;
+    bool isFolder;
+    AVLTree* index; // folders only: children by name
+    ChildTable* children; // folders only: the same children, hashed for latch-free lookups
+    SubtreeStats stats; // folders: everything below; files: this file alone
+    time_t mtime;
+    int owner;          // user index that created it, -1 for system nodes
+    QuotaLimits* quota; // optional folder quota
+    AclEntry* acl;
+    unsigned long long permCache; // PERM_BITS per user index
+    unsigned int permEpoch;       // permCache is valid while equal to AccessControl's epoch
+    treenode(string n, bool isDir = true)
+    {
+        name = n;
+        firstchild = nullptr;
+        nextsibling = nullptr;
+        prevsibling = nullptr;
+        parent = nullptr;
+        fileVersion = nullptr;
+        isFolder = isDir;
+        index = isDir ? new AVLTree() : nullptr;
+        children = isDir ? new ChildTable() : nullptr;
+        mtime = time(0);
+        stats.newestMtime = mtime;
+        owner = -1;
+        quota = nullptr;
+        acl = nullptr;
+        permCache = 0;
+        permEpoch = 0;
+        memStats.add(MEM_TREE, footprint());
+    }
+
+    size_t footprint() const
+    {
+        return sizeof(treenode) + name.capacity() + (isFolder ? sizeof(AVLTree) + sizeof(ChildTable) : 0);
+    }
+    ~treenode()
+    {
+        // Siblings are freed here too; previously only the first child was released
+        while (firstchild != nullptr)
+        {
+            treenode* next = firstchild->nextsibling;
+            firstchild->nextsibling = nullptr;
+            delete firstchild;
+            firstchild = next;
+        }
+        if (fileVersion != nullptr)
+        {
+            delete fileVersion;
+        }
+        delete index;
+        delete children;
+        delete quota;
+        while (acl != nullptr)
+        {
+            AclEntry* next = acl->next;
+            delete acl;
+            acl = next;
+        }
+        memStats.remove(MEM_TREE, footprint());
+    }
+};
+
+class AccessControl
+{
+    const UserSystem& users;
+    unsigned int epoch;
+    int knownUserCount;
+    mutex cacheLock; // checks from concurrent sessions fill the same node caches
+
+    static unsigned char roleDefault(Role role)
+    {
+        switch (role)
+        {
+        case ADMIN:
+        case EDITOR:
+            return PERM_ALL;
+        default:
+            return PERM_READ;
+        }
+    }
+
+    // Fills node->permCache from the parent's (cached) masks plus the node's own entries
+    unsigned long long effectiveMasks(treenode* node)
+    {
+        if (node->permEpoch == epoch)
+            return node->permCache;
+
+        unsigned long long masks = 0;
+        if (node->parent != nullptr)
+        {
+            masks = effectiveMasks(node->parent);
+        }
+        else
+        {
+            for (int i = 0; i < users.userCount; i++)
+                masks |= (unsigned long long)roleDefault(users.users[i].role) << (i * PERM_BITS);
+        }
+
+        for (AclEntry* e = node->acl; e != nullptr; e = e->next)
+        {
+            unsigned long long slot = (unsigned long long)PERM_ALL << (e->user * PERM_BITS);
+            masks = (masks & ~slot) | ((unsigned long long)e->mask << (e->user * PERM_BITS));
+        }
+
+        node->permCache = masks;
+        node->permEpoch = epoch;
+        return masks;
+    }
+
+public:
+    AccessControl(const UserSystem& us) : users(us), epoch(1), knownUserCount(0) {}
+
+    // Every cached mask becomes stale at once; they are rebuilt lazily on the next check
+    void invalidate()
+    {
+        lock_guard<mutex> guard(cacheLock);
+        epoch++;
+    }
+
+    bool canAccess(int user, treenode* node, Permission op)
+    {
+        if (user < 0 || user >= users.userCount || node == nullptr)
+            return false;
+        if (users.users[user].role == ADMIN)
+            return true;
+        lock_guard<mutex> guard(cacheLock);
+        if (knownUserCount != users.userCount)
+        {
+            knownUserCount = users.userCount;
+            epoch++;
+        }
+        return ((effectiveMasks(node) >> (user * PERM_BITS)) & op) == (unsigned long long)op;
+    }
+
+    void setPermission(treenode* node, int user, unsigned char mask)
+    {
+        for (AclEntry* e = node->acl; e != nullptr; e = e->next)
+        {
+            if (e->user == user)
+            {
+                e->mask = mask;
+                invalidate();
+                return;
+            }
+        }
+        node->acl = new AclEntry(user, mask, node->acl);
+        invalidate();
+    }
+
+    void clearPermission(treenode* node, int user)
+    {
+        AclEntry* prev = nullptr;
+        for (AclEntry* e = node->acl; e != nullptr; prev = e, e = e->next)
+        {
+            if (e->user == user)
+            {
+                if (prev == nullptr)
+                    node->acl = e->next;
+                else
+                    prev->next = e->next;
+                delete e;
+                invalidate();
+                return;
+            }
+        }
+    }
+
+    void showPermissions(treenode* node) const
+    {
+        cout << "Explicit permissions on '" << node->name << "':\n";
+        if (node->acl == nullptr)
+        {
+            cout << "  (none, inherited from parent)\n";
+            return;
+        }
+        for (AclEntry* e = node->acl; e != nullptr; e = e->next)
+        {
+            cout << "  " << users.users[e->user].username << ": "
+                << ((e->mask & PERM_READ) ? "r" : "-")
+                << ((e->mask & PERM_WRITE) ? "w" : "-")
+                << ((e->mask & PERM_DELETE) ? "d" : "-")
+                << ((e->mask & PERM_SHARE) ? "s" : "-") << "\n";
+        }
+    }
+};
+
+const int MAX_RECENT = 5;
+
+enum CachePolicy { POLICY_LRU = 1, POLICY_LFU = 2 };
+
+// Recency/frequency cache over file nodes. Entries reference the treenode, never a copy
+// of its content. Entries live in per-frequency buckets (LFU with O(1) promotion); under
+// LRU every entry stays in bucket 1, which is then a plain recency list.
+class RecentFiles
+{
+    struct Entry
+    {
+        treenode* node;
+        int freq;
+        Entry* prev; // towards most recent in its bucket
+        Entry* next;
+
+        Entry(treenode* n) : node(n), freq(1), prev(nullptr), next(nullptr)
+        {
+            memStats.add(MEM_RECENT, sizeof(Entry) + CONTAINER_NODE_OVERHEAD);
+        }
+        ~Entry()
+        {
+            memStats.remove(MEM_RECENT, sizeof(Entry) + CONTAINER_NODE_OVERHEAD);
+        }
+    };
+    struct Bucket
+    {
+        Entry* head = nullptr; // most recent
+        Entry* tail = nullptr; // eviction candidate
+    };
+
+    unordered_map<treenode*, Entry*> index;
+    unordered_map<int, Bucket> buckets;
+    int capacity;
+    int minFreq;
+    CachePolicy policy;
+
+    void detach(Entry* e)
+    {
+        Bucket& b = buckets[e->freq];
+        if (e->prev) e->prev->next = e->next; else b.head = e->next;
+        if (e->next) e->next->prev = e->prev; else b.tail = e->prev;
+        if (b.head == nullptr)
+        {
+            buckets.erase(e->freq);
+            if (minFreq == e->freq)
+                minFreq++;
+        }
+        e->prev = e->next = nullptr;
+    }
+
+    void attachFront(Entry* e)
+    {
+        Bucket& b = buckets[e->freq];
+        e->prev = nullptr;
+        e->next = b.head;
+        if (b.head) b.head->prev = e; else b.tail = e;
+        b.head = e;
+    }
+
+    void fixMinFreq()
+    {
+        if (buckets.empty())
+        {
+            minFreq = 1;
+        }
+        else if (buckets.find(minFreq) == buckets.end())
+        {
+            minFreq = INT32_MAX;
+            for (unordered_map<int, Bucket>::iterator b = buckets.begin(); b != buckets.end(); ++b)
+                minFreq = min(minFreq, b->first);
+        }
+    }
+
+    void evictOne()
+    {
+        fixMinFreq();
+        unordered_map<int, Bucket>::iterator it = buckets.find(minFreq);
+        if (it == buckets.end())
+            return;
+        Entry* victim = it->second.tail;
+        detach(victim);
+        index.erase(victim->node);
+        delete victim;
+    }
+
+public:
+    RecentFiles(int cap = MAX_RECENT, CachePolicy p = POLICY_LRU)
+    {
+        capacity = cap > 0 ? cap : 1;
+        minFreq = 1;
+        policy = p;
+    }
+    ~RecentFiles()
+    {
+        clear();
+    }
+
+    void clear()
+    {
+        for (unordered_map<treenode*, Entry*>::iterator it = index.begin(); it != index.end(); ++it)
+            delete it->second;
+        index.clear();
+        buckets.clear();
+        minFreq = 1;
+    }
+
+    int size() const
+    {
+        return (int)index.size();
+    }
+
+    int getCapacity() const
+    {
+        return capacity;
+    }
+
+    CachePolicy getPolicy() const
+    {
+        return policy;
+    }
+
+    void setCapacity(int cap)
+    {
+        capacity = cap > 0 ? cap : 1;
+        while ((int)index.size() > capacity)
+            evictOne();
+    }
+
+    // Frequencies are meaningless across policies, so switching starts a fresh cache
+    void setPolicy(CachePolicy p)
+    {
+        if (p != policy)
+        {
+            clear();
+            policy = p;
+        }
+    }
+
+    bool contains(treenode* node) const
+    {
+        return index.find(node) != index.end();
+    }
+
+    void accessFile(treenode* node)
+    {
+        unordered_map<treenode*, Entry*>::iterator it = index.find(node);
+        if (it != index.end())
+        {
+            Entry* e = it->second;
+            detach(e);
+            if (policy == POLICY_LFU)
+                e->freq++;
+            attachFront(e);
+            // detach() may have moved minFreq past the bucket the entry just went back into
+            minFreq = min(minFreq, e->freq);
+        }
+        else
+        {
+            if ((int)index.size() >= capacity)
+                evictOne();
+            Entry* e = new Entry(node);
+            index[node] = e;
+            attachFront(e);
+            minFreq = 1;
+        }
+        ENGINE_LOG << "Accessed file: " << node->name << endl;
+    }
+
+    // Must be called before a node is freed so no entry dangles
+    void forget(treenode* node)
+    {
+        unordered_map<treenode*, Entry*>::iterator it = index.find(node);
+        if (it == index.end())
+            return;
+        Entry* e = it->second;
+        detach(e);
+        index.erase(it);
+        delete e;
+        fixMinFreq();
+    }
+
+    void forgetSubtree(treenode* node)
+    {
+        if (node == nullptr || index.empty())
+            return;
+        forget(node);
+        for (treenode* child = node->firstchild; child != nullptr; child = child->nextsibling)
+            forgetSubtree(child);
+    }
+
+    void viewRecentFiles() const
+    {
+        if (index.empty())
+        {
+            ENGINE_LOG << "No recent files accessed.\n";
+            return;
+        }
+        ENGINE_LOG << (policy == POLICY_LFU ? "Most Frequently Accessed Files:\n" : "Recently Accessed Files:\n");
+
+        // Display only: walk the buckets that exist, from the highest frequency down
+        vector<int> freqs;
+        for (unordered_map<int, Bucket>::const_iterator b = buckets.begin(); b != buckets.end(); ++b)
+            freqs.push_back(b->first);
+        sort(freqs.begin(), freqs.end(), greater<int>());
+        int i = 1;
+        for (size_t f = 0; f < freqs.size(); f++)
+        {
+            const Bucket& b = buckets.at(freqs[f]);
+            for (Entry* e = b.head; e != nullptr; e = e->next, i++)
+            {
+                ENGINE_LOG << i << ". " << e->node->name;
+                if (policy == POLICY_LFU)
+                    ENGINE_LOG << " (" << e->freq << " accesses)";
+                ENGINE_LOG << endl;
+            }
+        }
+    }
+};
+
+// Per-user usage counters and limits; folder limits live on the folder nodes and are
+// checked against their SubtreeStats, so enforcement never walks the tree
+class QuotaManager
+{
+public:
+    struct Usage
+    {
+        long long files = 0;
+        long long versions = 0;
+        long long bytes = 0; // all-version content bytes
+    };
+
+private:
+    Usage usage[MAX_USERS];
+    QuotaLimits limits[MAX_USERS];
+
+public:
+    void charge(int user, long long files, long long versions, long long bytes)
+    {
+        if (user < 0 || user >= MAX_USERS)
+            return;
+        usage[user].files += files;
+        usage[user].versions += versions;
+        usage[user].bytes += bytes;
+    }
+
+    const Usage& getUsage(int user) const
+    {
+        return usage[user];
+    }
+
+    const QuotaLimits& getLimits(int user) const
+    {
+        return limits[user];
+    }
+
+    void setLimits(int user, const QuotaLimits& l)
+    {
+        limits[user] = l;
+    }
+
+    // Hard-limit name the write would break for this user, or nullptr; soft overruns go to 'soft'
+    const char* checkUser(int user, long long files, long long versions, long long bytes, const char*& soft) const
+    {
+        if (user < 0 || user >= MAX_USERS)
+            return nullptr;
+        const Usage& u = usage[user];
+        long long f = u.files + files, v = u.versions + versions, b = u.bytes + bytes;
+        if (soft == nullptr)
+            soft = limits[user].exceeded(f, v, b, false);
+        return limits[user].exceeded(f, v, b, true);
+    }
+};
+
+string formatTimestamp(time_t t)
+{
+    tm ltm;
+    localTime(t, ltm);
+    stringstream ss;
+    ss << 1900 + ltm.tm_year << "-"
+        << setw(2) << setfill('0') << 1 + ltm.tm_mon << "-"
+        << setw(2) << setfill('0') << ltm.tm_mday << " "
+        << setw(2) << setfill('0') << ltm.tm_hour << ":"
+        << setw(2) << setfill('0') << ltm.tm_min << ":"
+        << setw(2) << setfill('0') << ltm.tm_sec;
+    return ss.str();
+}
+
+// Outcome of a drive operation. Messages for people go through the engine log; callers
+// that run without it (batch, scripts) look at this instead.
+enum OpStatus
+{
+    STATUS_OK,
+    STATUS_NOT_FOUND,
+    STATUS_EXISTS,
+    STATUS_QUOTA,
+    STATUS_DENIED,
+    STATUS_INVALID
+};
+
+const char* statusName(OpStatus status)
+{
+    switch (status)
+    {
+    case STATUS_OK: return "ok";
+    case STATUS_NOT_FOUND: return "not_found";
+    case STATUS_EXISTS: return "exists";
+    case STATUS_QUOTA: return "quota_exceeded";
+    case STATUS_DENIED: return "denied";
+    default: return "invalid";
+    }
+}
+
+enum BatchOpType
+{
+    BATCH_MKDIR,
+    BATCH_CREATE,
+    BATCH_UPDATE,
+    BATCH_DELETE,
+    BATCH_MOVE
+};
+
+// What a batch does when a create or move lands on a name that is already taken
+enum ConflictPolicy
+{
+    CONFLICT_FAIL = 1,     // report the op as an error and carry on with the rest
+    CONFLICT_SKIP = 2,     // keep what is there and count the op as skipped
+    CONFLICT_OVERWRITE = 3 // files get a new version (create) or are replaced (move)
+};
+
+struct BatchOp
+{
+    BatchOpType type;
+    string path;    // absolute ("Root/a/b") or relative to the current folder
+    ContentRef content; // create / update; shared with the versions made from it
+    string target;      // move destination
+    BatchOp(BatchOpType t = BATCH_CREATE, const string& p = "", string c = "", const string& dst = "")
+        : type(t), path(p), content(makeContent(move(c))), target(dst) {}
+    BatchOp(BatchOpType t, const string& p, ContentRef c)
+        : type(t), path(p), content(move(c)) {}
+
+    size_t contentSize() const
+    {
+        return content->size();
+    }
+};
+
+struct BatchError
+{
+    size_t index; // position of the op in the batch
+    string path;
+    string reason;
+};
+
+struct BatchResult
+{
+    size_t applied = 0;
+    size_t skipped = 0;
+    size_t foldersCreated = 0; // includes missing parents made for creates
+    size_t softWarnings = 0;
+    vector<BatchError> errors;
+};
+
+// One op per line: "mkdir <path>", "create <path> <content>", "update <path> <content>",
+// "delete <path>" or "move <src> <dst>". Paths cannot contain spaces.
+bool parseBatchLine(const string& line, BatchOp& op)
+{
+    stringstream ss(line);
+    string verb;
+    if (!(ss >> verb >> op.path))
+        return false;
+    op.content = makeContent(string());
+    op.target.clear();
+    if (verb == "mkdir")
+        op.type = BATCH_MKDIR;
+    else if (verb == "delete")
+        op.type = BATCH_DELETE;
+    else if (verb == "move")
+    {
+        op.type = BATCH_MOVE;
+        return (bool)(ss >> op.target);
+    }
+    else if (verb == "create" || verb == "update")
+    {
+        op.type = verb == "create" ? BATCH_CREATE : BATCH_UPDATE;
+        ss.get();
+        string content;
+        getline(ss, content);
+        op.content = makeContent(move(content));
+    }
+    else
+        return false;
+    return true;
+}
+
+//  Sessions
+// A login's own view of a drive: its working folder and the user its writes are made as
+struct DriveSession
+{
+    treenode* cwd;
+    int user;
+    DriveSession(treenode* start = nullptr, int u = -1) : cwd(start), user(u) {}
+};
+
+// The session bound to this thread and the drive it belongs to (see Folder::SessionScope)
+struct SessionBinding
+{
+    const void* drive;
+    DriveSession* session;
+};
+
+thread_local SessionBinding boundSession = { nullptr, nullptr };
+
+// A Folder member that is really per session: on a thread with a session bound to the
+// drive it reads and writes that session's copy, everywhere else a drive-wide one. The
+// engine keeps using 'currentfolder' as before while every session moves independently.
+template <typename T, T DriveSession::*Field>
+class SessionField
+{
+    const void* drive;
+    T shared;
+
+public:
+    SessionField(const void* d, T initial) : drive(d), shared(initial) {}
+    SessionField(const SessionField&) = delete;
+
+    T& get()
+    {
+        return boundSession.drive == drive ? boundSession.session->*Field : shared;
+    }
+
+    T get() const
+    {
+        return boundSession.drive == drive ? boundSession.session->*Field : shared;
+    }
+
+    // The drive-wide copy, whatever session the calling thread has bound
+    T& unbound()
+    {
+        return shared;
+    }
+
+    operator T() const
+    {
+        return get();
+    }
+
+    SessionField& operator=(T value)
+    {
+        get() = value;
+        return *this;
+    }
+
+    T operator->() const
+    {
+        return get();
+    }
+};
+
+// A reader-writer latch split into cache-line-sized shards. A shared holder touches only its
+// thread's shard, so readers on different cores don't bounce one counter between them; an
+// exclusive holder takes every shard, in order.
+class ShardedLatch
+{
+    static const int SHARDS = 16;
+
+    struct alignas(64) Shard
+    {
+        shared_mutex latch;
+    };
+
+    Shard shards[SHARDS];
+
+    static int myShard()
+    {
+        static atomic<unsigned> nextShard(0);
+        static thread_local int shard = (int)(nextShard.fetch_add(1, memory_order_relaxed) % SHARDS);
+        return shard;
+    }
+
+public:
+    void lock_shared()
+    {
+        shards[myShard()].latch.lock_shared();
+    }
+
+    void unlock_shared()
+    {
+        shards[myShard()].latch.unlock_shared();
+    }
+
+    void lock()
+    {
+        for (int i = 0; i < SHARDS; i++)
+            shards[i].latch.lock();
+    }
+
+    void unlock()
+    {
+        for (int i = SHARDS - 1; i >= 0; i--)
+            shards[i].latch.unlock();
+    }
+};
+
+// Concurrency: any number of threads may call into one Folder, each with its own session
+// bound (SessionScope), under three kinds of latch, always taken in this order:
+//
+//   structure latch  Shared by every operation. Taken exclusively by the ones that free,
+//                    rename or relink nodes (delete, restore, move, copy, rename, batches
+//                    with deletes or moves) and by whole-tree walks, so a node reached under
+//                    the shared latch stays valid until it is released.
+//   directory latch  Guards one folder's sibling list and its files' version chains: shared
+//                    to read, exclusive to change. A thread holds at most one at a time.
+//                    Name lookups (ChildTable) and latest-content reads take none: they run
+//                    inside an EpochGuard, and what they skip past is retired, not deleted.
+//   account latch    Subtree aggregates and quota usage, which every write updates up to
+//                    the root. Held only for the O(depth) walk.
+//
+// Under the exclusive structure latch nothing else runs, so directory latches are skipped.
+class Folder
+{
+    static const int DIR_LATCH_STRIPES = 64;
+
+    // Folders share a fixed set of latches by address instead of carrying one each
+    mutable ShardedLatch structureLatch;
+    mutable shared_mutex dirLatches[DIR_LATCH_STRIPES];
+    mutable recursive_mutex accountLatch;
+    mutable mutex sessionLatch; // guards 'sessions'; taken last, after any other latch
+    vector<DriveSession*> sessions;
+
+    // What the calling thread holds, so nested public calls don't take a latch twice
+    enum LatchMode { LATCH_NONE, LATCH_SHARED, LATCH_EXCLUSIVE };
+    static inline thread_local const Folder* latchedDrive = nullptr;
+    static inline thread_local LatchMode latchedMode = LATCH_NONE;
+    static inline thread_local bool dirLatched = false;
+
+public:
+    // Holds the structure latch for a scope; a no-op when the thread already holds it
+    class TreeLatch
+    {
+        const Folder& drive;
+        const Folder* savedDrive;
+        LatchMode savedMode;
+        bool acquired;
+
+    public:
+        TreeLatch(const Folder& d, bool exclusive) : drive(d), savedDrive(latchedDrive), savedMode(latchedMode), acquired(false)
+        {
+            if (latchedDrive == &d && latchedMode != LATCH_NONE)
+            {
+                if (exclusive && latchedMode == LATCH_SHARED)
+                    throw logic_error("structure latch cannot be upgraded to exclusive");
+                return;
+            }
+            if (exclusive)
+                d.structureLatch.lock();
+            else
+                d.structureLatch.lock_shared();
+            latchedDrive = &d;
+            latchedMode = exclusive ? LATCH_EXCLUSIVE : LATCH_SHARED;
+            acquired = true;
+        }
+        ~TreeLatch()
+        {
+            if (!acquired)
+                return;
+            if (latchedMode == LATCH_EXCLUSIVE)
+                drive.structureLatch.unlock();
+            else
+                drive.structureLatch.unlock_shared();
+            latchedDrive = savedDrive;
+            latchedMode = savedMode;
+        }
+        TreeLatch(const TreeLatch&) = delete;
+    };
+
+    // One folder's latch, for callers already under the shared structure latch
+    class DirLatch
+    {
+        shared_mutex* latch;
+        bool exclusive;
+
+    public:
+        DirLatch(const Folder& d, const treenode* folder, bool excl) : latch(nullptr), exclusive(excl)
+        {
+            if (latchedDrive == &d && latchedMode == LATCH_EXCLUSIVE)
+                return;
+            if (dirLatched)
+                throw logic_error("directory latches cannot be nested");
+            latch = &d.dirLatches[((uintptr_t)folder >> 6) % DIR_LATCH_STRIPES];
+            if (exclusive)
+                latch->lock();
+            else
+                latch->lock_shared();
+            dirLatched = true;
+        }
+        ~DirLatch()
+        {
+            if (latch == nullptr)
+                return;
+            if (exclusive)
+                latch->unlock();
+            else
+                latch->unlock_shared();
+            dirLatched = false;
+        }
+        DirLatch(const DirLatch&) = delete;
+    };
+
+    // Binds a session to the calling thread for a scope: currentfolder and actingUser
+    // then read and write the session's own copies
+    class SessionScope
+    {
+        SessionBinding saved;
+
+    public:
+        SessionScope(const Folder& d, DriveSession& session) : saved(boundSession)
+        {
+            boundSession.drive = &d;
+            boundSession.session = &session;
+        }
+        ~SessionScope()
+        {
+            boundSession = saved;
+        }
+        SessionScope(const SessionScope&) = delete;
+    };
+
+    treenode* root;
+    SessionField<treenode*, &DriveSession::cwd> currentfolder;
+    RecentFiles* recentCache; // told about nodes before they are freed
+    QuotaManager* quotas;     // charged for every file linked, unlinked or changed
+    SessionField<int, &DriveSession::user> actingUser; // owner recorded for new files
+    atomic<unsigned long> structureVersion; // bumped whenever a node is linked or unlinked
+    Folder(string rootName) : currentfolder(this, nullptr), actingUser(this, -1)
+    {
+        root = new treenode(rootName);
+        currentfolder = root;
+        recentCache = nullptr;
+        quotas = nullptr;
+        structureVersion = 0;
+    }
+
+    // Copy of a folder's aggregates, consistent with concurrent writers
+    SubtreeStats statsOf(const treenode* folder) const
+    {
+        lock_guard<recursive_mutex> account(accountLatch);
+        return folder->stats;
+    }
+
+    void setQuotaManager(QuotaManager* q)
+    {
+        quotas = q;
+    }
+
+    void setActingUser(int user)
+    {
+        actingUser = user;
+    }
+
+    // Sessions whose working folder must follow deletes; a session stays registered for as
+    // long as it can be bound to a thread
+    void registerSession(DriveSession* session)
+    {
+        lock_guard<mutex> guard(sessionLatch);
+        sessions.push_back(session);
+    }
+
+    void unregisterSession(DriveSession* session)
+    {
+        lock_guard<mutex> guard(sessionLatch);
+        sessions.erase(remove(sessions.begin(), sessions.end(), session), sessions.end());
+    }
+
+    // Before 'folder' is unlinked and freed: every session working inside it moves up to its
+    // parent, and so does the drive-wide cursor the menu uses. A batch run from the menu can
+    // name the current folder or one of its ancestors through ".." or an absolute path. The
+    // caller holds the structure latch exclusively, so no session is mid-command.
+    void moveCursorsOutOf(const treenode* folder)
+    {
+        auto inside = [folder](const treenode* cwd)
+        {
+            for (; cwd != nullptr; cwd = cwd->parent)
+            {
+                if (cwd == folder)
+                    return true;
+            }
+            return false;
+        };
+        if (inside(currentfolder.unbound()))
+            currentfolder.unbound() = folder->parent;
+        lock_guard<mutex> guard(sessionLatch);
+        for (DriveSession* session : sessions)
+        {
+            if (inside(session->cwd))
+                session->cwd = folder->parent;
+        }
+    }
+
+    // O(owners): moves every file a contribution covers in or out of its owner's usage
+    void chargeShares(const SubtreeStats& c, int sign)
+    {
+        for (size_t i = 0; i < c.owners.size(); i++)
+        {
+            const OwnerShare& o = c.owners[i];
+            quotas->charge(o.owner, sign * o.files, sign * o.versions, sign * o.bytes);
+        }
+    }
+
+    // Checks user and folder hard limits before a write lands in 'folder'. Prints why a
+    // write is rejected, or a warning when only a soft limit is crossed.
+    bool admitWrite(treenode* folder, int owner, long long files, long long versions, long long bytes)
+    {
+        lock_guard<recursive_mutex> account(accountLatch);
+        const char* soft = nullptr;
+        if (quotas != nullptr)
+        {
+            const char* hard = quotas->checkUser(owner, files, versions, bytes, soft);
+            if (hard != nullptr)
+            {
+                ENGINE_LOG << "Quota exceeded: user hard limit on " << hard << " reached." << endl;
+                return false;
+            }
+        }
+        for (treenode* t = folder; t != nullptr; t = t->parent)
+        {
+            if (t->quota == nullptr)
+                continue;
+            long long f = t->stats.files + files;
+            long long v = t->stats.versions + versions;
+            long long b = t->stats.historyBytes + bytes;
+            const char* hard = t->quota->exceeded(f, v, b, true);
+            if (hard != nullptr)
+            {
+                ENGINE_LOG << "Quota exceeded: folder '" << pathOf(t) << "' hard limit on " << hard << " reached." << endl;
+                return false;
+            }
+            if (soft == nullptr)
+                soft = t->quota->exceeded(f, v, b, false);
+        }
+        if (soft != nullptr)
+            ENGINE_LOG << "Warning: soft quota on " << soft << " exceeded." << endl;
+        return true;
+    }
+
+    void setRecentCache(RecentFiles* recent)
+    {
+        recentCache = recent;
+    }
+    ~Folder()
+    {
+        delete root;
+    }
+
+    bool isEmpty() const
+    {
+        return root == nullptr;
+    }
+
+    void optimizeStructure()
+    {
+        TreeLatch tree(*this, true);
+        ENGINE_LOG << "Optimizing folder structure using AVL balancing...\n";
+        // Every folder keeps its index up to date, so there is nothing to rebuild here
+        currentfolder->index->display();
+        ENGINE_LOG << "Folder structure optimization complete.\n";
+    }
+
+    // What a node adds to each ancestor's aggregates
+    SubtreeStats contribution(const treenode* node) const
+    {
+        SubtreeStats c;
+        if (node->isFolder)
+        {
+            c = node->stats;
+            c.folders++;
+        }
+        else
+        {
+            c.files = 1;
+            if (node->fileVersion != nullptr)
+            {
+                c.versions = node->fileVersion->getVersionCount();
+                c.latestBytes = node->fileVersion->getLatestSize();
+                c.historyBytes = node->fileVersion->getTotalBytes();
+            }
+            c.newestMtime = node->mtime;
+            c.addShare(node->owner, c.files, c.versions, c.historyBytes);
+        }
+        return c;
+    }
+
+    // O(depth * owners): applies sign * delta to every folder from 'folder' up to the root
+    void propagate(treenode* folder, const SubtreeStats& delta, int sign, time_t mtime)
+    {
+        for (treenode* t = folder; t != nullptr; t = t->parent)
+        {
+            t->stats.add(delta, sign);
+            if (mtime > t->stats.newestMtime)
+                t->stats.newestMtime = mtime;
+        }
+    }
+
+    // Call after changing a file's versions in place, with its contribution from before.
+    // 'touch' marks a user modification; background work such as pruning passes false.
+    void fileChanged(treenode* file, const SubtreeStats& before, bool touch = true)
+    {
+        lock_guard<recursive_mutex> account(accountLatch);
+        time_t now = touch ? time(0) : 0;
+        if (touch)
+            file->mtime = now;
+        SubtreeStats after = contribution(file);
+        SubtreeStats delta;
+        delta.versions = after.versions - before.versions;
+        delta.latestBytes = after.latestBytes - before.latestBytes;
+        delta.historyBytes = after.historyBytes - before.historyBytes;
+        delta.addShare(file->owner, 0, delta.versions, delta.historyBytes);
+        propagate(file->parent, delta, 1, now);
+        if (quotas != nullptr)
+            quotas->charge(file->owner, 0, delta.versions, delta.historyBytes);
+    }
+
+    // O(log n) index update plus an O(1) push onto the sibling list; the subtree is charged
+    // from its per-owner shares, never walked. Moves pass chargeQuota = false: the owners'
+    // usage does not change.
+    void linkChild(treenode* parent, treenode* child, bool chargeQuota = true)
+    {
+        attach(parent, child);
+        lock_guard<recursive_mutex> account(accountLatch);
+        SubtreeStats c = contribution(child);
+        propagate(parent, c, 1, time(0));
+        if (quotas != nullptr && chargeQuota)
+            chargeShares(c, 1);
+    }
+
+    void unlinkChild(treenode* child, bool chargeQuota = true)
+    {
+        detach(child);
+        lock_guard<recursive_mutex> account(accountLatch);
+        SubtreeStats c = contribution(child);
+        propagate(child->parent, c, -1, time(0));
+        if (quotas != nullptr && chargeQuota)
+            chargeShares(c, -1);
+    }
+
+    // Sibling list and index only; callers own the aggregate and quota bookkeeping
+    void attach(treenode* parent, treenode* child)
+    {
+        child->parent = parent;
+        child->prevsibling = nullptr;
+        child->nextsibling = parent->firstchild;
+        if (parent->firstchild != nullptr)
+            parent->firstchild->prevsibling = child;
+        parent->firstchild = child;
+        parent->index->insert(child->name, child->isFolder, child);
+        parent->children->insert(child->name, child->isFolder, child);
+        structureVersion++;
+    }
+
+    // Leaves child->parent set so the caller can still find the old parent
+    void detach(treenode* child)
+    {
+        treenode* parent = child->parent;
+        if (child->prevsibling != nullptr)
+            child->prevsibling->nextsibling = child->nextsibling;
+        else
+            parent->firstchild = child->nextsibling;
+        if (child->nextsibling != nullptr)
+            child->nextsibling->prevsibling = child->prevsibling;
+        child->prevsibling = nullptr;
+        child->nextsibling = nullptr;
+        parent->index->erase(child->name, child->isFolder);
+        parent->children->erase(child->name, child->isFolder);
+        structureVersion++;
+    }
+
+    treenode* findChild(treenode* parent, const string& name, bool isFolder) const
+    {
+        return parent->children->find(name, isFolder);
+    }
+
+    OpStatus createFolder(const string& foldername)
+    {
+        OpTimer timer(OP_FOLDER_CREATE_FOLDER);
+        TreeLatch tree(*this, false);
+        treenode* folder = currentfolder;
+        DirLatch dir(*this, folder, true);
+        if (findChild(folder, foldername, true) != nullptr)
+        {
+            ENGINE_LOG << "Folder '" << foldername << "' already exists in current directory." << endl;
+            return STATUS_EXISTS;
+        }
+        treenode* newfolder = new treenode(foldername, true);
+        newfolder->owner = actingUser;
+        linkChild(folder, newfolder);
+        ENGINE_LOG << "Folder '" << foldername << "' created successfully." << endl;
+        return STATUS_OK;
+    }
+
+    // STATUS_EXISTS leaves the file alone; the caller decides whether to update it instead
+    OpStatus createFile(const string& filename, string content)
+    {
+        return createFile(filename, makeContent(move(content)));
+    }
+
+    OpStatus createFile(const string& filename, ContentRef content)
+    {
+        OpTimer timer(OP_FOLDER_CREATE_FILE);
+        TreeLatch tree(*this, false);
+        treenode* folder = currentfolder;
+        DirLatch dir(*this, folder, true);
+        if (findChild(folder, filename, false) != nullptr)
+        {
+            ENGINE_LOG << "File '" << filename << "' already exists in current directory." << endl;
+            return STATUS_EXISTS;
+        }
+        // Admission and linking under one account latch, so concurrent writers can't both
+        // squeeze under the same quota
+        lock_guard<recursive_mutex> account(accountLatch);
+        if (!admitWrite(folder, actingUser, 1, 1, content->size()))
+        {
+            ENGINE_LOG << "File '" << filename << "' was not created." << endl;
+            return STATUS_QUOTA;
+        }
+        treenode* newfile = new treenode(filename, false);
+        newfile->owner = actingUser;
+        newfile->fileVersion = new FileVersioning();
+        newfile->fileVersion->addVersion(move(content));
+        linkChild(folder, newfile);
+        ENGINE_LOG << "File '" << filename << "' created successfully." << endl;
+        return STATUS_OK;
+    }
+
+    treenode* findChildByName(treenode* parent, const string& name) const
+    {
+        OpTimer timer(OP_FOLDER_LOOKUP);
+        TreeLatch tree(*this, false);
+        return parent->children->find(name);
+    }
+
+    bool navigateToFolder(const string& folderName)
+    {
+        OpTimer timer(OP_FOLDER_NAVIGATE);
+        TreeLatch tree(*this, false);
+        treenode* child = findChild(currentfolder, folderName, true);
+        if (child != nullptr)
+        {
+            currentfolder = child;
+            ENGINE_LOG << "Changed directory to: " << folderName << endl;
+            return true;
+        }
+        ENGINE_LOG << "Folder '" << folderName << "' not found." << endl;
+        return false;
+    }
+
+    bool navigateUp()
+    {
+        OpTimer timer(OP_FOLDER_NAVIGATE);
+        TreeLatch tree(*this, false);
+        if (currentfolder->parent != nullptr)
+        {
+            currentfolder = currentfolder->parent;
+            ENGINE_LOG << "Changed directory to parent folder." << endl;
+            return true;
+        }
+        ENGINE_LOG << "Already at root directory." << endl;
+        return false;
+    }
+
+    bool deleteFolder(const string& folderName)
+    {
+        OpTimer timer(OP_FOLDER_DELETE_FOLDER);
+        TreeLatch tree(*this, true);
+        treenode* child = findChild(currentfolder, folderName, true);
+        if (child != nullptr)
+        {
+            moveCursorsOutOf(child);
+            unlinkChild(child);
+            if (recentCache != nullptr)
+                recentCache->forgetSubtree(child);
+            delete child;
+            ENGINE_LOG << "Folder '" << folderName << "' deleted successfully." << endl;
+            return true;
+        }
+        ENGINE_LOG << "Folder '" << folderName << "' not found." << endl;
+        return false;
+    }
+
+    OpStatus deleteFile(const string& filename, RecycleBin& recycle)
+    {
+        OpTimer timer(OP_FOLDER_DELETE_FILE);
+        TreeLatch tree(*this, true);
+        treenode* child = findChild(currentfolder, filename, false);
+        if (child != nullptr && child->fileVersion != nullptr)
+        {
+            unlinkChild(child);
+            // Hand the whole version chain to the bin instead of copying the latest content
+            recycle.push(new RecycleEntry(child->name, getCurrentPath(), child->fileVersion, child->owner));
+            child->fileVersion = nullptr;
+            if (recentCache != nullptr)
+                recentCache->forget(child);
+            delete child;
+            ENGINE_LOG << "File '" << filename << "' deleted and moved to Recycle Bin." << endl;
+            return STATUS_OK;
+        }
+        ENGINE_LOG << "File '" << filename << "' not found." << endl;
+        return STATUS_NOT_FOUND;
+    }
+
+    // Resolves a path in getCurrentPath() form ("Root/a/b")
+    treenode* findFolderByPath(const string& path) const
+    {
+        TreeLatch tree(*this, false);
+        stringstream ss(path);
+        string part;
+        if (!getline(ss, part, '/') || part != root->name)
+            return nullptr;
+        treenode* node = root;
+        while (getline(ss, part, '/'))
+        {
+            if (part.empty())
+                continue;
+            treenode* next = findChildByName(node, part);
+            if (next == nullptr || !next->isFolder)
+                return nullptr;
+            node = next;
+        }
+        return node;
+    }
+
+    // Resolves "Root/a/b" from the root, anything else from the current folder; ".." goes up
+    treenode* resolvePath(const string& path) const
+    {
+        OpTimer timer(OP_FOLDER_RESOLVE_PATH);
+        TreeLatch tree(*this, false);
+        return walkPath(path, false);
+    }
+
+    // The folder something created at 'path' would land in, as far as the tree exists
+    // today: its parent when that exists, otherwise the deepest folder along the way, under
+    // which the missing ones would be made. That folder's permissions govern the create.
+    treenode* deepestExistingParent(const string& path) const
+    {
+        TreeLatch tree(*this, false);
+        size_t slash = path.find_last_of('/');
+        return slash == string::npos ? currentfolder.get() : walkPath(path.substr(0, slash), true);
+    }
+
+    // Follows 'path' from the current folder, or from the root when it starts with the
+    // root's name. A missing part fails the walk, or with 'partial' ends it at the deepest
+    // folder reached.
+    treenode* walkPath(const string& path, bool partial) const
+    {
+        stringstream ss(path);
+        string part;
+        treenode* node = currentfolder;
+        bool first = true;
+        while (getline(ss, part, '/'))
+        {
+            if (first && part == root->name)
+            {
+                node = root;
+                first = false;
+                continue;
+            }
+            first = false;
+            if (part.empty() || part == ".")
+                continue;
+            if (!node->isFolder)
+                return partial ? node->parent : nullptr;
+            if (part == "..")
+            {
+                if (node->parent != nullptr)
+                    node = node->parent;
+                continue;
+            }
+            treenode* next = node->children->find(part);
+            if (next == nullptr)
+                return partial ? node : nullptr;
+            node = next;
+        }
+        return partial && !node->isFolder ? node->parent : node;
+    }
+
+    // Where 'dstPath' puts a node: into it when it names a folder, otherwise into its
+    // parent folder under its last component
+    bool resolveDestination(const string& dstPath, const string& keepName, treenode*& parent, string& name) const
+    {
+        string error = destinationOf(dstPath, keepName, parent, name);
+        if (!error.empty())
+        {
+            ENGINE_LOG << error << endl;
+            return false;
+        }
+        return true;
+    }
+
+    // Same as resolveDestination without printing; returns why it failed, or ""
+    string destinationOf(const string& dstPath, const string& keepName, treenode*& parent, string& name) const
+    {
+        treenode* existing = resolvePath(dstPath);
+        if (existing != nullptr && existing->isFolder)
+        {
+            parent = existing;
+            name = keepName;
+            return "";
+        }
+        size_t slash = dstPath.find_last_of('/');
+        parent = slash == string::npos ? currentfolder : resolvePath(dstPath.substr(0, slash));
+        name = slash == string::npos ? dstPath : dstPath.substr(slash + 1);
+        if (parent == nullptr || !parent->isFolder)
+            return "Destination folder for '" + dstPath + "' not found.";
+        if (name.empty() || name == "." || name == "..")
+            return "Invalid destination name '" + name + "'.";
+        return "";
+    }
+
+    // Only valid while the node is out of its parent's index
+    void setName(treenode* node, const string& newName)
+    {
+        memStats.remove(MEM_TREE, node->footprint());
+        node->name = newName;
+        memStats.add(MEM_TREE, node->footprint());
+    }
+
+    // O(log n): re-keys the entry in the current folder's index; nothing else changes
+    bool renameNode(const string& oldName, const string& newName)
+    {
+        OpTimer timer(OP_FOLDER_RENAME);
+        TreeLatch tree(*this, true);
+        treenode* node = findChildByName(currentfolder, oldName);
+        if (node == nullptr)
+        {
+            ENGINE_LOG << "'" << oldName << "' not found." << endl;
+            return false;
+        }
+        if (newName.empty() || newName.find('/') != string::npos || newName == "." || newName == "..")
+        {
+            ENGINE_LOG << "Invalid name '" << newName << "'." << endl;
+            return false;
+        }
+        if (findChild(currentfolder, newName, node->isFolder) != nullptr)
+        {
+            ENGINE_LOG << "'" << newName << "' already exists in current directory." << endl;
+            return false;
+        }
+        currentfolder->index->erase(node->name, node->isFolder);
+        currentfolder->children->erase(node->name, node->isFolder);
+        setName(node, newName);
+        currentfolder->index->insert(node->name, node->isFolder, node);
+        currentfolder->children->insert(node->name, node->isFolder, node);
+        structureVersion++;
+        ENGINE_LOG << "Renamed '" << oldName << "' to '" << newName << "'." << endl;
+        return true;
+    }
+
+    // Relinks the subtree under its new parent: O(1) pointer work, O(log n) per index and
+    // O(depth) aggregate updates on both sides, however large the subtree is
+    bool moveNode(const string& srcPath, const string& dstPath)
+    {
+        OpTimer timer(OP_FOLDER_MOVE);
+        TreeLatch tree(*this, true);
+        treenode* node = resolvePath(srcPath);
+        if (node == nullptr)
+        {
+            ENGINE_LOG << "'" << srcPath << "' not found." << endl;
+            return false;
+        }
+        if (node == root)
+        {
+            ENGINE_LOG << "The root folder cannot be moved." << endl;
+            return false;
+        }
+        treenode* parent;
+        string name;
+        if (!resolveDestination(dstPath, node->name, parent, name))
+            return false;
+        for (treenode* t = parent; t != nullptr; t = t->parent)
+        {
+            if (t == node)
+            {
+                ENGINE_LOG << "Cannot move '" << node->name << "' into itself." << endl;
+                return false;
+            }
+        }
+        treenode* clash = findChild(parent, name, node->isFolder);
+        if (clash == node)
+            return true;
+        if (clash != nullptr)
+        {
+            ENGINE_LOG << "'" << name << "' already exists in " << pathOf(parent) << "." << endl;
+            return false;
+        }
+
+        treenode* oldParent = node->parent;
+        unlinkChild(node, false);
+        // Ownership is unchanged, so only folder quotas on the destination side can object
+        SubtreeStats c = contribution(node);
+        if (!admitWrite(parent, -1, c.files, c.versions, c.historyBytes))
+        {
+            linkChild(oldParent, node, false);
+            ENGINE_LOG << "'" << srcPath << "' was not moved." << endl;
+            return false;
+        }
+        if (name != node->name)
+            setName(node, name);
+        linkChild(parent, node, false);
+        ENGINE_LOG << "Moved '" << srcPath << "' to " << pathOf(node) << "." << endl;
+        return true;
+    }
+
+    // Folders are rebuilt node by node; file histories share their content blobs with the source
+    treenode* cloneSubtree(const treenode* src, const string& name)
+    {
+        treenode* copy = new treenode(name, src->isFolder);
+        copy->owner = actingUser;
+        if (src->fileVersion != nullptr)
+            copy->fileVersion = src->fileVersion->clone();
+        for (const treenode* child = src->firstchild; child != nullptr; child = child->nextsibling)
+            linkChild(copy, cloneSubtree(child, child->name), false);
+        return copy;
+    }
+
+    bool copyNode(const string& srcPath, const string& dstPath)
+    {
+        OpTimer timer(OP_FOLDER_COPY);
+        TreeLatch tree(*this, true);
+        treenode* node = resolvePath(srcPath);
+        if (node == nullptr)
+        {
+            ENGINE_LOG << "'" << srcPath << "' not found." << endl;
+            return false;
+        }
+        treenode* parent;
+        string name;
+        if (!resolveDestination(dstPath, node->name, parent, name))
+            return false;
+        if (findChild(parent, name, node->isFolder) != nullptr)
+        {
+            ENGINE_LOG << "'" << name << "' already exists in " << pathOf(parent) << "." << endl;
+            return false;
+        }
+        SubtreeStats c = contribution(node);
+        if (!admitWrite(parent, actingUser, c.files, c.versions, c.historyBytes))
+        {
+            ENGINE_LOG << "'" << srcPath << "' was not copied." << endl;
+            return false;
+        }
+        treenode* copy = cloneSubtree(node, name);
+        linkChild(parent, copy);
+        ENGINE_LOG << "Copied '" << srcPath << "' to " << pathOf(copy) << "." << endl;
+        return true;
+    }
+
+    // Bookkeeping deferred while a batch runs: aggregate deltas per folder are propagated once
+    // in flushBatch, and quota usage is charged once per owner
+    struct BatchState
+    {
+        unordered_map<treenode*, SubtreeStats> stats; // per folder, not yet propagated
+        unordered_map<treenode*, SubtreeStats> quota; // pending deltas as seen by quota'd ancestors
+        QuotaManager::Usage usage[MAX_USERS];
+        string cachedPath; // last parent folder resolved by ensureFolder
+        treenode* cachedFolder = nullptr;
+    };
+
+    void deferDelta(BatchState& state, treenode* folder, const SubtreeStats& delta, int sign)
+    {
+        SubtreeStats& d = state.stats[folder];
+        d.add(delta, sign);
+        if (sign > 0 && delta.newestMtime > d.newestMtime)
+            d.newestMtime = delta.newestMtime;
+        for (treenode* t = folder; t != nullptr; t = t->parent)
+        {
+            if (t->quota == nullptr)
+                continue;
+            SubtreeStats& q = state.quota[t];
+            q.files += sign * delta.files;
+            q.versions += sign * delta.versions;
+            q.historyBytes += sign * delta.historyBytes;
+        }
+    }
+
+    void deferCharge(BatchState& state, int owner, long long files, long long versions, long long bytes)
+    {
+        if (owner < 0 || owner >= MAX_USERS)
+            return;
+        state.usage[owner].files += files;
+        state.usage[owner].versions += versions;
+        state.usage[owner].bytes += bytes;
+    }
+
+    // admitWrite for a batch: counts what the batch already added and reports instead of printing
+    bool admitBatchWrite(BatchState& state, treenode* folder, int owner, long long files, long long versions,
+        long long bytes, string& reason, BatchResult& result)
+    {
+        lock_guard<recursive_mutex> account(accountLatch);
+        const char* soft = nullptr;
+        if (quotas != nullptr && owner >= 0 && owner < MAX_USERS)
+        {
+            const QuotaManager::Usage& p = state.usage[owner];
+            const char* hard = quotas->checkUser(owner, p.files + files, p.versions + versions, p.bytes + bytes, soft);
+            if (hard != nullptr)
+            {
+                reason = string("user hard limit on ") + hard + " reached";
+                return false;
+            }
+        }
+        for (treenode* t = folder; t != nullptr; t = t->parent)
+        {
+            if (t->quota == nullptr)
+                continue;
+            long long f = t->stats.files + files, v = t->stats.versions + versions, b = t->stats.historyBytes + bytes;
+            unordered_map<treenode*, SubtreeStats>::const_iterator q = state.quota.find(t);
+            if (q != state.quota.end())
+            {
+                f += q->second.files;
+                v += q->second.versions;
+                b += q->second.historyBytes;
+            }
+            const char* hard = t->quota->exceeded(f, v, b, true);
+            if (hard != nullptr)
+            {
+                reason = "folder '" + pathOf(t) + "' hard limit on " + hard + " reached";
+                return false;
+            }
+            if (soft == nullptr)
+                soft = t->quota->exceeded(f, v, b, false);
+        }
+        if (soft != nullptr)
+            result.softWarnings++;
+        return true;
+    }
+
+    // Applies everything deferred so far: one O(depth) walk per touched folder
+    void flushBatch(BatchState& state)
+    {
+        lock_guard<recursive_mutex> account(accountLatch);
+        for (unordered_map<treenode*, SubtreeStats>::const_iterator it = state.stats.begin(); it != state.stats.end(); ++it)
+            propagate(it->first, it->second, 1, it->second.newestMtime);
+        state.stats.clear();
+        state.quota.clear();
+        for (int u = 0; u < MAX_USERS; u++)
+        {
+            const QuotaManager::Usage& p = state.usage[u];
+            if (quotas != nullptr && (p.files != 0 || p.versions != 0 || p.bytes != 0))
+                quotas->charge(u, p.files, p.versions, p.bytes);
+            state.usage[u] = QuotaManager::Usage();
+        }
+    }
+
+    // Resolves a folder path, creating whatever is missing (mkdir -p)
+    treenode* ensureFolder(BatchState& state, const string& path, BatchResult& result)
+    {
+        if (state.cachedFolder != nullptr && path == state.cachedPath)
+            return state.cachedFolder;
+        stringstream ss(path);
+        string part;
+        treenode* node = currentfolder;
+        bool first = true;
+        while (getline(ss, part, '/'))
+        {
+            if (first && part == root->name)
+            {
+                node = root;
+                first = false;
+                continue;
+            }
+            first = false;
+            if (part.empty() || part == ".")
+                continue;
+            if (part == "..")
+            {
+                if (node->parent != nullptr)
+                    node = node->parent;
+                continue;
+            }
+            treenode* next = findChild(node, part, true);
+            if (next == nullptr)
+            {
+                // Look again under the exclusive latch: another session may have just made it
+                DirLatch dir(*this, node, true);
+                next = findChild(node, part, true);
+                if (next == nullptr)
+                {
+                    next = new treenode(part, true);
+                    next->owner = actingUser;
+                    attach(node, next);
+                    deferDelta(state, node, contribution(next), 1);
+                    result.foldersCreated++;
+                }
+            }
+            node = next;
+        }
+        state.cachedPath = path;
+        state.cachedFolder = node;
+        return node;
+    }
+
+    static void splitPath(const string& path, string& parent, string& name)
+    {
+        size_t slash = path.find_last_of('/');
+        parent = slash == string::npos ? "" : path.substr(0, slash);
+        name = slash == string::npos ? path : path.substr(slash + 1);
+    }
+
+    // Returns "" when the op was applied or skipped, otherwise why it failed
+    string applyBatchOp(BatchState& state, const BatchOp& op, ConflictPolicy policy, RecycleBin& recycle, BatchResult& result)
+    {
+        string reason;
+        if (op.type == BATCH_MKDIR || op.type == BATCH_CREATE)
+        {
+            string parentPath, name;
+            splitPath(op.path, parentPath, name);
+            if (name.empty() || name == "." || name == "..")
+                return "invalid name";
+            treenode* parent = ensureFolder(state, parentPath, result);
+            bool isDir = op.type == BATCH_MKDIR;
+            treenode* existing = findChild(parent, name, isDir);
+            if (existing != nullptr)
+            {
+                if (policy == CONFLICT_FAIL)
+                    return "already exists";
+                if (policy == CONFLICT_SKIP || isDir)
+                {
+                    result.skipped++;
+                    return "";
+                }
+                BatchOp update(BATCH_UPDATE, op.path, op.content);
+                return applyBatchOp(state, update, policy, recycle, result);
+            }
+            if (isDir)
+            {
+                ensureFolder(state, op.path, result);
+                result.applied++;
+                return "";
+            }
+            if (!admitBatchWrite(state, parent, actingUser, 1, 1, op.contentSize(), reason, result))
+                return reason;
+            treenode* file = new treenode(name, false);
+            file->owner = actingUser;
+            file->fileVersion = new FileVersioning();
+            file->fileVersion->addVersion(op.content, false);
+            SubtreeStats c = contribution(file);
+            bool raced;
+            {
+                DirLatch dir(*this, parent, true);
+                raced = findChild(parent, name, false) != nullptr;
+                if (!raced)
+                    attach(parent, file);
+            }
+            if (raced)
+            {
+                // Another session created it since the check above; settle the conflict again
+                delete file;
+                return applyBatchOp(state, op, policy, recycle, result);
+            }
+            deferDelta(state, parent, c, 1);
+            deferCharge(state, actingUser, c.files, c.versions, c.historyBytes);
+            result.applied++;
+            return "";
+        }
+
+        treenode* node = resolvePath(op.path);
+        if (node == nullptr)
+            return "not found";
+
+        if (op.type == BATCH_UPDATE)
+        {
+            if (node->isFolder || node->fileVersion == nullptr)
+                return "not a file";
+            if (!admitBatchWrite(state, node->parent, node->owner, 0, 1, op.contentSize(), reason, result))
+                return reason;
+            DirLatch dir(*this, node->parent, true);
+            SubtreeStats before = contribution(node);
+            node->fileVersion->addVersion(op.content, false);
+            node->mtime = time(0);
+            SubtreeStats delta = contribution(node);
+            delta.files = 0;
+            delta.versions -= before.versions;
+            delta.latestBytes -= before.latestBytes;
+            delta.historyBytes -= before.historyBytes;
+            delta.owners.clear();
+            delta.addShare(node->owner, 0, delta.versions, delta.historyBytes);
+            deferDelta(state, node->parent, delta, 1);
+            deferCharge(state, node->owner, 0, delta.versions, delta.historyBytes);
+            result.applied++;
+            return "";
+        }
+
+        if (node == root)
+            return "the root folder cannot be changed";
+
+        if (op.type == BATCH_DELETE)
+        {
+            if (node->isFolder)
+            {
+                // Pending deltas may point into this subtree; settle them before it is freed
+                flushBatch(state);
+                state.cachedFolder = nullptr;
+                moveCursorsOutOf(node);
+                unlinkChild(node);
+                if (recentCache != nullptr)
+                    recentCache->forgetSubtree(node);
+                delete node;
+            }
+            else
+                batchRecycle(state, node, recycle);
+            result.applied++;
+            return "";
+        }
+
+        // BATCH_MOVE
+        if (node->isFolder)
+            flushBatch(state); // the subtree's own pending deltas would otherwise stay with the old ancestors' quotas
+        treenode* parent;
+        string name;
+        reason = destinationOf(op.target, node->name, parent, name);
+        if (!reason.empty())
+            return reason;
+        for (treenode* t = parent; t != nullptr; t = t->parent)
+        {
+            if (t == node)
+                return "cannot move a folder into itself";
+        }
+        treenode* clash = findChild(parent, name, node->isFolder);
+        if (clash == node)
+        {
+            result.applied++;
+            return "";
+        }
+        if (clash != nullptr)
+        {
+            if (policy == CONFLICT_FAIL)
+                return "'" + name + "' already exists at the destination";
+            if (policy == CONFLICT_SKIP)
+            {
+                result.skipped++;
+                return "";
+            }
+            if (clash->isFolder)
+                return "cannot overwrite a folder";
+            batchRecycle(state, clash, recycle);
+        }
+        treenode* oldParent = node->parent;
+        SubtreeStats c = contribution(node);
+        detach(node);
+        deferDelta(state, oldParent, c, -1);
+        if (!admitBatchWrite(state, parent, -1, c.files, c.versions, c.historyBytes, reason, result))
+        {
+            attach(oldParent, node);
+            deferDelta(state, oldParent, c, 1);
+            return reason;
+        }
+        if (name != node->name)
+            setName(node, name);
+        attach(parent, node);
+        deferDelta(state, parent, c, 1);
+        state.cachedFolder = nullptr;
+        result.applied++;
+        return "";
+    }
+
+    void batchRecycle(BatchState& state, treenode* file, RecycleBin& recycle)
+    {
+        treenode* parent = file->parent;
+        SubtreeStats c = contribution(file);
+        detach(file);
+        deferDelta(state, parent, c, -1);
+        deferCharge(state, file->owner, -c.files, -c.versions, -c.historyBytes);
+        recycle.push(new RecycleEntry(file->name, pathOf(parent), file->fileVersion, file->owner));
+        file->fileVersion = nullptr;
+        if (recentCache != nullptr)
+            recentCache->forget(file);
+        delete file;
+    }
+
+    // Runs a list of ops without console I/O. Index updates happen per op so later ops see
+    // earlier ones; aggregates and quota usage are settled in one pass at the end. A failed
+    // op is recorded in the result and the rest of the batch still runs.
+    BatchResult applyBatch(const vector<BatchOp>& ops, ConflictPolicy policy, RecycleBin& recycle)
+    {
+        OpTimer timer(OP_FOLDER_BATCH);
+        // Creates and updates only take directory latches; deletes and moves free or relink nodes
+        bool structural = false;
+        for (size_t i = 0; i < ops.size() && !structural; i++)
+            structural = ops[i].type == BATCH_DELETE || ops[i].type == BATCH_MOVE;
+        TreeLatch tree(*this, structural);
+        BatchResult result;
+        BatchState state;
+        for (size_t i = 0; i < ops.size(); i++)
+        {
+            string reason = applyBatchOp(state, ops[i], policy, recycle, result);
+            if (!reason.empty())
+            {
+                BatchError error;
+                error.index = i;
+                error.path = ops[i].path;
+                error.reason = reason;
+                result.errors.push_back(error);
+            }
+        }
+        flushBatch(state);
+        return result;
+    }
+
+    OpStatus restoreFile(const string& filename, RecycleBin& recycle)
+    {
+        OpTimer timer(OP_FOLDER_RESTORE_FILE);
+        TreeLatch tree(*this, true);
+        const RecycleEntry* peek = recycle.peekByName(filename);
+        if (peek != nullptr)
+        {
+            treenode* target = findFolderByPath(peek->originalPath);
+            if (target == nullptr)
+                target = currentfolder;
+            if (findChild(target, filename, false) != nullptr)
+            {
+                ENGINE_LOG << "Cannot restore: '" << filename << "' already exists in " << peek->originalPath
+                    << ". It stays in the Recycle Bin." << endl;
+                return STATUS_EXISTS;
+            }
+            long long versions = peek->history ? peek->history->getVersionCount() : 0;
+            if (!admitWrite(target, peek->owner, 1, versions, peek->bytes))
+            {
+                ENGINE_LOG << "File '" << filename << "' stays in the Recycle Bin." << endl;
+                return STATUS_QUOTA;
+            }
+        }
+
+        RecycleEntry* entry = recycle.restoreFileByName(filename);
+        if (entry == nullptr)
+            return STATUS_NOT_FOUND;
+
+        treenode* target = findFolderByPath(entry->originalPath);
+        if (target == nullptr)
+        {
+            ENGINE_LOG << "Original folder '" << entry->originalPath << "' no longer exists; restoring to current folder." << endl;
+            target = currentfolder;
+        }
+        treenode* node = new treenode(entry->name, false);
+        node->owner = entry->owner;
+        node->fileVersion = entry->history;
+        entry->history = nullptr;
+        linkChild(target, node);
+        ENGINE_LOG << "File '" << entry->name << "' restored with " << node->fileVersion->getVersionCount()
+            << " version(s)." << endl;
+        delete entry;
+        return STATUS_OK;
+    }
+
+    void listCurrent() const
+    {
+        OpTimer timer(OP_FOLDER_LIST);
+        TreeLatch tree(*this, false);
+        if (currentfolder == nullptr)
+        {
+            ENGINE_LOG << "Error: No current folder selected." << endl;
+            return;
+        }
+        DirLatch dir(*this, currentfolder, false);
+
+        treenode* child = currentfolder->firstchild;
+        if (child == nullptr)
+        {
+            ENGINE_LOG << "Empty folder." << endl;
+            return;
+        }
+
+        ENGINE_LOG << "\nCurrent directory: " << getCurrentPath() << endl;
+
+        ENGINE_LOG << "Contents:\n------------------------" << endl;
+        int folderCount = 0, fileCount = 0;
+
+        // The index is already sorted: folders, then files, each in name order
+        for (AVLTree::Iterator it = currentfolder->index->begin(); it.valid(); it.next())
+        {
+            if ((*it)->isFolder)
+            {
+                ENGINE_LOG << "[Folder] " << (*it)->name << endl;
+                folderCount++;
+            }
+        }
+
+        for (AVLTree::Iterator it = currentfolder->index->begin(); it.valid(); it.next())
+        {
+            if (!(*it)->isFolder)
+            {
+                printEntry(*it);
+                fileCount++;
+            }
+        }
+
+        ENGINE_LOG << "------------------------" << endl;
+        ENGINE_LOG << folderCount << " folder(s), " << fileCount << " file(s)" << endl;
+        SubtreeStats st = statsOf(currentfolder);
+        ENGINE_LOG << "Subtree: " << st.folders << " folder(s), " << st.files << " file(s), "
+            << st.latestBytes << " bytes" << endl;
+    }
+
+    // du-style report from the maintained aggregates: O(1) per folder shown
+    void showUsage() const
+    {
+        TreeLatch tree(*this, false);
+        DirLatch dir(*this, currentfolder, false);
+        lock_guard<recursive_mutex> account(accountLatch);
+        const SubtreeStats& st = currentfolder->stats;
+        ENGINE_LOG << "\nUsage for " << getCurrentPath() << endl;
+        ENGINE_LOG << "Files: " << st.files << ", Folders: " << st.folders << endl;
+        ENGINE_LOG << "Current content: " << st.latestBytes << " bytes" << endl;
+        ENGINE_LOG << "All versions: " << st.historyBytes << " bytes" << endl;
+        ENGINE_LOG << "Last modified: " << formatTimestamp(st.newestMtime) << endl;
+        ENGINE_LOG << "------------------------" << endl;
+        for (AVLTree::Iterator it = currentfolder->index->begin(); it.valid(); it.next())
+        {
+            const treenode* child = *it;
+            if (!child->isFolder)
+                continue;
+            ENGINE_LOG << setw(12) << child->stats.latestBytes << "  " << child->name << "/ ("
+                << child->stats.files << " files)" << endl;
+        }
+    }
+
+    void printEntry(const treenode* child) const
+    {
+        if (child->isFolder)
+        {
+            ENGINE_LOG << "[Folder] " << child->name << endl;
+            return;
+        }
+        ENGINE_LOG << "[File] " << child->name;
+        if (child->fileVersion != nullptr)
+        {
+            ENGINE_LOG << " (Version: " << child->fileVersion->getCurrentVersionNumber() << ")";
+        }
+        ENGINE_LOG << endl;
+    }
+
+    // Names from 'from' through everything starting with 'to', in order, so "m" to "p"
+    // includes "pa.txt"; O(log n + k)
+    void listRange(const string& from, const string& to) const
+    {
+        TreeLatch tree(*this, false);
+        DirLatch dir(*this, currentfolder, false);
+        int shown = 0;
+        for (AVLTree::Iterator it = currentfolder->index->lowerBound(from); it.valid() && it.key().compare(0, to.size(), to) <= 0; it.next())
+        {
+            printEntry(*it);
+            shown++;
+        }
+        ENGINE_LOG << shown << " entr" << (shown == 1 ? "y" : "ies") << " between '" << from << "' and '" << to << "'" << endl;
+    }
+
+    // One-based page of the sorted listing; O(log n + pageSize)
+    void listPage(int page, int pageSize) const
+    {
+        TreeLatch tree(*this, false);
+        DirLatch dir(*this, currentfolder, false);
+        int total = currentfolder->index->size();
+        if (page < 1 || pageSize < 1)
+        {
+            ENGINE_LOG << "Page and page size must be positive." << endl;
+            return;
+        }
+        int pages = (total + pageSize - 1) / pageSize;
+        AVLTree::Iterator it = currentfolder->index->at((page - 1) * pageSize);
+        for (int i = 0; i < pageSize && it.valid(); i++, it.next())
+        {
+            printEntry(*it);
+        }
+        ENGINE_LOG << "Page " << page << " of " << max(pages, 1) << " (" << total << " entries)" << endl;
+    }
+
+    void preOrderTraversal(treenode* node, int depth = 0) const
+    {
+        if (node == nullptr) return;
+        for (int i = 0; i < depth; i++)
+        {
+            ENGINE_LOG << "  ";
+        }
+        if (node->isFolder)
+        {
+            ENGINE_LOG << "[+] " << node->name << "/" << endl;
+        }
+        else
+        {
+            ENGINE_LOG << "[-] " << node->name << endl;
+        }
+        if (node->index != nullptr)
+        {
+            for (AVLTree::Iterator it = node->index->begin(); it.valid(); it.next())
+            {
+                preOrderTraversal(*it, depth + 1);
+            }
+        }
+    }
+
+    void listAllFolders() const
+    {
+        TreeLatch tree(*this, true);
+        ENGINE_LOG << "\nComplete Directory Structure:\n=============================" << endl;
+        preOrderTraversal(root);
+        ENGINE_LOG << "=============================" << endl;
+    }
+
+    OpStatus updateFile(const string& filename, string newContent)
+    {
+        return updateFile(filename, makeContent(move(newContent)));
+    }
+
+    OpStatus updateFile(const string& filename, ContentRef newContent)
+    {
+        OpTimer timer(OP_FOLDER_UPDATE_FILE);
+        TreeLatch tree(*this, false);
+        DirLatch dir(*this, currentfolder, true);
+        treenode* child = findChild(currentfolder, filename, false);
+        if (child != nullptr && child->fileVersion != nullptr)
+        {
+            lock_guard<recursive_mutex> account(accountLatch);
+            if (!admitWrite(child->parent, child->owner, 0, 1, newContent->size()))
+            {
+                ENGINE_LOG << "File '" << filename << "' was not updated." << endl;
+                return STATUS_QUOTA;
+            }
+            SubtreeStats before = contribution(child);
+            child->fileVersion->addVersion(move(newContent));
+            fileChanged(child, before);
+            ENGINE_LOG << "File '" << filename << "' updated successfully." << endl;
+            return STATUS_OK;
+        }
+        ENGINE_LOG << "File '" << filename << "' not found in current directory." << endl;
+        return STATUS_NOT_FOUND;
+    }
+
+    // Up to 'len' bytes of the current version from 'offset'; reads past the end come back
+    // short. Copies only the requested range.
+    OpStatus readRange(const string& path, size_t offset, size_t len, string& out) const
+    {
+        OpTimer timer(OP_FOLDER_READ_RANGE);
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        out = file->fileVersion->latest()->read(offset, len);
+        return STATUS_OK;
+    }
+
+    // Writes 'bytes' at 'offset' as a new version; append writes at the current end instead.
+    // The new version shares every extent the write doesn't touch. Offsets past the end
+    // would leave a hole and are refused.
+    OpStatus writeRange(const string& path, size_t offset, string_view bytes, bool append = false)
+    {
+        OpTimer timer(OP_FOLDER_WRITE_RANGE);
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, true);
+        ContentRef current = file->fileVersion->latest();
+        if (append)
+            offset = current->size();
+        if (offset > current->size())
+            return STATUS_INVALID;
+        // An empty write, or one that puts back the bytes already there, is not a new version
+        if (offset + bytes.size() <= current->size())
+        {
+            bool same = true;
+            size_t at = 0;
+            current->forEachRange(offset, bytes.size(), [&](string_view piece) {
+                same = same && piece == bytes.substr(at, piece.size());
+                at += piece.size();
+            });
+            if (same)
+                return STATUS_OK;
+        }
+        return commitVersion(file, current->write(offset, bytes));
+    }
+
+    // Differences between two held versions of a file. Only the lookups happen under the
+    // directory latch; the diff runs on the shared blobs after it is released.
+    OpStatus diffVersions(const string& path, int fromVersion, int toVersion, ContentDiff::Result& out) const
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        ContentRef from, to;
+        {
+            DirLatch dir(*this, file->parent, false);
+            from = file->fileVersion->contentOf(fromVersion);
+            to = file->fileVersion->contentOf(toVersion);
+        }
+        if (from == nullptr || to == nullptr)
+            return STATUS_NOT_FOUND;
+        out = ContentDiff::diff(from, to);
+        return STATUS_OK;
+    }
+
+    // Merges the changes 'ours' and 'theirs' each made to 'base' and stores the result as a
+    // new version, conflict markers and all. Binary content that conflicts can't be marked
+    // up and is refused.
+    OpStatus mergeVersions(const string& path, int baseVersion, int oursVersion, int theirsVersion, size_t& conflicts)
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, true);
+        ContentRef base = file->fileVersion->contentOf(baseVersion);
+        ContentRef ours = file->fileVersion->contentOf(oursVersion);
+        ContentRef theirs = file->fileVersion->contentOf(theirsVersion);
+        if (base == nullptr || ours == nullptr || theirs == nullptr)
+            return STATUS_NOT_FOUND;
+        ContentDiff::MergeResult merged = ContentDiff::merge(base, ours, theirs);
+        conflicts = merged.conflicts;
+        if (merged.content == nullptr)
+            return STATUS_INVALID;
+        return commitVersion(file, move(merged.content));
+    }
+
+    // Branch operations on one file. Creating a branch copies nothing; switching makes the
+    // branch's tip the current version.
+    OpStatus createBranch(const string& path, const string& name, int fromVersion = 0)
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, true);
+        if (file->fileVersion->branchTip(name) != 0)
+            return STATUS_EXISTS;
+        return file->fileVersion->createBranch(name, fromVersion) ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+
+    OpStatus switchBranch(const string& path, const string& name)
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, true);
+        SubtreeStats before = contribution(file);
+        if (!file->fileVersion->switchBranch(name))
+            return STATUS_NOT_FOUND;
+        fileChanged(file, before);
+        return STATUS_OK;
+    }
+
+    // The current branch can't be deleted
+    OpStatus deleteBranch(const string& path, const string& name)
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, true);
+        if (name == file->fileVersion->getCurrentBranch())
+            return STATUS_INVALID;
+        return file->fileVersion->deleteBranch(name) ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+
+    // Brings 'branch' into the current branch. If the current branch is behind, its tip just
+    // moves up; if it already holds everything, nothing happens; otherwise the two tips are
+    // merged against their merge base into a new version with both as parents. 'outcome' is
+    // "up_to_date", "fast_forward" or "merged".
+    OpStatus mergeBranch(const string& path, const string& branch, size_t& conflicts, string& outcome)
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, true);
+        FileVersioning* history = file->fileVersion;
+        int theirs = history->branchTip(branch);
+        if (theirs == 0)
+            return STATUS_NOT_FOUND;
+        if (branch == history->getCurrentBranch())
+            return STATUS_INVALID;
+        int ours = history->getCurrentVersionNumber();
+        int base = history->mergeBase(branch);
+        conflicts = 0;
+        if (base == theirs)
+        {
+            outcome = "up_to_date";
+            return STATUS_OK;
+        }
+        if (base == ours)
+        {
+            SubtreeStats before = contribution(file);
+            history->fastForward(theirs);
+            fileChanged(file, before);
+            outcome = "fast_forward";
+            return STATUS_OK;
+        }
+        ContentRef baseContent = base != 0 ? history->contentOf(base) : makeContent(string());
+        ContentDiff::MergeResult merged = ContentDiff::merge(baseContent, history->contentOf(ours), history->contentOf(theirs));
+        conflicts = merged.conflicts;
+        if (merged.content == nullptr)
+            return STATUS_INVALID;
+        outcome = "merged";
+        return commitVersion(file, move(merged.content), branch);
+    }
+
+    // Nearest version two versions of a file both descend from
+    OpStatus commonAncestor(const string& path, int a, int b, int& ancestor) const
+    {
+        TreeLatch tree(*this, false);
+        treenode* file = resolvePath(path);
+        if (file == nullptr || file->fileVersion == nullptr)
+            return STATUS_NOT_FOUND;
+        DirLatch dir(*this, file->parent, false);
+        ancestor = file->fileVersion->commonAncestor(a, b);
+        return ancestor != 0 ? STATUS_OK : STATUS_NOT_FOUND;
+    }
+
+    // Stores 'content' as the file's next version if the owner's quota admits it, as a merge
+    // of 'mergedBranch' when one is given. The caller holds the file's directory latch
+    // exclusively.
+    OpStatus commitVersion(treenode* file, ContentRef content, const string& mergedBranch = string())
+    {
+        lock_guard<recursive_mutex> account(accountLatch);
+        if (!admitWrite(file->parent, file->owner, 0, 1, content->size()))
+        {
+            ENGINE_LOG << "File '" << file->name << "' was not updated." << endl;
+            return STATUS_QUOTA;
+        }
+        SubtreeStats before = contribution(file);
+        if (mergedBranch.empty())
+            file->fileVersion->addVersion(move(content), false);
+        else
+            file->fileVersion->addMergeVersion(move(content), mergedBranch);
+        fileChanged(file, before);
+        return STATUS_OK;
+    }
+
+    void viewFileHistory(const string& filename)
+    {
+        TreeLatch tree(*this, false);
+        DirLatch dir(*this, currentfolder, false);
+        treenode* child = findChild(currentfolder, filename, false);
+        if (child != nullptr && child->fileVersion != nullptr)
+        {
+            child->fileVersion->viewHistory();
+            return;
+        }
+        ENGINE_LOG << "File '" << filename << "' not found in current directory." << endl;
+    }
+
+    OpStatus rollbackFile(const string& filename, int versionNumber)
+    {
+        TreeLatch tree(*this, false);
+        treenode* child = findChild(currentfolder, filename, false);
+        if (child != nullptr && child->fileVersion != nullptr)
+            return rollbackNode(child, versionNumber);
+        ENGINE_LOG << "File '" << filename << "' not found in current directory." << endl;
+        return STATUS_NOT_FOUND;
+    }
+
+    OpStatus rollbackNode(treenode* file, int versionNumber)
+    {
+        OpTimer timer(OP_FOLDER_ROLLBACK_FILE);
+        TreeLatch tree(*this, false);
+        DirLatch dir(*this, file->parent, true);
+        SubtreeStats before = contribution(file);
+        if (!file->fileVersion->rollbackToVersion(versionNumber))
+            return STATUS_NOT_FOUND;
+        fileChanged(file, before);
+        return STATUS_OK;
+    }
+
+    treenode* accessFile(const string& filename, RecentFiles& recent)
+    {
+        OpTimer timer(OP_FOLDER_ACCESS_FILE);
+        TreeLatch tree(*this, true); // the recent-files cache is shared by every session
+        treenode* child = findChild(currentfolder, filename, false);
+        if (child != nullptr && child->fileVersion != nullptr)
+        {
+            recent.accessFile(child);
+            return child;
+        }
+        ENGINE_LOG << "File '" << filename << "' not found in current directory." << endl;
+        return nullptr;
+    }
+
+    // "Root/a/b" for the folder (or file) at node
+    string pathOf(const treenode* node) const
+    {
+        string path = "";
+        const treenode* temp = node;
+        while (temp != nullptr)
+        {
+            if (path.empty())
+            {
+                path = temp->name;
+            }
+            else
+            {
+                path = temp->name + "/" + path;
+            }
+            temp = temp->parent;
+        }
+        return path;
+    }
+
+    string getCurrentPath() const
+    {
+        return pathOf(currentfolder);
+    }
+
+    // Bytes and objects held by a subtree: nodes, folder indexes and version chains
+    void subtreeMemory(const treenode* node, long long& bytes, long long& objects) const
+    {
+        TreeLatch tree(*this, true);
+        bytes += node->footprint();
+        objects++;
+        if (node->index != nullptr)
+        {
+            bytes += node->index->footprint() + node->children->footprint();
+            objects += node->index->size() * 2;
+        }
+        if (node->fileVersion != nullptr)
+        {
+            bytes += node->fileVersion->footprint();
+            objects += node->fileVersion->getVersionCount();
+        }
+        for (const treenode* child = node->firstchild; child != nullptr; child = child->nextsibling)
+            subtreeMemory(child, bytes, objects);
+    }
+
+    // Paths of every file called 'filename' under 'node', without printing
+    void collectFiles(const string& filename, const treenode* node, vector<string>& paths) const
+    {
+        OpTimer timer(OP_FOLDER_SEARCH, node == root);
+        TreeLatch tree(*this, false);
+        // One folder's latch at a time: gather subfolders first, descend after releasing it
+        vector<const treenode*> folders;
+        {
+            DirLatch dir(*this, node, false);
+            for (const treenode* child = node->firstchild; child != nullptr; child = child->nextsibling)
+            {
+                if (child->isFolder)
+                    folders.push_back(child);
+                else if (child->name == filename)
+                    paths.push_back(pathOf(child));
+            }
+        }
+        for (size_t i = 0; i < folders.size(); i++)
+            collectFiles(filename, folders[i], paths);
+    }
+
+    void searchFile(const string& filename, treenode* node = nullptr) const
+    {
+        OpTimer timer(OP_FOLDER_SEARCH, node == nullptr);
+        TreeLatch tree(*this, true);
+        if (node == nullptr)
+        {
+            node = root;
+            ENGINE_LOG << "Searching for file '" << filename << "'..." << endl;
+        }
+        treenode* child = node->firstchild;
+        while (child != nullptr)
+        {
+            if (!child->isFolder && child->name == filename)
+            {
+                ENGINE_LOG << "Found: " << pathOf(child) << endl;
+            }
+            if (child->isFolder)
+            {
+                searchFile(filename, child);
+            }
+            child = child->nextsibling;
+        }
+    }
+};
+
+// Incremental reclamation pass over the whole drive. Each step() runs for at most a
+// small time slice, so it can be interleaved with foreground commands.
+class GarbageCollector
+{
+public:
+    struct Report
+    {
+        size_t versionsPruned = 0;
+        size_t versionBytes = 0;
+        size_t recycleBytes = 0;
+        size_t compactedBytes = 0;
+        size_t filesVisited = 0;
+
+        size_t total() const
+        {
+            return versionBytes + recycleBytes + compactedBytes;
+        }
+    };
+
+private:
+    Folder& drive;
+    RecycleBin& recycle;
+    int keepVersions; // 0 = keep every version
+    vector<treenode*> pending;
+    unsigned long walkVersion;
+    // Read without the structure latch to skip idle steps cheaply; everything else is only
+    // touched under the exclusive latch
+    atomic<bool> cycleActive;
+    atomic<time_t> lastFinished; // background cycles start at most once per CYCLE_INTERVAL_SECONDS
+    Report current;
+    Report last;
+
+    void beginCycle()
+    {
+        pending.clear();
+        pending.push_back(drive.root);
+        walkVersion = drive.structureVersion;
+        cycleActive = true;
+        current = Report();
+        current.recycleBytes = recycle.purgeExpired();
+    }
+
+    void collectFile(treenode* node)
+    {
+        FileVersioning* fv = node->fileVersion;
+        if (fv == nullptr)
+            return;
+        current.filesVisited++;
+        bool pruned = false;
+        if (keepVersions > 0 && fv->getVersionCount() > keepVersions)
+        {
+            SubtreeStats before = drive.contribution(node);
+            int versionsBefore = fv->getVersionCount();
+            size_t freed = fv->pruneVersions(keepVersions);
+            if (fv->getVersionCount() != versionsBefore)
+            {
+                current.versionsPruned += versionsBefore - fv->getVersionCount();
+                current.versionBytes += freed;
+                drive.fileChanged(node, before, false);
+                pruned = true;
+            }
+        }
+        // Only rebuild chains that were pruned or carry noticeable slack
+        size_t slack = fv->getSlackBytes();
+        if (pruned || (slack > 64 && slack * 4 > fv->getTotalBytes()))
+            current.compactedBytes += fv->compact();
+    }
+
+public:
+    static const int DEFAULT_SLICE_MICROS = 2000;
+    static const int CYCLE_INTERVAL_SECONDS = 30;
+
+    GarbageCollector(Folder& d, RecycleBin& r) : drive(d), recycle(r)
+    {
+        keepVersions = 0;
+        walkVersion = 0;
+        cycleActive = false;
+        lastFinished = 0;
+    }
+
+    void setVersionRetention(int keep)
+    {
+        keepVersions = keep > 0 ? keep : 0;
+    }
+
+    int getVersionRetention() const
+    {
+        return keepVersions;
+    }
+
+    // Runs until the slice is used up; returns true when a full cycle has finished
+    bool step(int sliceMicros = DEFAULT_SLICE_MICROS)
+    {
+        if (!cycleActive && time(0) - lastFinished < CYCLE_INTERVAL_SECONDS)
+            return true;
+        Folder::TreeLatch tree(drive, true);
+        chrono::steady_clock::time_point deadline =
+            chrono::steady_clock::now() + chrono::microseconds(sliceMicros);
+        if (!cycleActive)
+        {
+            // Back-to-back cycles would spend a full slice on every command for nothing
+            if (time(0) - lastFinished < CYCLE_INTERVAL_SECONDS)
+                return true;
+            beginCycle();
+        }
+
+        // The tree changed under us: pending nodes may be gone, so walk again from the root.
+        // Pruning is idempotent, so re-visiting costs time but never correctness.
+        if (walkVersion != drive.structureVersion)
+        {
+            pending.clear();
+            pending.push_back(drive.root);
+            walkVersion = drive.structureVersion;
+        }
+
+        int sinceCheck = 0;
+        while (!pending.empty())
+        {
+            treenode* node = pending.back();
+            pending.pop_back();
+            if (node->isFolder)
+            {
+                for (treenode* child = node->firstchild; child != nullptr; child = child->nextsibling)
+                    pending.push_back(child);
+            }
+            else
+            {
+                collectFile(node);
+            }
+            if (++sinceCheck == 32)
+            {
+                sinceCheck = 0;
+                if (chrono::steady_clock::now() >= deadline)
+                    return false;
+            }
+        }
+
+        cycleActive = false;
+        lastFinished = time(0);
+        last = current;
+        // Retired index entries and version nodes otherwise wait for the next full batch
+        epochs.collect();
+        return true;
+    }
+
+    // Runs a whole cycle as a series of slices and returns what it reclaimed
+    const Report& runFull()
+    {
+        Folder::TreeLatch tree(drive, true);
+        beginCycle(); // start fresh so the report covers one complete pass
+        while (!step())
+        {
+        }
+        return last;
+    }
+
+    const Report& lastReport() const
+    {
+        return last;
+    }
+};
+
+// Seeds a drive from a directory on disk and writes a drive folder back out. File contents
+// are read and written by a pool of threads, each file in one sequential read or write. The
+// drive itself is only touched from the calling thread, through the batch API.
+//
+// With history enabled, a directory "<name>.history" next to a file holds its older versions
+// as files named by version number; export writes the same layout back.
+class DiskTransfer
+{
+public:
+    struct Report
+    {
+        size_t files = 0;
+        size_t folders = 0;
+        size_t versions = 0;
+        size_t bytes = 0;
+        double seconds = 0;
+        vector<string> errors;
+    };
+
+private:
+    Folder& drive;
+    int threads;
+    size_t chunkBytes; // import reads and applies at most this much content at a time
+
+    // A file's versions as they were when the export walked past it
+    struct ExportFile
+    {
+        filesystem::path target;
+        vector<pair<int, ContentRef>> chain;
+        int current = 0;
+    };
+
+    struct DiskFile
+    {
+        string drivePath;
+        vector<filesystem::path> sources; // oldest version first, current content last
+        size_t size = 0;
+        vector<string> contents;
+        string error;
+    };
+
+    static bool readWhole(const filesystem::path& path, string& out)
+    {
+        ifstream in(path, ios::binary);
+        if (!in)
+            return false;
+        in.seekg(0, ios::end);
+        streamoff size = in.tellg();
+        in.seekg(0, ios::beg);
+        out.resize(size > 0 ? (size_t)size : 0);
+        if (size > 0)
+            in.read(&out[0], size);
+        return (bool)in;
+    }
+
+    static bool writeWhole(const filesystem::path& path, const ContentBlob& data)
+    {
+        ofstream out(path, ios::binary | ios::trunc);
+        if (!out)
+            return false;
+        data.forEachExtent([&](string_view piece) { out.write(piece.data(), piece.size()); });
+        return (bool)out;
+    }
+
+    // Runs work(i) for i in [0, count) on the worker pool
+    template <typename Work>
+    void parallelFor(size_t count, Work work) const
+    {
+        atomic<size_t> next(0);
+        int n = (int)min<size_t>(threads, count);
+        vector<thread> pool;
+        for (int t = 1; t < n; t++)
+        {
+            pool.emplace_back([&]()
+                {
+                    for (size_t i = next++; i < count; i = next++)
+                        work(i);
+                });
+        }
+        for (size_t i = next++; i < count; i = next++)
+            work(i);
+        for (size_t t = 0; t < pool.size(); t++)
+            pool[t].join();
+    }
+
+    static vector<filesystem::path> historyOf(const filesystem::path& file)
+    {
+        vector<pair<long long, filesystem::path>> numbered;
+        filesystem::path dir = file;
+        dir += ".history";
+        error_code ec;
+        if (!filesystem::is_directory(dir, ec))
+            return vector<filesystem::path>();
+        for (filesystem::directory_iterator it(dir, ec), end; !ec && it != end; it.increment(ec))
+        {
+            const string stem = it->path().filename().string();
+            char* rest = nullptr;
+            long long number = strtoll(stem.c_str(), &rest, 10);
+            if (it->is_regular_file(ec) && !stem.empty() && *rest == '\0')
+                numbered.push_back(make_pair(number, it->path()));
+        }
+        sort(numbered.begin(), numbered.end());
+        vector<filesystem::path> paths;
+        for (size_t i = 0; i < numbered.size(); i++)
+            paths.push_back(numbered[i].second);
+        return paths;
+    }
+
+    void applyChunk(vector<DiskFile>& chunk, ConflictPolicy policy, RecycleBin& recycle, Report& report)
+    {
+        parallelFor(chunk.size(), [&](size_t i)
+            {
+                DiskFile& f = chunk[i];
+                f.contents.resize(f.sources.size());
+                for (size_t v = 0; v < f.sources.size(); v++)
+                {
+                    if (!readWhole(f.sources[v], f.contents[v]))
+                    {
+                        f.error = "cannot read " + f.sources[v].string();
+                        return;
+                    }
+                }
+            });
+
+        vector<BatchOp> ops;
+        for (size_t i = 0; i < chunk.size(); i++)
+        {
+            DiskFile& f = chunk[i];
+            if (!f.error.empty())
+            {
+                report.errors.push_back(f.error);
+                continue;
+            }
+            for (size_t v = 0; v < f.contents.size(); v++)
+            {
+                report.bytes += f.contents[v].size();
+                ops.push_back(BatchOp(v == 0 ? BATCH_CREATE : BATCH_UPDATE, f.drivePath, makeContent(move(f.contents[v]))));
+            }
+        }
+        BatchResult result = drive.applyBatch(ops, policy, recycle);
+        report.folders += result.foldersCreated;
+        report.versions += result.applied;
+        for (size_t i = 0; i < result.errors.size(); i++)
+            report.errors.push_back(result.errors[i].path + ": " + result.errors[i].reason);
+        chunk.clear();
+    }
+
+    // Drive names are free text; one that isn't a single plain path component would land
+    // somewhere other than under the export directory
+    static bool safeDiskName(const string& name)
+    {
+        return !name.empty() && name != "." && name != ".." && name.find_first_of("/\\") == string::npos;
+    }
+
+    // Caller holds the shared structure latch. Each folder's latch is held only while its
+    // children are copied out, as collectFiles does.
+    void collectExport(const treenode* node, const filesystem::path& dir, bool withHistory,
+        vector<ExportFile>& files, Report& report) const
+    {
+        error_code ec;
+        filesystem::create_directories(dir, ec);
+        if (ec)
+        {
+            report.errors.push_back("cannot create " + dir.string() + ": " + ec.message());
+            return;
+        }
+        report.folders++;
+        vector<const treenode*> folders;
+        {
+            Folder::DirLatch latch(drive, node, false);
+            for (const treenode* child = node->firstchild; child != nullptr; child = child->nextsibling)
+            {
+                if (!safeDiskName(child->name))
+                {
+                    report.errors.push_back("skipped '" + drive.pathOf(child) + "': the name can't be used on disk");
+                    continue;
+                }
+                if (child->isFolder)
+                    folders.push_back(child);
+                else if (child->fileVersion != nullptr)
+                {
+                    ExportFile f;
+                    f.target = dir / child->name;
+                    f.chain = child->fileVersion->versions();
+                    f.current = child->fileVersion->getCurrentVersionNumber();
+                    if (withHistory && f.chain.size() > 1)
+                    {
+                        filesystem::path history = dir / (child->name + ".history");
+                        filesystem::create_directories(history, ec);
+                    }
+                    files.push_back(move(f));
+                }
+            }
+        }
+        for (size_t i = 0; i < folders.size(); i++)
+            collectExport(folders[i], dir / folders[i]->name, withHistory, files, report);
+    }
+
+public:
+    DiskTransfer(Folder& d, int workerThreads = 0) : drive(d), chunkBytes(64u << 20)
+    {
+        threads = workerThreads > 0 ? workerThreads : (int)thread::hardware_concurrency();
+        if (threads < 1)
+            threads = 1;
+    }
+
+    // Copies the directory 'diskDir' into the drive folder 'drivePath' (created if missing)
+    Report importTree(const string& diskDir, const string& drivePath, bool withHistory,
+        ConflictPolicy policy, RecycleBin& recycle)
+    {
+        Report report;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        filesystem::path base(diskDir);
+        error_code ec;
+        if (!filesystem::is_directory(base, ec))
+        {
+            report.errors.push_back("'" + diskDir + "' is not a directory");
+            return report;
+        }
+        string prefix = drivePath.empty() ? string() : drivePath + "/";
+
+        vector<BatchOp> folders;
+        vector<DiskFile> chunk;
+        size_t pendingBytes = 0;
+        filesystem::recursive_directory_iterator it(base, filesystem::directory_options::skip_permission_denied, ec), end;
+        for (; !ec && it != end; it.increment(ec))
+        {
+            const filesystem::directory_entry& entry = *it;
+            string rel = filesystem::relative(entry.path(), base, ec).generic_string();
+            if (withHistory && entry.path().extension() == ".history" && entry.is_directory(ec))
+            {
+                it.disable_recursion_pending();
+                continue;
+            }
+            if (entry.is_directory(ec))
+            {
+                folders.push_back(BatchOp(BATCH_MKDIR, prefix + rel));
+                continue;
+            }
+            if (!entry.is_regular_file(ec))
+                continue;
+            DiskFile f;
+            f.drivePath = prefix + rel;
+            if (withHistory)
+                f.sources = historyOf(entry.path());
+            f.sources.push_back(entry.path());
+            f.size = entry.file_size(ec) * f.sources.size();
+            pendingBytes += f.size;
+            chunk.push_back(f);
+            report.files++;
+            if (pendingBytes >= chunkBytes)
+            {
+                applyChunk(chunk, policy, recycle, report);
+                pendingBytes = 0;
+            }
+        }
+        if (ec)
+            report.errors.push_back("walking '" + diskDir + "' stopped: " + ec.message());
+        applyChunk(chunk, policy, recycle, report);
+        // Empty directories only exist as mkdir ops; the rest were made by the file creates
+        BatchResult result = drive.applyBatch(folders, CONFLICT_SKIP, recycle);
+        report.folders += result.foldersCreated;
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+
+    // Writes the drive folder 'drivePath' (current folder when empty) to 'diskDir'
+    Report exportTree(const string& drivePath, const string& diskDir, bool withHistory)
+    {
+        Report report;
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<ExportFile> files;
+        {
+            // The walk runs under the shared structure latch like any other whole-tree read.
+            // It copies out each file's version list, so the writes below touch no drive state
+            // and other sessions aren't held up by the disk.
+            Folder::TreeLatch tree(drive, false);
+            treenode* node = drivePath.empty() ? drive.currentfolder.get() : drive.resolvePath(drivePath);
+            if (node == nullptr || !node->isFolder)
+            {
+                report.errors.push_back("drive folder '" + drivePath + "' not found");
+                return report;
+            }
+            collectExport(node, filesystem::path(diskDir), withHistory, files, report);
+        }
+
+        vector<string> errors(files.size());
+        vector<size_t> bytes(files.size(), 0), versions(files.size(), 0);
+        parallelFor(files.size(), [&](size_t i)
+            {
+                // The file gets the current version, which is not the newest after a rollback;
+                // every other version goes to the history directory
+                const vector<pair<int, ContentRef>>& chain = files[i].chain;
+                for (size_t v = 0; v < chain.size(); v++)
+                {
+                    bool isCurrent = chain[v].first == files[i].current;
+                    if (!isCurrent && !withHistory)
+                        continue;
+                    filesystem::path target = files[i].target;
+                    if (!isCurrent)
+                    {
+                        target += ".history";
+                        target /= to_string(chain[v].first);
+                    }
+                    if (!writeWhole(target, *chain[v].second))
+                    {
+                        errors[i] = "cannot write " + target.string();
+                        return;
+                    }
+                    bytes[i] += chain[v].second->size();
+                    versions[i]++;
+                }
+            });
+        for (size_t i = 0; i < files.size(); i++)
+        {
+            if (!errors[i].empty())
+                report.errors.push_back(errors[i]);
+            report.bytes += bytes[i];
+            report.versions += versions[i];
+        }
+        report.files = files.size();
+        report.seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        return report;
+    }
+};
+
+class FileCompression
+{
+public:
+    // Run-Length Encoding (RLE)
+    static string encodeRLE(string_view input)
+    {
+        OpTimer timer(OP_RLE_ENCODE);
+        string encoded;
+        if (input.empty()) return encoded;
+
+        char currentChar = input[0];
+        int count = 1;
+
+        for (int i = 1; i < input.length(); i++)
+        {
+            if (input[i] == currentChar)
+            {
+                count++;
+            }
+            else
+            {
+                encoded += to_string(count) + currentChar;
+                currentChar = input[i];
+                count = 1;
+            }
+        }
+
+        encoded += to_string(count) + currentChar;
+        return encoded;
+    }
+
+    static string decodeRLE(string_view input)
+    {
+        OpTimer timer(OP_RLE_DECODE);
+        string decoded;
+        string countStr;
+
+        for (int i = 0; i < input.length(); i++)
+        {
+            if (isdigit(input[i]))
+            {
+                countStr += input[i];
+            }
+            else
+            {
+                int count = stoi(countStr);
+                for (int j = 0; j < count; j++)
+                {
+                    decoded += input[i];
+                }
+                countStr = "";
+            }
+        }
+
+        return decoded;
+    }
+
+    // Dictionary-based compression replacement 
+    static string encodeDictionary(string_view input)
+    {
+        ENGINE_LOG << "Dictionary-based compression unavailable. Using RLE instead." << endl;
+        return encodeRLE(input);
+    }
+
+    static string compressFile(string_view content, bool useRLE = true)
+    {
+        return encodeRLE(content);
+    }
+};
+
+class CloudSync
+{
+private:
+    struct SyncTask
+    {
+        string operation; // "upload", "download", "delete"
+        string filename;
+        ContentRef content; // shared with the version it was taken from
+        string timestamp;
+
+        SyncTask(const string& op, const string& file, ContentRef cont)
+            : operation(op), filename(file), content(move(cont))
+        {
+            // Set timestamp
+            time_t now = time(0);
+            tm ltm;
+            localTime(now, ltm);
+            stringstream ss;
+            ss << 1900 + ltm.tm_year << "-"
+                << setw(2) << setfill('0') << 1 + ltm.tm_mon << "-"
+                << setw(2) << setfill('0') << ltm.tm_mday << " "
+                << setw(2) << setfill('0') << ltm.tm_hour << ":"
+                << setw(2) << setfill('0') << ltm.tm_min << ":"
+                << setw(2) << setfill('0') << ltm.tm_sec;
+            timestamp = ss.str();
+            memStats.add(MEM_SYNC, footprint());
+        }
+        ~SyncTask()
+        {
+            memStats.remove(MEM_SYNC, footprint());
+        }
+
+        size_t footprint() const
+        {
+            return sizeof(SyncTask) + operation.capacity() + filename.capacity() + timestamp.capacity();
+        }
+    };
+
+    const int MAX_QUEUE_SIZE = 100;
+    SyncTask* queue[100];
+    int front, rear, count;
+    bool isRunning;
+
+public:
+    CloudSync() : front(0), rear(-1), count(0), isRunning(false)
+    {
+        for (int i = 0; i < MAX_QUEUE_SIZE; i++)
+        {
+            queue[i] = nullptr;
+        }
+    }
+
+    ~CloudSync()
+    {
+        for (int i = 0; i < MAX_QUEUE_SIZE; i++)
+        {
+            if (queue[i] != nullptr)
+            {
+                delete queue[i];
+            }
+        }
+    }
+
+    void addSyncTask(const string& operation, const string& filename, ContentRef content = makeContent(string()))
+    {
+        OpTimer timer(OP_SYNC_ENQUEUE);
+        if (count == MAX_QUEUE_SIZE)
+        {
+            ENGINE_LOG << "Sync queue is full. Waiting for tasks to complete." << endl;
+            return;
+        }
+
+        rear = (rear + 1) % MAX_QUEUE_SIZE;
+        queue[rear] = new SyncTask(operation, filename, move(content));
+        count++;
+
+        ENGINE_LOG << "Added " << operation << " task for file '" << filename << "' to sync queue." << endl;
+
+        // Start background sync if not already running
+        if (!isRunning)
+        {
+            startSync();
+        }
+    }
+
+    void startSync()
+    {
+        isRunning = true;
+        ENGINE_LOG << "Background sync started.\n";
+        processSyncQueue();
+    }
+
+    void processSyncQueue()
+    {
+        OpTimer timer(OP_SYNC_DRAIN);
+        while (count > 0)
+        {
+            SyncTask* task = queue[front];
+            queue[front] = nullptr; // the destructor frees whatever is still queued
+            front = (front + 1) % MAX_QUEUE_SIZE;
+            count--;
+
+            // Simulate cloud operations
+            ENGINE_LOG << "Syncing: " << task->operation << " file '" << task->filename
+                << "' at " << task->timestamp << endl;
+
+            // Simulate some processing time
+            ENGINE_LOG << "Sync completed for file '" << task->filename << "'.\n";
+
+            delete task;
+        }
+
+        isRunning = false;
+        ENGINE_LOG << "All sync tasks completed.\n";
+    }
+};
+
+// Lookups take no lock; insert and remove serialize on a writer mutex and retire what they
+// unlink, so an entry found inside an EpochGuard stays valid until the guard ends
+class FileHashTable
+{
+private:
+    static const int TABLE_SIZE = 100;
+    struct FileMetadata
+    {
+        string name;
+        string path;
+        string owner;
+        string type;
+        long size;
+        string creationDate;
+        atomic<FileMetadata*> next; // For collision handling
+
+        FileMetadata(string n, string p, string o, string t, long s, string d)
+            : name(n), path(p), owner(o), type(t), size(s), creationDate(d), next(nullptr) {
+            memStats.add(MEM_HASH, footprint());
+        }
+        ~FileMetadata()
+        {
+            memStats.remove(MEM_HASH, footprint());
+        }
+
+        size_t footprint() const
+        {
+            return sizeof(FileMetadata) + name.capacity() + path.capacity() + owner.capacity() +
+                type.capacity() + creationDate.capacity();
+        }
+
+    };
+
+    atomic<FileMetadata*> table[TABLE_SIZE];
+    mutex writerLock;
+
+    // Hash function
+    int hashFunction(const string& filename) const
+    {
+        int hash = 0;
+        for (int i = 0; i < filename.length(); i++)
+        {
+            char c = filename[i];
+            hash = (hash * 31 + c) % TABLE_SIZE;
+        }
+        return hash;
+    }
+
+public:
+    FileHashTable()
+    {
+        for (int i = 0; i < TABLE_SIZE; i++)
+        {
+            table[i].store(nullptr, memory_order_relaxed);
+        }
+    }
+
+    ~FileHashTable()
+    {
+        for (int i = 0; i < TABLE_SIZE; i++)
+        {
+            FileMetadata* current = table[i].load(memory_order_relaxed);
+            while (current != nullptr)
+            {
+                FileMetadata* temp = current;
+                current = current->next.load(memory_order_relaxed);
+                delete temp;
+            }
+        }
+    }
+
+    void insert(const string& filename, const string& path, const string& owner,
+        const string& type, long size, const string& date)
+    {
+        OpTimer timer(OP_HASH_INSERT);
+        int index = hashFunction(filename);
+        FileMetadata* newFile = new FileMetadata(filename, path, owner, type, size, date);
+
+        lock_guard<mutex> guard(writerLock);
+        if (table[index].load(memory_order_relaxed) == nullptr)
+        {
+            table[index].store(newFile, memory_order_release);
+        }
+        else
+        {
+            // Handle collision using chaining
+            FileMetadata* current = table[index].load(memory_order_relaxed);
+            while (current->next.load(memory_order_relaxed) != nullptr)
+            {
+                current = current->next.load(memory_order_relaxed);
+            }
+            current->next.store(newFile, memory_order_release);
+        }
+        ENGINE_LOG << "File indexed in hash table.\n";
+    }
+
+    // The caller keeps an EpochGuard for as long as it uses the entry
+    FileMetadata* lookup(const string& filename) const
+    {
+        OpTimer timer(OP_HASH_LOOKUP);
+        EpochGuard guard;
+        int index = hashFunction(filename);
+        FileMetadata* current = table[index].load(memory_order_acquire);
+
+        while (current != nullptr)
+        {
+            if (current->name == filename)
+            {
+                return current;
+            }
+            current = current->next.load(memory_order_acquire);
+        }
+        return nullptr;
+    }
+
+    void removeFile(const string& filename)
+    {
+        OpTimer timer(OP_HASH_REMOVE);
+        int index = hashFunction(filename);
+        lock_guard<mutex> guard(writerLock);
+        FileMetadata* current = table[index].load(memory_order_relaxed);
+        FileMetadata* prev = nullptr;
+
+        while (current != nullptr)
+        {
+            if (current->name == filename)
+            {
+                if (prev == nullptr)
+                {
+                    table[index].store(current->next.load(memory_order_relaxed), memory_order_release);
+                }
+                else
+                {
+                    prev->next.store(current->next.load(memory_order_relaxed), memory_order_release);
+                }
+                epochs.retire(current);
+                ENGINE_LOG << "File removed from index.\n";
+                return;
+            }
+            prev = current;
+            current = current->next.load(memory_order_relaxed);
+        }
+    }
+
+    void displayFileInfo(const string& filename) const
+    {
+        EpochGuard guard;
+        FileMetadata* file = lookup(filename);
+        if (file != nullptr)
+        {
+            ENGINE_LOG << "\nFile Information:\n";
+            ENGINE_LOG << "Name: " << file->name << endl;
+            ENGINE_LOG << "Path: " << file->path << endl;
+            ENGINE_LOG << "Owner: " << file->owner << endl;
+            ENGINE_LOG << "Type: " << file->type << endl;
+            ENGINE_LOG << "Size: " << file->size << " bytes" << endl;
+            ENGINE_LOG << "Created: " << file->creationDate << endl;
+        }
+        else
+        {
+            ENGINE_LOG << "File not found in index.\n";
+        }
+    }
+};
+
+string jsonEscape(string_view text)
+{
+    string out;
+    out.reserve(text.size() + 2);
+    for (size_t i = 0; i < text.size(); i++)
+    {
+        unsigned char c = text[i];
+        if (c == '"' || c == '\\')
+        {
+            out += '\\';
+            out += c;
+        }
+        else if (c == '\n')
+            out += "\\n";
+        else if (c == '\t')
+            out += "\\t";
+        else if (c < 0x20)
+        {
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", c);
+            out += buf;
+        }
+        else
+            out += c;
+    }
+    return out;
+}
+
+// Non-interactive front end: one command per line from a script or a pipe, one JSON object
+// per command on the output. Engine messages are off so the output stays machine-readable.
+//
+//   useradd <user> <password> <admin|editor|viewer>   login <user> <password>   logout
+//   mkdir <path>   put <path> <content>   update <path> <content>   rm <path>   mv <src> <dst>
+//   rollback <path> <version>   cat <path>   history <path>   ls [path]   cd <path>
+//   search <name>   du [path]   restore <name>   sync <path>   share <user>   gc   metrics
+//   read <path> <offset> <len>   write <path> <offset> <bytes>   append <path> <bytes>
+//   diff <path> <from> <to>   merge <path> <base> <ours> <theirs>
+//   branch <path> <name> [version]   checkout <path> <name>   rmbranch <path> <name>
+//   mergebranch <path> <name>   branches <path>   ancestor <path> <version> <version>
+//
+// Blank lines and lines starting with '#' are skipped.
+class ScriptRunner
+{
+    Folder& drive;
+    RecycleBin& recycle;
+    UserSystem& users;
+    AccessControl& access;
+    GarbageCollector& gc;
+    CloudSync cloud;
+    string session;
+    int user;
+    DriveSession self; // this runner's working folder and acting user on the drive
+
+    struct Reply
+    {
+        bool ok = true;
+        string status = "ok";
+        string error;
+        string fields; // extra ",\"key\":value" pairs
+    };
+
+    static Reply fail(const string& status, const string& error)
+    {
+        Reply r;
+        r.ok = false;
+        r.status = status;
+        r.error = error;
+        return r;
+    }
+
+    Reply runBatchOp(const BatchOp& op, ConflictPolicy policy)
+    {
+        vector<BatchOp> ops(1, op);
+        BatchResult result = drive.applyBatch(ops, policy, recycle);
+        if (!result.errors.empty())
+            return fail("failed", result.errors[0].reason);
+        Reply r;
+        if (result.skipped > 0)
+            r.status = "skipped";
+        if (op.type == BATCH_MOVE)
+            access.invalidate();
+        return r;
+    }
+
+    bool allowed(treenode* node, Permission op)
+    {
+        return access.canAccess(user, node, op);
+    }
+
+    // The node itself when it exists, otherwise the deepest existing folder on its path,
+    // whose permissions anything created below it would inherit
+    treenode* governing(const string& path)
+    {
+        treenode* node = drive.resolvePath(path);
+        return node != nullptr ? node : drive.deepestExistingParent(path);
+    }
+
+    static string statsJson(const SubtreeStats& st)
+    {
+        stringstream ss;
+        ss << "\"files\":" << st.files << ",\"folders\":" << st.folders << ",\"versions\":" << st.versions
+            << ",\"bytes\":" << st.latestBytes << ",\"history_bytes\":" << st.historyBytes
+            << ",\"modified\":\"" << formatTimestamp(st.newestMtime) << "\"";
+        return ss.str();
+    }
+
+    // Commands that free or relink nodes, or change users and sharing, run with the drive
+    // to themselves; everything else runs alongside other sessions
+    static bool exclusiveCommand(const string& cmd)
+    {
+        return cmd == "useradd" || cmd == "login" || cmd == "rm" || cmd == "mv" || cmd == "restore" || cmd == "share" || cmd == "gc";
+    }
+
+    Reply execute(const string& cmd, stringstream& args)
+    {
+        string a, b;
+        if (cmd == "useradd")
+        {
+            string roleName;
+            if (!(args >> a >> b >> roleName))
+                return fail("invalid", "usage: useradd <user> <password> <admin|editor|viewer>");
+            Role role = roleName == "admin" ? ADMIN : roleName == "editor" ? EDITOR : VIEWER;
+            if (users.userCount > 0 && (user < 0 || users.users[user].role != ADMIN))
+                return fail("denied", "only admins can add users");
+            if (users.findUserIndex(a) != -1)
+                return fail("exists", "user already exists");
+            if (users.userCount >= MAX_USERS)
+                return fail("invalid", "user limit reached");
+            users.addUser(a, b, "", role);
+            return Reply();
+        }
+        if (cmd == "login")
+        {
+            if (!(args >> a >> b))
+                return fail("invalid", "usage: login <user> <password>");
+            string token = users.authenticate(a, b);
+            if (token.empty())
+                return fail("denied", "invalid username or password");
+            if (!session.empty())
+                users.endSession(session);
+            session = token;
+            user = users.sessionUser(session);
+            return Reply();
+        }
+        if (user < 0)
+            return fail("denied", "not logged in");
+        if (cmd == "logout")
+        {
+            users.endSession(session);
+            session.clear();
+            user = -1;
+            return Reply();
+        }
+
+        if (cmd == "mkdir" || cmd == "put" || cmd == "update")
+        {
+            if (!(args >> a))
+                return fail("invalid", "missing path");
+            string content;
+            args.get();
+            getline(args, content);
+            if (!allowed(governing(a), PERM_WRITE))
+                return fail("denied", "no write permission");
+            BatchOpType type = cmd == "mkdir" ? BATCH_MKDIR : cmd == "put" ? BATCH_CREATE : BATCH_UPDATE;
+            return runBatchOp(BatchOp(type, a, move(content)), cmd == "put" ? CONFLICT_OVERWRITE : CONFLICT_FAIL);
+        }
+        if (cmd == "rm")
+        {
+            if (!(args >> a))
+                return fail("invalid", "missing path");
+            treenode* node = drive.resolvePath(a);
+            if (node != nullptr && !allowed(node, PERM_DELETE))
+                return fail("denied", "no delete permission");
+            return runBatchOp(BatchOp(BATCH_DELETE, a), CONFLICT_FAIL);
+        }
+        if (cmd == "mv")
+        {
+            if (!(args >> a >> b))
+                return fail("invalid", "usage: mv <src> <dst>");
+            treenode* node = drive.resolvePath(a);
+            if (node != nullptr && (!allowed(node, PERM_WRITE) || !allowed(governing(b), PERM_WRITE)))
+                return fail("denied", "no write permission");
+            return runBatchOp(BatchOp(BATCH_MOVE, a, "", b), CONFLICT_FAIL);
+        }
+        if (cmd == "ls" || cmd == "cd" || cmd == "du")
+        {
+            args >> a;
+            treenode* node = a.empty() ? drive.currentfolder : drive.resolvePath(a);
+            if (node == nullptr || !node->isFolder)
+                return fail("not_found", "no such folder");
+            if (!allowed(node, PERM_READ))
+                return fail("denied", "no read permission");
+            Reply r;
+            if (cmd == "cd")
+            {
+                drive.currentfolder = node;
+                r.fields = ",\"path\":\"" + jsonEscape(drive.pathOf(node)) + "\"";
+            }
+            else if (cmd == "du")
+                r.fields = ",\"path\":\"" + jsonEscape(drive.pathOf(node)) + "\"," + statsJson(drive.statsOf(node));
+            else
+            {
+                Folder::DirLatch dir(drive, node, false);
+                stringstream ss;
+                ss << ",\"path\":\"" << jsonEscape(drive.pathOf(node)) << "\",\"entries\":[";
+                bool first = true;
+                for (AVLTree::Iterator it = node->index->begin(); it.valid(); it.next())
+                {
+                    const treenode* child = *it;
+                    ss << (first ? "" : ",") << "{\"name\":\"" << jsonEscape(child->name) << "\",\"type\":\""
+                        << (child->isFolder ? "folder" : "file") << "\"";
+                    if (child->fileVersion != nullptr)
+                        ss << ",\"version\":" << child->fileVersion->getCurrentVersionNumber()
+                            << ",\"bytes\":" << child->fileVersion->getLatestSize();
+                    ss << "}";
+                    first = false;
+                }
+                ss << "]";
+                r.fields = ss.str();
+            }
+            return r;
+        }
+        if (cmd == "search")
+        {
+            if (!(args >> a))
+                return fail("invalid", "missing name");
+            vector<string> paths;
+            drive.collectFiles(a, drive.root, paths);
+            Reply r;
+            r.fields = ",\"matches\":[";
+            bool first = true;
+            for (size_t i = 0; i < paths.size(); i++)
+            {
+                if (!allowed(drive.resolvePath(paths[i]), PERM_READ))
+                    continue;
+                r.fields += (first ? "\"" : ",\"") + jsonEscape(paths[i]) + "\"";
+                first = false;
+            }
+            r.fields += "]";
+            return r;
+        }
+        if (cmd == "restore")
+        {
+            if (!(args >> a))
+                return fail("invalid", "missing name");
+            if (!allowed(drive.currentfolder, PERM_WRITE))
+                return fail("denied", "no write permission");
+            OpStatus status = drive.restoreFile(a, recycle);
+            return status == STATUS_OK ? Reply() : fail(statusName(status), "restore failed");
+        }
+        if (cmd == "share")
+        {
+            if (!(args >> a))
+                return fail("invalid", "missing user");
+            if (users.findUserIndex(a) == -1)
+                return fail("not_found", "no such user");
+            users.shareFile(users.users[user].username, a);
+            return Reply();
+        }
+        if (cmd == "metrics")
+        {
+            if (users.users[user].role != ADMIN)
+                return fail("denied", "only admins can read operation stats");
+            ostringstream stats;
+            opMetrics.dump(stats, true);
+            Reply r;
+            string body = stats.str();
+            r.fields = ",\"ops\":" + body.substr(0, body.size() - 1);
+            return r;
+        }
+        if (cmd == "gc")
+        {
+            if (users.users[user].role != ADMIN)
+                return fail("denied", "only admins can run the collector");
+            const GarbageCollector::Report& report = gc.runFull();
+            Reply r;
+            r.fields = ",\"freed_bytes\":" + to_string(report.total()) + ",\"versions_pruned\":" + to_string(report.versionsPruned);
+            return r;
+        }
+
+        // The rest address an existing file
+        if (cmd != "rollback" && cmd != "cat" && cmd != "history" && cmd != "sync" &&
+            cmd != "read" && cmd != "write" && cmd != "append" && cmd != "diff" && cmd != "merge" &&
+            cmd != "branch" && cmd != "checkout" && cmd != "rmbranch" && cmd != "mergebranch" &&
+            cmd != "branches" && cmd != "ancestor")
+            return fail("invalid", "unknown command '" + cmd + "'");
+        if (!(args >> a))
+            return fail("invalid", "missing path");
+        treenode* node = drive.resolvePath(a);
+        if (node == nullptr || node->fileVersion == nullptr)
+            return fail("not_found", "no such file");
+        Reply r;
+        if (cmd == "rollback")
+        {
+            int version;
+            if (!(args >> version))
+                return fail("invalid", "usage: rollback <path> <version>");
+            if (!allowed(node, PERM_WRITE))
+                return fail("denied", "no write permission");
+            OpStatus status = drive.rollbackNode(node, version);
+            if (status != STATUS_OK)
+                return fail(statusName(status), "no such version");
+            return r;
+        }
+        if (cmd == "sync")
+        {
+            if (!allowed(node, PERM_SHARE))
+                return fail("denied", "no share permission");
+            cloud.addSyncTask("upload", drive.pathOf(node), node->fileVersion->latest());
+            return r;
+        }
+        if (cmd == "write" || cmd == "append")
+        {
+            size_t offset = 0;
+            if (cmd == "write" && !(args >> offset))
+                return fail("invalid", "usage: write <path> <offset> <bytes>");
+            string bytes;
+            args.get();
+            getline(args, bytes);
+            if (!allowed(node, PERM_WRITE))
+                return fail("denied", "no write permission");
+            OpStatus status = drive.writeRange(a, offset, bytes, cmd == "append");
+            if (status == STATUS_INVALID)
+                return fail(statusName(status), "offset is past the end of the file");
+            if (status != STATUS_OK)
+                return fail(statusName(status), "write failed");
+            r.fields = ",\"version\":" + to_string(node->fileVersion->getCurrentVersionNumber()) +
+                ",\"bytes\":" + to_string(node->fileVersion->getLatestSize());
+            return r;
+        }
+        if (cmd == "merge")
+        {
+            int base, ours, theirs;
+            if (!(args >> base >> ours >> theirs))
+                return fail("invalid", "usage: merge <path> <base> <ours> <theirs>");
+            if (!allowed(node, PERM_WRITE))
+                return fail("denied", "no write permission");
+            size_t conflicts = 0;
+            OpStatus status = drive.mergeVersions(a, base, ours, theirs, conflicts);
+            if (status == STATUS_INVALID)
+                return fail(statusName(status), "binary content conflicts");
+            if (status != STATUS_OK)
+                return fail(statusName(status), "no such version");
+            r.fields = ",\"version\":" + to_string(node->fileVersion->getCurrentVersionNumber()) +
+                ",\"conflicts\":" + to_string(conflicts);
+            return r;
+        }
+        if (cmd == "branch" || cmd == "checkout" || cmd == "rmbranch" || cmd == "mergebranch")
+        {
+            string branch;
+            int fromVersion = 0;
+            if (!(args >> branch))
+                return fail("invalid", "usage: " + cmd + " <path> <branch>" + (cmd == "branch" ? " [version]" : ""));
+            if (cmd == "branch")
+                args >> fromVersion;
+            if (!allowed(node, PERM_WRITE))
+                return fail("denied", "no write permission");
+            OpStatus status;
+            size_t conflicts = 0;
+            string outcome;
+            if (cmd == "branch")
+                status = drive.createBranch(a, branch, fromVersion);
+            else if (cmd == "checkout")
+                status = drive.switchBranch(a, branch);
+            else if (cmd == "rmbranch")
+                status = drive.deleteBranch(a, branch);
+            else
+                status = drive.mergeBranch(a, branch, conflicts, outcome);
+            if (status == STATUS_EXISTS)
+                return fail(statusName(status), "branch already exists");
+            if (status == STATUS_INVALID)
+                return fail(statusName(status), cmd == "mergebranch" ? "cannot merge that branch here" : "cannot delete the current branch");
+            if (status != STATUS_OK)
+                return fail(statusName(status), "no such branch or version");
+            Folder::DirLatch dir(drive, node->parent, false);
+            r.fields = ",\"branch\":\"" + jsonEscape(node->fileVersion->getCurrentBranch()) +
+                "\",\"version\":" + to_string(node->fileVersion->getCurrentVersionNumber());
+            if (cmd == "mergebranch")
+                r.fields += ",\"result\":\"" + outcome + "\",\"conflicts\":" + to_string(conflicts);
+            return r;
+        }
+        if (!allowed(node, PERM_READ))
+            return fail("denied", "no read permission");
+        if (cmd == "read")
+        {
+            size_t offset, len;
+            if (!(args >> offset >> len))
+                return fail("invalid", "usage: read <path> <offset> <len>");
+            string bytes;
+            OpStatus status = drive.readRange(a, offset, len, bytes);
+            if (status != STATUS_OK)
+                return fail(statusName(status), "read failed");
+            r.fields = ",\"offset\":" + to_string(offset) + ",\"content\":\"" + jsonEscape(bytes) + "\"";
+            return r;
+        }
+        if (cmd == "ancestor")
+        {
+            int first, second, ancestor = 0;
+            if (!(args >> first >> second))
+                return fail("invalid", "usage: ancestor <path> <version> <version>");
+            OpStatus status = drive.commonAncestor(a, first, second, ancestor);
+            if (status != STATUS_OK)
+                return fail(statusName(status), "no common ancestor");
+            r.fields = ",\"ancestor\":" + to_string(ancestor);
+            return r;
+        }
+        if (cmd == "branches")
+        {
+            Folder::DirLatch dir(drive, node->parent, false);
+            vector<pair<string, int>> tips = node->fileVersion->branchTips();
+            r.fields = ",\"current\":\"" + jsonEscape(node->fileVersion->getCurrentBranch()) + "\",\"branches\":[";
+            for (size_t i = 0; i < tips.size(); i++)
+                r.fields += string(i ? "," : "") + "{\"name\":\"" + jsonEscape(tips[i].first) + "\",\"version\":" + to_string(tips[i].second) + "}";
+            r.fields += "]";
+            return r;
+        }
+        if (cmd == "diff")
+        {
+            int from, to;
+            if (!(args >> from >> to))
+                return fail("invalid", "usage: diff <path> <from> <to>");
+            ContentDiff::Result changes;
+            OpStatus status = drive.diffVersions(a, from, to, changes);
+            if (status != STATUS_OK)
+                return fail(statusName(status), "no such version");
+            r.fields = ",\"binary\":" + string(changes.binary ? "true" : "false") +
+                ",\"added\":" + to_string(changes.added) + ",\"removed\":" + to_string(changes.removed) +
+                ",\"hunks\":" + to_string(changes.hunks.size()) +
+                ",\"unified\":\"" + jsonEscape(ContentDiff::unified(changes)) + "\"";
+            return r;
+        }
+        if (cmd == "cat")
+        {
+            int version;
+            ContentRef content = node->fileVersion->latest(version);
+            r.fields = ",\"version\":" + to_string(version) + ",\"content\":\"";
+            content->forEachExtent([&](string_view piece) { r.fields += jsonEscape(piece); });
+            r.fields += "\"";
+            return r;
+        }
+        Folder::DirLatch dir(drive, node->parent, false);
+        stringstream ss;
+        ss << ",\"current\":" << node->fileVersion->getCurrentVersionNumber() << ",\"branch\":\""
+            << jsonEscape(node->fileVersion->getCurrentBranch()) << "\",\"versions\":[";
+        vector<pair<int, ContentRef>> chain = node->fileVersion->versions();
+        for (size_t i = 0; i < chain.size(); i++)
+            ss << (i ? "," : "") << "{\"version\":" << chain[i].first << ",\"parent\":" << node->fileVersion->parentOf(chain[i].first)
+                << ",\"bytes\":" << chain[i].second->size() << "}";
+        ss << "]";
+        r.fields = ss.str();
+        return r;
+    }
+
+public:
+    ScriptRunner(Folder& d, RecycleBin& r, UserSystem& u, AccessControl& a, GarbageCollector& g)
+        : drive(d), recycle(r), users(u), access(a), gc(g), user(-1), self(d.currentfolder)
+    {
+        drive.registerSession(&self);
+    }
+    // A server connection that goes away without logging out doesn't leave its login behind
+    ~ScriptRunner()
+    {
+        if (!session.empty())
+            users.endSession(session);
+        drive.unregisterSession(&self);
+    }
+    ScriptRunner(const ScriptRunner&) = delete;
+
+    // Runs one line. Returns 1 if the command failed, 0 if it ran, -1 for blank lines and
+    // comments. 'cmd' receives the command word; the JSON reply goes to 'out' when given.
+    int runLine(const string& text, int lineNo, ostream* out, string& cmd)
+    {
+        string line = text;
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        stringstream args(line);
+        cmd.clear();
+        if (!(args >> cmd) || cmd[0] == '#')
+            return -1;
+        // Each runner has its own working folder and user, so several can share one drive,
+        // from one thread or many
+        Folder::SessionScope bind(drive, self);
+        Reply r;
+        try
+        {
+            Folder::TreeLatch latch(drive, exclusiveCommand(cmd));
+            if (!session.empty())
+                user = users.sessionUser(session);
+            drive.setActingUser(user);
+            r = execute(cmd, args);
+        }
+        catch (const exception& e)
+        {
+            r = fail("error", e.what());
+        }
+        if (out != nullptr)
+        {
+            *out << "{\"line\":" << lineNo << ",\"cmd\":\"" << jsonEscape(cmd) << "\",\"ok\":" << (r.ok ? "true" : "false")
+                << ",\"status\":\"" << r.status << "\"";
+            if (!r.error.empty())
+                *out << ",\"error\":\"" << jsonEscape(r.error) << "\"";
+            *out << r.fields << "}\n";
+        }
+        gc.step();
+        return r.ok ? 0 : 1;
+    }
+
+    // Returns how many commands failed
+    int run(istream& in, ostream& out)
+    {
+        int failures = 0;
+        string line, cmd;
+        for (int lineNo = 1; getline(in, line); lineNo++)
+        {
+            if (runLine(line, lineNo, &out, cmd) == 1)
+                failures++;
+        }
+        out.flush();
+        return failures;
+    }
+};
+
+// Samples ranks 0..n-1 with P(k) proportional to 1 / (k + 1)^skew
+class ZipfSampler
+{
+    vector<double> cdf;
+
+public:
+    ZipfSampler(int n, double skew) : cdf(n)
+    {
+        double total = 0;
+        for (int k = 0; k < n; k++)
+        {
+            total += 1.0 / pow(k + 1.0, skew);
+            cdf[k] = total;
+        }
+        for (int k = 0; k < n; k++)
+            cdf[k] /= total;
+    }
+
+    int sample(mt19937& rng) const
+    {
+        double u = uniform_real_distribution<double>(0.0, 1.0)(rng);
+        return (int)(lower_bound(cdf.begin(), cdf.end(), u) - cdf.begin());
+    }
+};
+
+struct WorkloadConfig
+{
+    long long ops = 100000;
+    int files = 2000;
+    int depth = 4;         // folder levels below the starting folder
+    int fanout = 6;        // subfolders per folder on every level
+    double zipfSkew = 1.1; // file popularity
+    int burstLength = 8;   // versions written by one edit burst
+    int users = 4;         // extra users that files get shared with
+    unsigned seed = 1;
+};
+
+// Writes a synthetic session in the --script command language. A setup part builds the tree
+// and the "# measure" marker starts the part a replay reports on. The same config and seed
+// always produce the same trace.
+class WorkloadGenerator
+{
+    WorkloadConfig config;
+    mt19937 rng;
+
+    string randomContent()
+    {
+        // Log-uniform between 16 bytes and 16 KB
+        int size = (int)exp(uniform_real_distribution<double>(log(16.0), log(16384.0))(rng));
+        string text(size, ' ');
+        for (int i = 0; i < size; i++)
+            text[i] = (i % 8 == 7) ? ' ' : (char)('a' + rng() % 26);
+        return text;
+    }
+
+public:
+    WorkloadGenerator(const WorkloadConfig& c) : config(c), rng(c.seed) {}
+
+    void generate(ostream& out)
+    {
+        out << "# workload seed=" << config.seed << " ops=" << config.ops << " files=" << config.files
+            << " depth=" << config.depth << " fanout=" << config.fanout << " skew=" << config.zipfSkew << "\n";
+        out << "useradd bench bench admin\nlogin bench bench\n";
+        for (int u = 0; u < config.users; u++)
+            out << "useradd peer" << u << " bench editor\n";
+
+        // Deep and wide: every folder down to 'depth' gets 'fanout' children
+        vector<string> folders(1, ".");
+        for (size_t i = 0; i < folders.size(); i++)
+        {
+            int level = folders[i] == "." ? 0 : (int)count(folders[i].begin(), folders[i].end(), '/') + 1;
+            if (level >= config.depth)
+                continue;
+            for (int c = 0; c < config.fanout; c++)
+            {
+                string child = (folders[i] == "." ? "" : folders[i] + "/") + "d" + to_string(c);
+                folders.push_back(child);
+                out << "mkdir " << child << "\n";
+            }
+        }
+
+        vector<string> paths(config.files);
+        vector<bool> deleted(config.files, false);
+        for (int f = 0; f < config.files; f++)
+        {
+            const string& folder = folders[rng() % folders.size()];
+            paths[f] = (folder == "." ? "" : folder + "/") + "f" + to_string(f) + ".txt";
+            out << "put " << paths[f] << " " << randomContent() << "\n";
+        }
+
+        out << "# measure\n";
+        ZipfSampler popularity(config.files, config.zipfSkew);
+        for (long long emitted = 0; emitted < config.ops; )
+        {
+            int f = popularity.sample(rng);
+            int roll = rng() % 100;
+            if (deleted[f])
+            {
+                out << "restore f" << f << ".txt\n";
+                deleted[f] = false;
+                emitted++;
+                continue;
+            }
+            if (roll < 50)
+                out << "cat " << paths[f] << "\n";
+            else if (roll < 65)
+            {
+                // An edit burst: several saves of the same file in a row
+                for (int b = 0; b < config.burstLength && emitted < config.ops; b++, emitted++)
+                    out << "update " << paths[f] << " " << randomContent() << "\n";
+                continue;
+            }
+            else if (roll < 73)
+            {
+                size_t slash = paths[f].find_last_of('/');
+                out << "ls" << (slash == string::npos ? "" : " " + paths[f].substr(0, slash)) << "\n";
+            }
+            else if (roll < 78)
+                out << "history " << paths[f] << "\n";
+            else if (roll < 82)
+            {
+                out << "rm " << paths[f] << "\n";
+                deleted[f] = true;
+            }
+            else if (roll < 86)
+                out << "share peer" << rng() % max(config.users, 1) << "\n";
+            else if (roll < 92)
+                out << "sync " << paths[f] << "\n";
+            else if (roll < 95)
+                out << "search f" << f << ".txt\n";
+            else if (roll < 97)
+            {
+                // Move the file to another folder; later ops follow it
+                const string& folder = folders[rng() % folders.size()];
+                string target = (folder == "." ? "" : folder + "/") + "f" + to_string(f) + ".txt";
+                if (target != paths[f])
+                {
+                    out << "mv " << paths[f] << " " << target << "\n";
+                    paths[f] = target;
+                }
+                else
+                    out << "cat " << paths[f] << "\n";
+            }
+            else
+                out << "du\n";
+            emitted++;
+        }
+    }
+};
+
+// Replays a trace against one drive and reports latency percentiles per command. With several
+// threads, each replays the whole trace inside its own folder "t<i>" with its own session, and
+// the threads run against the drive concurrently. The Recycle Bin is shared, so a thread may
+// restore another's file by name; such misses count as failures.
+class ReplayHarness
+{
+    Folder& drive;
+    RecycleBin& recycle;
+    UserSystem& users;
+    AccessControl& access;
+    GarbageCollector& gc;
+
+    struct ThreadLog
+    {
+        map<string, vector<long long>> latencies; // ns per command word
+        map<string, long long> failures;
+    };
+
+    void replay(const vector<string>& lines, int tid, int threads, ThreadLog& log)
+    {
+        ScriptRunner runner(drive, recycle, users, access, gc);
+        // Traces without a "# measure" marker, such as recorded sessions, are measured throughout
+        bool measuring = find(lines.begin(), lines.end(), "# measure") == lines.end();
+        bool placed = threads == 1;
+        string cmd;
+        for (size_t i = 0; i < lines.size(); i++)
+        {
+            if (lines[i] == "# measure")
+                measuring = true;
+            if (!placed && lines[i].compare(0, 8, "useradd ") != 0 && lines[i].compare(0, 6, "login ") != 0
+                && lines[i][0] != '#')
+            {
+                runner.runLine("mkdir t" + to_string(tid), 0, nullptr, cmd);
+                runner.runLine("cd t" + to_string(tid), 0, nullptr, cmd);
+                placed = true;
+            }
+            chrono::steady_clock::time_point start = chrono::steady_clock::now();
+            int result = runner.runLine(lines[i], (int)i + 1, nullptr, cmd);
+            long long ns = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+            if (result < 0 || !measuring)
+                continue;
+            log.latencies[cmd].push_back(ns);
+            if (result == 1)
+                log.failures[cmd]++;
+        }
+    }
+
+    static double percentile(const vector<long long>& sorted, double p)
+    {
+        if (sorted.empty())
+            return 0;
+        size_t rank = (size_t)ceil(p * sorted.size());
+        return sorted[rank == 0 ? 0 : rank - 1] / 1000.0;
+    }
+
+public:
+    ReplayHarness(Folder& d, RecycleBin& r, UserSystem& u, AccessControl& a, GarbageCollector& g)
+        : drive(d), recycle(r), users(u), access(a), gc(g) {}
+
+    void run(const vector<string>& lines, int threads, ostream& out)
+    {
+        vector<ThreadLog> logs(threads);
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        vector<thread> pool;
+        for (int t = 1; t < threads; t++)
+            pool.emplace_back(&ReplayHarness::replay, this, cref(lines), t, threads, ref(logs[t]));
+        replay(lines, 0, threads, logs[0]);
+        for (size_t t = 0; t < pool.size(); t++)
+            pool[t].join();
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+
+        map<string, vector<long long>> merged;
+        map<string, long long> failures;
+        long long total = 0, failed = 0;
+        for (int t = 0; t < threads; t++)
+        {
+            for (map<string, vector<long long>>::iterator it = logs[t].latencies.begin(); it != logs[t].latencies.end(); ++it)
+            {
+                vector<long long>& all = merged[it->first];
+                all.insert(all.end(), it->second.begin(), it->second.end());
+                total += it->second.size();
+            }
+            for (map<string, long long>::iterator it = logs[t].failures.begin(); it != logs[t].failures.end(); ++it)
+            {
+                failures[it->first] += it->second;
+                failed += it->second;
+            }
+        }
+
+        out << fixed << setprecision(2);
+        out << "{\"threads\":" << threads << ",\"ops\":" << total << ",\"failures\":" << failed
+            << ",\"seconds\":" << seconds << ",\"ops_per_sec\":" << (seconds > 0 ? total / seconds : 0) << ",\"operations\":{";
+        bool first = true;
+        for (map<string, vector<long long>>::iterator it = merged.begin(); it != merged.end(); ++it)
+        {
+            vector<long long>& v = it->second;
+            sort(v.begin(), v.end());
+            out << (first ? "\n" : ",\n") << "  \"" << jsonEscape(it->first) << "\":{\"count\":" << v.size()
+                << ",\"failures\":" << failures[it->first] << ",\"p50_us\":" << percentile(v, 0.50)
+                << ",\"p99_us\":" << percentile(v, 0.99) << ",\"p999_us\":" << percentile(v, 0.999)
+                << ",\"max_us\":" << v.back() / 1000.0 << "}";
+            first = false;
+        }
+        out << "\n}}" << endl;
+        out.unsetf(ios::fixed);
+    }
+};
+
+// Writes each interactive command as its --script equivalent so a real session can be
+// replayed later. Commands act on names in the current folder, which the trace mirrors
+// with cd lines. The trace logs in as its own admin user.
+class TraceRecorder
+{
+    ofstream out;
+
+public:
+    bool open(const string& path)
+    {
+        out.open(path, ios::trunc);
+        if (!out)
+            return false;
+        out << "# recorded " << formatTimestamp(time(0)) << "\nuseradd replay replay admin\nlogin replay replay\n";
+        return true;
+    }
+
+    void record(const string& line)
+    {
+        if (out.is_open())
+        {
+            out << line << "\n";
+            out.flush();
+        }
+    }
+};
+
+//  Server Mode
+// Wire protocol: every frame is a little-endian header followed by a body.
+//
+//   request   u32 length | u32 id | u8 op     | arguments, as text after the --script command word
+//   response  u32 length | u32 id | u8 status | the command's JSON reply (status 0 = ok, 1 = failed)
+//
+// 'length' counts the bytes after itself. Requests on one connection run in order and their
+// responses come back in the same order, so a client may pipeline as many as it likes; 'id'
+// is echoed to help it match them up.
+enum WireOp
+{
+    WIRE_USERADD = 1, WIRE_LOGIN, WIRE_LOGOUT, WIRE_MKDIR, WIRE_PUT, WIRE_UPDATE, WIRE_RM, WIRE_MV,
+    WIRE_LS, WIRE_CD, WIRE_DU, WIRE_SEARCH, WIRE_RESTORE, WIRE_SHARE, WIRE_GC, WIRE_ROLLBACK,
+    WIRE_CAT, WIRE_HISTORY, WIRE_SYNC, WIRE_METRICS, WIRE_READ, WIRE_WRITE, WIRE_APPEND,
+    WIRE_DIFF, WIRE_MERGE, WIRE_BRANCH, WIRE_CHECKOUT, WIRE_RMBRANCH, WIRE_MERGEBRANCH, WIRE_BRANCHES,
+    WIRE_ANCESTOR, WIRE_OPS
+};
+
+const char* wireCommand(int op)
+{
+    static const char* const names[WIRE_OPS] = { "", "useradd", "login", "logout", "mkdir", "put", "update",
+        "rm", "mv", "ls", "cd", "du", "search", "restore", "share", "gc", "rollback", "cat", "history",
+        "sync", "metrics", "read", "write", "append", "diff", "merge", "branch", "checkout", "rmbranch",
+        "mergebranch", "branches", "ancestor" };
+    return op > 0 && op < WIRE_OPS ? names[op] : nullptr;
+}
+
+const size_t WIRE_HEADER = 9;
+const uint32_t WIRE_MAX_FRAME = 64 << 20;
+
+void putWireU32(string& out, uint32_t v)
+{
+    for (int i = 0; i < 4; i++)
+        out.push_back((char)((v >> (8 * i)) & 0xff));
+}
+
+uint32_t getWireU32(const char* p)
+{
+    return (uint32_t)(unsigned char)p[0] | (uint32_t)(unsigned char)p[1] << 8
+        | (uint32_t)(unsigned char)p[2] << 16 | (uint32_t)(unsigned char)p[3] << 24;
+}
+
+void putWireFrame(string& out, uint32_t id, unsigned char code, const string& body)
+{
+    putWireU32(out, (uint32_t)(body.size() + WIRE_HEADER - 4));
+    putWireU32(out, id);
+    out.push_back((char)code);
+    out += body;
+}
+
+// Takes one whole frame off the front of 'buf'; false while it is still incomplete.
+// Throws on a frame larger than WIRE_MAX_FRAME.
+bool takeWireFrame(string& buf, size_t& offset, uint32_t& id, unsigned char& code, string& body)
+{
+    if (buf.size() - offset < WIRE_HEADER)
+        return false;
+    uint32_t length = getWireU32(buf.data() + offset);
+    if (length < WIRE_HEADER - 4 || length > WIRE_MAX_FRAME)
+        throw runtime_error("bad frame length");
+    if (buf.size() - offset < 4 + (size_t)length)
+        return false;
+    id = getWireU32(buf.data() + offset + 4);
+    code = (unsigned char)buf[offset + 8];
+    body.assign(buf, offset + WIRE_HEADER, length - (WIRE_HEADER - 4));
+    offset += 4 + length;
+    return true;
+}
+
+#ifdef __linux__
+
+// "unix:/path/to/socket", "host:port" or just a port on 127.0.0.1
+bool parseWireAddress(const string& address, sockaddr_storage& addr, socklen_t& len, string& error)
+{
+    memset(&addr, 0, sizeof(addr));
+    if (address.compare(0, 5, "unix:") == 0)
+    {
+        sockaddr_un* un = (sockaddr_un*)&addr;
+        string path = address.substr(5);
+        if (path.empty() || path.size() >= sizeof(un->sun_path))
+        {
+            error = "bad socket path";
+            return false;
+        }
+        un->sun_family = AF_UNIX;
+        strcpy(un->sun_path, path.c_str());
+        len = sizeof(sockaddr_un);
+        return true;
+    }
+    size_t colon = address.find_last_of(':');
+    string host = colon == string::npos ? "127.0.0.1" : address.substr(0, colon);
+    int port = atoi(address.substr(colon == string::npos ? 0 : colon + 1).c_str());
+    sockaddr_in* in = (sockaddr_in*)&addr;
+    in->sin_family = AF_INET;
+    in->sin_port = htons((uint16_t)port);
+    if (port <= 0 || port > 65535 || inet_pton(AF_INET, host.c_str(), &in->sin_addr) != 1)
+    {
+        error = "bad address '" + address + "'";
+        return false;
+    }
+    len = sizeof(sockaddr_in);
+    return true;
+}
+
+bool setNonBlocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) == 0;
+}
+
+volatile sig_atomic_t serverStopRequested = 0;
+
+void requestServerStop(int)
+{
+    serverStopRequested = 1;
+}
+
+// Serves the drive to many clients at once. One thread runs an epoll loop that owns every
+// socket: it accepts, reads and frames requests, and writes responses back. A pool of workers
+// runs the requests. Each connection is its own session with its own ScriptRunner (login,
+// working folder), and at most one worker serves a connection at a time, which keeps its
+// requests in order while different connections run in parallel.
+class DriveServer
+{
+    struct Request
+    {
+        uint32_t id;
+        unsigned char op;
+        string args;
+    };
+
+    struct Connection
+    {
+        int fd;
+        ScriptRunner runner;
+        string in;       // bytes read but not yet framed; loop thread only
+        string sending;  // responses being written; loop thread only
+        uint32_t armed;  // epoll events currently watched; loop thread only
+        bool draining;   // the peer stopped sending: close once every reply is out; loop thread only
+
+        mutex lock; // guards the fields below
+        deque<Request> pending;
+        string out;     // responses finished by a worker, not yet picked up by the loop
+        bool scheduled; // queued for or running on a worker
+        bool busy;      // a worker is running a request whose reply isn't in 'out' yet
+        bool closed;
+
+        Connection(int f, Folder& d, RecycleBin& r, UserSystem& u, AccessControl& a, GarbageCollector& g)
+            : fd(f), runner(d, r, u, a, g), armed(EPOLLIN), draining(false), scheduled(false), busy(false), closed(false) {}
+    };
+    typedef shared_ptr<Connection> ConnectionRef;
+
+    // Requests a worker runs for one connection before letting the others have a turn
+    static const int WORKER_TURN = 32;
+    // Past either limit a connection isn't read until it drains, so a client that pipelines
+    // without reading its replies can't grow the server without bound
+    static const size_t MAX_PENDING = 1024;
+    static const size_t MAX_UNSENT = 8 << 20;
+    // Bytes taken from one socket per wakeup, so the queue limits are looked at in between
+    static const size_t READ_BUDGET = 1 << 20;
+
+    Folder& drive;
+    RecycleBin& recycle;
+    UserSystem& users;
+    AccessControl& access;
+    GarbageCollector& gc;
+    int listenFd;
+    int epollFd;
+    int wakeFd; // eventfd: workers poke the loop when they leave output behind
+    string unixPath;
+    unordered_map<int, ConnectionRef> connections; // loop thread only
+
+    mutex queueLock;
+    condition_variable queueReady;
+    deque<ConnectionRef> ready;
+    bool stopping;
+
+    mutex flushLock;
+    vector<ConnectionRef> flushes;
+
+    void watch(int fd, uint32_t events, int ctl)
+    {
+        epoll_event ev;
+        memset(&ev, 0, sizeof(ev));
+        ev.events = events;
+        ev.data.fd = fd;
+        epoll_ctl(epollFd, ctl, fd, &ev);
+    }
+
+    void schedule(const ConnectionRef& conn)
+    {
+        {
+            lock_guard<mutex> guard(queueLock);
+            ready.push_back(conn);
+        }
+        queueReady.notify_one();
+    }
+
+    void workerLoop()
+    {
+        while (true)
+        {
+            ConnectionRef conn;
+            {
+                unique_lock<mutex> guard(queueLock);
+                queueReady.wait(guard, [this]() { return stopping || !ready.empty(); });
+                if (ready.empty())
+                    return;
+                conn = ready.front();
+                ready.pop_front();
+            }
+            serve(conn);
+        }
+    }
+
+    void serve(const ConnectionRef& conn)
+    {
+        string cmd;
+        for (int turn = 0; ; turn++)
+        {
+            Request request;
+            {
+                lock_guard<mutex> guard(conn->lock);
+                if (conn->closed || conn->pending.empty())
+                {
+                    conn->scheduled = false;
+                    return;
+                }
+                if (turn == WORKER_TURN)
+                    break; // still scheduled; back of the queue
+                request = conn->pending.front();
+                conn->pending.pop_front();
+                conn->busy = true;
+            }
+            string frame;
+            const char* word = wireCommand(request.op);
+            if (word == nullptr)
+                putWireFrame(frame, request.id, 1, "{\"ok\":false,\"status\":\"invalid\",\"error\":\"unknown op\"}");
+            else
+            {
+                ostringstream reply;
+                int result = conn->runner.runLine(string(word) + " " + request.args, (int)request.id, &reply, cmd);
+                string body = reply.str();
+                if (!body.empty() && body[body.size() - 1] == '\n')
+                    body.erase(body.size() - 1);
+                putWireFrame(frame, request.id, result == 1 ? 1 : 0, body);
+            }
+            bool first;
+            {
+                lock_guard<mutex> guard(conn->lock);
+                first = conn->out.empty();
+                conn->out += frame;
+                conn->busy = false;
+            }
+            if (first)
+            {
+                {
+                    lock_guard<mutex> guard(flushLock);
+                    flushes.push_back(conn);
+                }
+                uint64_t one = 1;
+                ssize_t ignored = write(wakeFd, &one, sizeof(one));
+                (void)ignored;
+            }
+        }
+        schedule(conn);
+    }
+
+    void accept()
+    {
+        while (true)
+        {
+            int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (fd < 0)
+                return;
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+            connections[fd] = ConnectionRef(new Connection(fd, drive, recycle, users, access, gc));
+            watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+        }
+    }
+
+    void close(const ConnectionRef& conn)
+    {
+        {
+            lock_guard<mutex> guard(conn->lock);
+            conn->closed = true;
+            conn->pending.clear();
+        }
+        epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+        ::close(conn->fd);
+        connections.erase(conn->fd);
+    }
+
+    // Watches for input only while the connection is under its queue limits, and for output
+    // only while some is waiting. A draining connection is closed once nothing is left to do.
+    void rearm(const ConnectionRef& conn)
+    {
+        size_t queued, unsent;
+        bool idle;
+        {
+            lock_guard<mutex> guard(conn->lock);
+            queued = conn->pending.size();
+            unsent = conn->out.size() + conn->sending.size();
+            idle = queued == 0 && !conn->busy && conn->out.empty();
+        }
+        if (conn->draining && idle && conn->sending.empty())
+        {
+            close(conn);
+            return;
+        }
+        bool read = !conn->draining && queued < MAX_PENDING && unsent < MAX_UNSENT;
+        uint32_t events = (read ? EPOLLIN : 0) | (conn->sending.empty() ? 0 : EPOLLOUT);
+        if (events != conn->armed)
+        {
+            conn->armed = events;
+            watch(conn->fd, events, EPOLL_CTL_MOD);
+        }
+    }
+
+    // Reads what has arrived, up to READ_BUDGET, and queues every complete request. End of
+    // input only stops reading: requests already sent are still answered.
+    void receive(const ConnectionRef& conn)
+    {
+        char buf[65536];
+        bool broken = false;
+        size_t taken = 0;
+        while (taken < READ_BUDGET)
+        {
+            ssize_t n = read(conn->fd, buf, sizeof(buf));
+            if (n > 0)
+            {
+                conn->in.append(buf, n);
+                taken += n;
+                continue;
+            }
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n == 0)
+                conn->draining = true;
+            else if (errno != EAGAIN && errno != EWOULDBLOCK)
+                broken = true;
+            break;
+        }
+        vector<Request> framed;
+        size_t offset = 0;
+        try
+        {
+            Request request;
+            while (takeWireFrame(conn->in, offset, request.id, request.op, request.args))
+                framed.push_back(request);
+        }
+        catch (const exception&)
+        {
+            broken = true; // a broken stream can't be resynchronized
+        }
+        conn->in.erase(0, offset);
+        if (!framed.empty())
+        {
+            bool wake = false;
+            {
+                lock_guard<mutex> guard(conn->lock);
+                for (size_t i = 0; i < framed.size(); i++)
+                    conn->pending.push_back(framed[i]);
+                if (!conn->scheduled)
+                    wake = conn->scheduled = true;
+            }
+            if (wake)
+                schedule(conn);
+        }
+        if (broken)
+            close(conn);
+        else
+            rearm(conn);
+    }
+
+    void send(const ConnectionRef& conn)
+    {
+        {
+            lock_guard<mutex> guard(conn->lock);
+            conn->sending += conn->out;
+            conn->out.clear();
+        }
+        size_t sent = 0;
+        while (sent < conn->sending.size())
+        {
+            ssize_t n = write(conn->fd, conn->sending.data() + sent, conn->sending.size() - sent);
+            if (n > 0)
+                sent += n;
+            else if (n < 0 && errno == EINTR)
+                continue;
+            else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+            {
+                close(conn); // the peer is gone; nothing queued can reach it
+                return;
+            }
+            else
+                break;
+        }
+        conn->sending.erase(0, sent);
+        rearm(conn);
+    }
+
+    void drainFlushes()
+    {
+        uint64_t count;
+        ssize_t ignored = read(wakeFd, &count, sizeof(count));
+        (void)ignored;
+        vector<ConnectionRef> batch;
+        {
+            lock_guard<mutex> guard(flushLock);
+            batch.swap(flushes);
+        }
+        for (size_t i = 0; i < batch.size(); i++)
+        {
+            if (connections.count(batch[i]->fd) && connections[batch[i]->fd] == batch[i])
+                send(batch[i]);
+        }
+    }
+
+public:
+    DriveServer(Folder& d, RecycleBin& r, UserSystem& u, AccessControl& a, GarbageCollector& g)
+        : drive(d), recycle(r), users(u), access(a), gc(g), listenFd(-1), epollFd(-1), wakeFd(-1), stopping(false) {}
+
+    ~DriveServer()
+    {
+        if (listenFd >= 0)
+            ::close(listenFd);
+        if (epollFd >= 0)
+            ::close(epollFd);
+        if (wakeFd >= 0)
+            ::close(wakeFd);
+        if (!unixPath.empty())
+            unlink(unixPath.c_str());
+    }
+
+    bool listen(const string& address, string& error)
+    {
+        sockaddr_storage addr;
+        socklen_t len;
+        if (!parseWireAddress(address, addr, len, error))
+            return false;
+        listenFd = socket(addr.ss_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (listenFd < 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+        if (addr.ss_family == AF_UNIX)
+        {
+            unixPath = ((sockaddr_un*)&addr)->sun_path;
+            unlink(unixPath.c_str());
+        }
+        else
+        {
+            int one = 1;
+            setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        }
+        if (::bind(listenFd, (sockaddr*)&addr, len) != 0 || ::listen(listenFd, SOMAXCONN) != 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+        epollFd = epoll_create1(EPOLL_CLOEXEC);
+        wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (epollFd < 0 || wakeFd < 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+        watch(listenFd, EPOLLIN, EPOLL_CTL_ADD);
+        watch(wakeFd, EPOLLIN, EPOLL_CTL_ADD);
+        return true;
+    }
+
+    // Runs until SIGINT or SIGTERM
+    void run(int workers)
+    {
+        signal(SIGINT, requestServerStop);
+        signal(SIGTERM, requestServerStop);
+        signal(SIGPIPE, SIG_IGN);
+        vector<thread> pool;
+        for (int i = 0; i < workers; i++)
+            pool.emplace_back(&DriveServer::workerLoop, this);
+
+        epoll_event events[256];
+        while (!serverStopRequested)
+        {
+            int n = epoll_wait(epollFd, events, 256, 200);
+            for (int i = 0; i < n; i++)
+            {
+                int fd = events[i].data.fd;
+                if (fd == listenFd)
+                    accept();
+                else if (fd == wakeFd)
+                    drainFlushes();
+                else
+                {
+                    unordered_map<int, ConnectionRef>::iterator it = connections.find(fd);
+                    if (it == connections.end())
+                        continue;
+                    ConnectionRef conn = it->second;
+                    if (events[i].events & EPOLLOUT)
+                        send(conn);
+                    if ((events[i].events & EPOLLIN) && !conn->closed)
+                        receive(conn);
+                    // Both directions are shut, or the socket failed: replies can't be delivered
+                    if ((events[i].events & (EPOLLHUP | EPOLLERR)) && !conn->closed)
+                        close(conn);
+                }
+            }
+        }
+
+        {
+            lock_guard<mutex> guard(queueLock);
+            stopping = true;
+            ready.clear();
+        }
+        queueReady.notify_all();
+        for (size_t i = 0; i < pool.size(); i++)
+            pool[i].join();
+        while (!connections.empty())
+            close(connections.begin()->second);
+    }
+};
+
+// Loopback load generator: opens many connections to a server from one epoll thread, logs
+// each in, gives it a folder with a few files, then keeps 'depth' requests in flight per
+// connection (reads, updates, listings) and reports throughput and latency percentiles.
+class LoadClient
+{
+    struct Session
+    {
+        int fd;
+        int index;
+        string out;
+        string in;
+        deque<chrono::steady_clock::time_point> inflight; // send times, oldest first
+        deque<bool> measured;
+        long long sent;
+        long long received;
+        bool wantWrite;
+    };
+
+    static const int FILES_PER_SESSION = 8;
+
+    string address;
+    int connectionCount;
+    long long requests; // measured requests per connection
+    int depth;
+    mt19937 rng;
+    vector<long long> latencies;
+    long long failures;
+
+    // Setup requests (login, mkdir, cd, puts) are sent first and not measured
+    int setupCount() const
+    {
+        return 3 + FILES_PER_SESSION;
+    }
+
+    void queueRequest(Session& s)
+    {
+        long long k = s.sent;
+        unsigned char op;
+        string args;
+        if (k == 0)
+            op = WIRE_LOGIN, args = "loadgen loadgen";
+        else if (k == 1)
+            op = WIRE_MKDIR, args = "c" + to_string(s.index);
+        else if (k == 2)
+            op = WIRE_CD, args = "c" + to_string(s.index);
+        else if (k < setupCount())
+            op = WIRE_PUT, args = "f" + to_string(k - 3) + " initial content";
+        else
+        {
+            int pick = rng() % 100;
+            string file = "f" + to_string(rng() % FILES_PER_SESSION);
+            if (pick < 70)
+                op = WIRE_CAT, args = file;
+            else if (pick < 85)
+                op = WIRE_UPDATE, args = file + " edit " + to_string(k);
+            else if (pick < 95)
+                op = WIRE_LS, args = "";
+            else
+                op = WIRE_DU, args = "";
+        }
+        putWireFrame(s.out, (uint32_t)k, op, args);
+        s.inflight.push_back(chrono::steady_clock::now());
+        s.measured.push_back(k >= setupCount());
+        s.sent++;
+    }
+
+    int connect(string& error)
+    {
+        sockaddr_storage addr;
+        socklen_t len;
+        if (!parseWireAddress(address, addr, len, error))
+            return -1;
+        int fd = socket(addr.ss_family, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (fd < 0 || ::connect(fd, (sockaddr*)&addr, len) != 0)
+        {
+            error = strerror(errno);
+            if (fd >= 0)
+                ::close(fd);
+            return -1;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        return fd;
+    }
+
+    // One blocking round trip, used to create the load user before the sessions start
+    bool call(int fd, unsigned char op, const string& args)
+    {
+        string frame;
+        putWireFrame(frame, 0, op, args);
+        if (write(fd, frame.data(), frame.size()) != (ssize_t)frame.size())
+            return false;
+        string buf;
+        char chunk[4096];
+        size_t offset = 0;
+        uint32_t id;
+        unsigned char status;
+        string body;
+        while (!takeWireFrame(buf, offset, id, status, body))
+        {
+            ssize_t n = read(fd, chunk, sizeof(chunk));
+            if (n <= 0)
+                return false;
+            buf.append(chunk, n);
+        }
+        return true;
+    }
+
+public:
+    LoadClient(const string& a, int connections, long long perConnection, int pipeline)
+        : address(a), connectionCount(connections), requests(perConnection), depth(pipeline), rng(12345), failures(0) {}
+
+    bool run(ostream& out, string& error)
+    {
+        signal(SIGPIPE, SIG_IGN);
+        int setup = connect(error);
+        if (setup < 0)
+            return false;
+        // Refused when the drive already has users; the login below still works if this
+        // server was loaded before
+        call(setup, WIRE_USERADD, "loadgen loadgen admin");
+        ::close(setup);
+
+        int epollFd = epoll_create1(EPOLL_CLOEXEC);
+        vector<Session> sessions(connectionCount);
+        for (int i = 0; i < connectionCount; i++)
+        {
+            Session& s = sessions[i];
+            s.fd = connect(error);
+            if (s.fd < 0)
+            {
+                for (int j = 0; j < i; j++)
+                    ::close(sessions[j].fd);
+                ::close(epollFd);
+                return false;
+            }
+            setNonBlocking(s.fd);
+            s.index = i;
+            s.sent = s.received = 0;
+            s.wantWrite = false;
+            epoll_event ev;
+            memset(&ev, 0, sizeof(ev));
+            ev.events = EPOLLIN;
+            ev.data.u32 = (uint32_t)i;
+            epoll_ctl(epollFd, EPOLL_CTL_ADD, s.fd, &ev);
+        }
+
+        long long total = setupCount() + requests;
+        int done = 0, setUp = 0;
+        chrono::steady_clock::time_point measureStart = chrono::steady_clock::now();
+        epoll_event events[256];
+        vector<int> touched(connectionCount);
+        for (int i = 0; i < connectionCount; i++)
+            touched[i] = i;
+        while (done < connectionCount)
+        {
+            // Top every touched session up to 'depth' requests in flight and write them out
+            for (size_t t = 0; t < touched.size(); t++)
+            {
+                Session& s = sessions[touched[t]];
+                if (s.fd < 0)
+                    continue;
+                // Measured traffic waits until every session is logged in and set up
+                long long limit = setUp == connectionCount ? total : setupCount();
+                while (s.sent < limit && (long long)s.inflight.size() < depth)
+                    queueRequest(s);
+                ssize_t n = s.out.empty() ? 0 : write(s.fd, s.out.data(), s.out.size());
+                if (n > 0)
+                    s.out.erase(0, n);
+                bool backlog = !s.out.empty();
+                if (backlog != s.wantWrite)
+                {
+                    s.wantWrite = backlog;
+                    epoll_event ev;
+                    memset(&ev, 0, sizeof(ev));
+                    ev.events = backlog ? EPOLLIN | EPOLLOUT : EPOLLIN;
+                    ev.data.u32 = (uint32_t)touched[t];
+                    epoll_ctl(epollFd, EPOLL_CTL_MOD, s.fd, &ev);
+                }
+            }
+            touched.clear();
+
+            int n = epoll_wait(epollFd, events, 256, 1000);
+            if (n < 0 && errno != EINTR)
+                break;
+            for (int e = 0; e < n; e++)
+            {
+                int i = (int)events[e].data.u32;
+                Session& s = sessions[i];
+                touched.push_back(i);
+                if (!(events[e].events & (EPOLLIN | EPOLLHUP | EPOLLERR)))
+                    continue;
+                char buf[65536];
+                ssize_t r;
+                while ((r = read(s.fd, buf, sizeof(buf))) > 0)
+                    s.in.append(buf, r);
+                size_t offset = 0;
+                uint32_t id;
+                unsigned char status;
+                string body;
+                while (takeWireFrame(s.in, offset, id, status, body))
+                {
+                    chrono::steady_clock::time_point now = chrono::steady_clock::now();
+                    if (s.measured.front())
+                    {
+                        latencies.push_back(chrono::duration_cast<chrono::nanoseconds>(now - s.inflight.front()).count());
+                        if (status != 0)
+                            failures++;
+                    }
+                    else if (status != 0 && s.received == 0)
+                        error = "login failed: " + body;
+                    s.inflight.pop_front();
+                    s.measured.pop_front();
+                    s.received++;
+                    if (s.received == setupCount() && ++setUp == connectionCount)
+                    {
+                        measureStart = chrono::steady_clock::now();
+                        for (int j = 0; j < connectionCount; j++)
+                            touched.push_back(j);
+                    }
+                }
+                s.in.erase(0, offset);
+                if (s.received == total || r == 0)
+                {
+                    epoll_ctl(epollFd, EPOLL_CTL_DEL, s.fd, nullptr);
+                    ::close(s.fd);
+                    s.fd = -1;
+                    done++;
+                }
+            }
+        }
+        double seconds = chrono::duration<double>(chrono::steady_clock::now() - measureStart).count();
+        ::close(epollFd);
+        if (!error.empty())
+            return false;
+
+        sort(latencies.begin(), latencies.end());
+        out << fixed << setprecision(2);
+        out << "{\"connections\":" << connectionCount << ",\"pipeline\":" << depth << ",\"requests\":" << latencies.size()
+            << ",\"failures\":" << failures << ",\"seconds\":" << seconds
+            << ",\"requests_per_sec\":" << (seconds > 0 ? latencies.size() / seconds : 0)
+            << ",\"p50_us\":" << percentile(0.50) << ",\"p99_us\":" << percentile(0.99)
+            << ",\"p999_us\":" << percentile(0.999) << ",\"max_us\":" << (latencies.empty() ? 0 : latencies.back() / 1000.0)
+            << "}" << endl;
+        out.unsetf(ios::fixed);
+        return true;
+    }
+
+    double percentile(double p) const
+    {
+        if (latencies.empty())
+            return 0;
+        size_t rank = (size_t)ceil(p * latencies.size());
+        return latencies[rank == 0 ? 0 : rank - 1] / 1000.0;
+    }
+};
+
+#endif
+
+void showMenu()
+{
+    cout << "\n--- Folder & File Versioning System Menu ---" << endl;
+    cout << "1. Create Folder" << endl;
+    cout << "2. Create File" << endl;
+    cout << "3. Update File" << endl;
+    cout << "4. View File Version History" << endl;
+    cout << "5. Rollback File to Specific Version" << endl;
+    cout << "6. Navigate to Folder" << endl;
+    cout << "7. Navigate Up" << endl;
+    cout << "8. List Current Folder Contents" << endl;
+    cout << "9. List All Folders" << endl;
+    cout << "10. Access File (Add to Recent)" << endl;
+    cout << "11. Delete File (Move to Recycle Bin)" << endl;
+    cout << "12. View Recent Files" << endl;
+    cout << "13. View Recycle Bin" << endl;
+    cout << "14. Empty Recycle Bin" << endl;
+    cout << "15. Logout" << endl;
+    cout << "16. Share File to Another User" << endl;
+    cout << "17. View Who Can Access My Files (Graph)" << endl;
+    cout << "18. Search File" << endl;
+    cout << "19. Restore File from Recycle Bin" << endl;
+    cout << "20. Delete Folder" << endl;
+    cout << "21. Display All Users" << endl;
+    cout << "22. Forgot Password" << endl;
+    cout << "23. View File Metadata (Hash Table)" << endl;
+    cout << "24. Compress File" << endl;
+    cout << "25. Decompress File" << endl;
+    cout << "26. Add File to Cloud Sync Queue" << endl;
+    cout << "27. Process Cloud Sync Queue" << endl;
+    cout << "28. Optimize File System Structure (AVL + Garbage Collection)" << endl;
+    cout << "29. Manage Sharing Groups" << endl;
+    cout << "30. Check Transitive File Access" << endl;
+    cout << "31. Set File/Folder Permissions" << endl;
+    cout << "32. Set Password Hash Work Factor" << endl;
+    cout << "33. Set Recycle Bin Retention" << endl;
+    cout << "34. Configure Recent Files" << endl;
+    cout << "35. List Folder Range / Page" << endl;
+    cout << "36. Memory Usage Report" << endl;
+    cout << "37. Folder Usage (du)" << endl;
+    cout << "38. Storage Quotas" << endl;
+    cout << "39. Move / Rename / Copy" << endl;
+    cout << "40. Run Batch Operations" << endl;
+    cout << "41. Import / Export Disk Directory" << endl;
+    cout << "42. Engine Output Mode" << endl;
+    cout << "43. Operation Latency Stats" << endl;
+    cout << "44. Read / Write File Range" << endl;
+    cout << "45. Compare / Merge Versions" << endl;
+    cout << "46. Manage File Branches" << endl;
+    cout << "0. Exit\n";
+}
+
+// A menu batch may name any path, so each op is checked where it acts: write on the folder
+// a mkdir or create lands in, write on an updated file and its folder, delete on a deleted
+// node, write on a moved node and on its destination folder. Refused ops are taken out of
+// 'ops' and come back as errors at their batch positions; 'origin' maps the ops left to
+// those positions.
+vector<BatchError> authorizeBatch(Folder& drive, AccessControl& access, int user, vector<BatchOp>& ops, vector<size_t>& origin)
+{
+    vector<BatchError> denied;
+    vector<BatchOp> allowed;
+    origin.clear();
+    for (size_t i = 0; i < ops.size(); i++)
+    {
+        const BatchOp& op = ops[i];
+        // A path an earlier op in the batch will create doesn't resolve yet; its
+        // nearest existing ancestor governs the permissions it will inherit
+        treenode* node = op.type == BATCH_MKDIR || op.type == BATCH_CREATE ? nullptr : drive.resolvePath(op.path);
+        treenode* governing = node != nullptr ? node : drive.deepestExistingParent(op.path);
+        string reason;
+        if (op.type == BATCH_MKDIR || op.type == BATCH_CREATE)
+        {
+            if (!access.canAccess(user, governing, PERM_WRITE))
+                reason = "no write permission on the destination folder";
+        }
+        else if (op.type == BATCH_UPDATE)
+        {
+            if ((governing->parent != nullptr && !access.canAccess(user, governing->parent, PERM_WRITE)) ||
+                !access.canAccess(user, governing, PERM_WRITE))
+                reason = "no write permission";
+        }
+        else if (op.type == BATCH_DELETE)
+        {
+            if (!access.canAccess(user, governing, PERM_DELETE))
+                reason = "no delete permission";
+        }
+        else
+        {
+            size_t slash = op.path.find_last_of('/');
+            string keepName = node != nullptr ? node->name : op.path.substr(slash == string::npos ? 0 : slash + 1);
+            treenode* parent;
+            string name;
+            if (!drive.destinationOf(op.target, keepName, parent, name).empty())
+                parent = drive.deepestExistingParent(op.target);
+            if (!access.canAccess(user, governing, PERM_WRITE))
+                reason = "no write permission on the source";
+            else if (!access.canAccess(user, parent, PERM_WRITE))
+                reason = "no write permission on the destination folder";
+        }
+        if (reason.empty())
+        {
+            allowed.push_back(op);
+            origin.push_back(i);
+        }
+        else
+        {
+            BatchError error;
+            error.index = i;
+            error.path = op.path;
+            error.reason = reason;
+            denied.push_back(error);
+        }
+    }
+    ops.swap(allowed);
+    return denied;
+}
+
+void printMemoryReport(const Folder& drive, bool json)
+{
+    long long subtreeBytes = 0, subtreeObjects = 0;
+    drive.subtreeMemory(drive.currentfolder, subtreeBytes, subtreeObjects);
+    long long totalBytes = 0, totalObjects = 0;
+    for (int i = 0; i < MEM_SUBSYSTEMS; i++)
+    {
+        totalBytes += memStats.getBytes((MemSubsystem)i);
+        totalObjects += memStats.getObjects((MemSubsystem)i);
+    }
+
+    if (json)
+    {
+        cout << "{\"subsystems\":{";
+        for (int i = 0; i < MEM_SUBSYSTEMS; i++)
+        {
+            MemSubsystem sub = (MemSubsystem)i;
+            cout << (i ? "," : "") << "\"" << MemoryStats::name(sub) << "\":{\"bytes\":" << memStats.getBytes(sub)
+                << ",\"objects\":" << memStats.getObjects(sub) << "}";
+        }
+        cout << "},\"total\":{\"bytes\":" << totalBytes << ",\"objects\":" << totalObjects << "}"
+            << ",\"subtree\":{\"path\":\"" << jsonEscape(drive.getCurrentPath()) << "\",\"bytes\":" << subtreeBytes
+            << ",\"objects\":" << subtreeObjects << "}}" << endl;
+        return;
+    }
+
+    cout << "\nMemory Usage by Subsystem\n------------------------------------------" << endl;
+    cout << left << setw(16) << "Subsystem" << right << setw(14) << "Bytes" << setw(12) << "Objects" << endl;
+    for (int i = 0; i < MEM_SUBSYSTEMS; i++)
+    {
+        MemSubsystem sub = (MemSubsystem)i;
+        cout << left << setw(16) << MemoryStats::name(sub) << right << setw(14) << memStats.getBytes(sub)
+            << setw(12) << memStats.getObjects(sub) << endl;
+    }
+    cout << "------------------------------------------" << endl;
+    cout << left << setw(16) << "total" << right << setw(14) << totalBytes << setw(12) << totalObjects << endl;
+    cout << "\nSubtree " << drive.getCurrentPath() << ": " << subtreeBytes << " bytes in "
+        << subtreeObjects << " objects" << endl;
+}
+
+string getCurrentTimestamp()
+{
+    return formatTimestamp(time(0));
+}
+
+
+// Login throughput at several work factors, plus the cost of a session check for comparison
+void runAuthBenchmark()
+{
+    const int workFactors[] = { 1000, 10000, 50000, 100000 };
+    const int LOGINS = 20;
+
+    cout << "Work factor   Logins/sec   ms/login" << endl;
+    for (int w : workFactors)
+    {
+        UserSystem bench;
+        bench.setHashIterations(w);
+        bench.users[bench.userCount++] = { "bench", PasswordHasher::hash("secret", w), "", "", EDITOR };
+
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        for (int i = 0; i < LOGINS; i++)
+        {
+            if (bench.authenticate("bench", "secret").empty())
+            {
+                cout << "Benchmark login failed." << endl;
+                return;
+            }
+        }
+        double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+        cout << setw(11) << w << setw(13) << fixed << setprecision(1) << LOGINS / secs
+            << setw(11) << setprecision(3) << secs * 1000 / LOGINS << endl;
+    }
+
+    UserSystem bench;
+    bench.users[bench.userCount++] = { "bench", PasswordHasher::hash("secret", 1000), "", "", EDITOR };
+    string token = bench.authenticate("bench", "secret");
+    const int CHECKS = 1000000;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    long long ok = 0;
+    for (int i = 0; i < CHECKS; i++)
+        ok += bench.sessionUser(token) == 0;
+    double secs = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    cout << "Session check: " << setprecision(1) << (secs * 1e9 / CHECKS) << " ns/check (" << ok << " ok)" << endl;
+}
+
+// Microbenchmarks for the core data structures, printed as one JSON document so runs from
+// different builds can be diffed. Each case times 'ops' operations after its setup.
+class MicroBenchmark
+{
+    struct Result
+    {
+        string name;
+        long long param;
+        long long ops;
+        double seconds;
+        long long bytes; // payload processed, for throughput cases
+    };
+
+    string filter;
+    vector<Result> results;
+    volatile long long sink; // keeps results of timed calls alive
+
+    bool selected(const string& name) const
+    {
+        return filter.empty() || name.find(filter) != string::npos;
+    }
+
+    // body() does all 'ops' operations; setup work belongs outside it
+    template <typename Body>
+    void time(const string& name, long long param, long long ops, long long bytes, Body body)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        body();
+        Result r = { name, param, ops, chrono::duration<double>(chrono::steady_clock::now() - start).count(), bytes };
+        results.push_back(r);
+    }
+
+    static vector<string> names(const string& prefix, int count)
+    {
+        vector<string> out(count);
+        for (int i = 0; i < count; i++)
+            out[i] = prefix + to_string(i);
+        return out;
+    }
+
+    void folderCases()
+    {
+        const int fanouts[] = { 10, 1000, 100000 };
+        for (int fanout : fanouts)
+        {
+            vector<string> files = names("file", fanout);
+            Folder drive("Root");
+            if (selected("folder.create"))
+            {
+                time("folder.create", fanout, fanout, 0, [&]()
+                    {
+                        for (int i = 0; i < fanout; i++)
+                            drive.createFile(files[i], "x");
+                    });
+            }
+            else
+            {
+                for (int i = 0; i < fanout; i++)
+                    drive.createFile(files[i], "x");
+            }
+
+            const long long LOOKUPS = 1000000;
+            mt19937 rng(42);
+            vector<int> picks(LOOKUPS);
+            for (long long i = 0; i < LOOKUPS; i++)
+                picks[i] = rng() % fanout;
+            if (selected("folder.lookup"))
+            {
+                time("folder.lookup", fanout, LOOKUPS, 0, [&]()
+                    {
+                        long long found = 0;
+                        for (long long i = 0; i < LOOKUPS; i++)
+                            found += drive.findChild(drive.currentfolder, files[picks[i]], false) != nullptr;
+                        sink = found;
+                    });
+            }
+
+            if (selected("folder.navigate"))
+            {
+                int folders = min(fanout, 10000);
+                vector<string> dirs = names("dir", folders);
+                for (int i = 0; i < folders; i++)
+                    drive.createFolder(dirs[i]);
+                const long long MOVES = 200000;
+                time("folder.navigate", fanout, MOVES * 2, 0, [&]()
+                    {
+                        long long ok = 0;
+                        for (long long i = 0; i < MOVES; i++)
+                        {
+                            ok += drive.navigateToFolder(dirs[picks[i] % folders]);
+                            ok += drive.navigateUp();
+                        }
+                        sink = ok;
+                    });
+            }
+        }
+    }
+
+    void versioningCases()
+    {
+        const int depths[] = { 100, 10000, 100000 };
+        for (int depth : depths)
+        {
+            FileVersioning history;
+            if (selected("versioning.add"))
+            {
+                time("versioning.add", depth, depth, 0, [&]()
+                    {
+                        for (int i = 0; i < depth; i++)
+                            history.addVersion("version content");
+                    });
+            }
+            else
+            {
+                for (int i = 0; i < depth; i++)
+                    history.addVersion("version content");
+            }
+
+            if (selected("versioning.rollback"))
+            {
+                const long long ROLLBACKS = depth >= 100000 ? 2000 : 20000;
+                mt19937 rng(7);
+                time("versioning.rollback", depth, ROLLBACKS, 0, [&]()
+                    {
+                        long long ok = 0;
+                        for (long long i = 0; i < ROLLBACKS; i++)
+                            ok += history.rollbackToVersion(1 + rng() % depth);
+                        sink = ok;
+                    });
+            }
+
+            // Two lines 'depth' versions long from one fork: walking parents would cost
+            // O(depth) a query, the skip pointers O(log depth)
+            if (selected("versioning.merge_base"))
+            {
+                FileVersioning forked;
+                forked.addVersion("fork point", false);
+                forked.createBranch("side");
+                for (int i = 0; i < depth; i++)
+                    forked.addVersion("main line", false);
+                forked.switchBranch("side");
+                for (int i = 0; i < depth; i++)
+                    forked.addVersion("side line", false);
+                int mainTip = forked.branchTip(MAIN_BRANCH), sideTip = forked.getCurrentVersionNumber();
+                const long long QUERIES = 200000;
+                time("versioning.merge_base", depth, QUERIES, 0, [&]()
+                    {
+                        long long total = 0;
+                        for (long long i = 0; i < QUERIES; i++)
+                            total += forked.commonAncestor(mainTip - (int)(i % depth), sideTip - (int)((i * 7) % depth));
+                        sink = total;
+                    });
+            }
+        }
+
+        // Reading the current content shares its blob, so the cost must not grow with size
+        if (selected("versioning.latest"))
+        {
+            const size_t sizes[] = { 1 << 10, 1 << 20, 16 << 20 };
+            const long long READS = 200000;
+            for (size_t size : sizes)
+            {
+                FileVersioning history;
+                history.addVersion(string(size, 'v'), false);
+                time("versioning.latest", (long long)size, READS, 0, [&]()
+                    {
+                        size_t total = 0;
+                        for (long long i = 0; i < READS; i++)
+                            total += history.latest()->size();
+                        sink = (long long)total;
+                    });
+            }
+        }
+
+        // A small edit rebuilds one extent, so it must not grow with the file either
+        if (selected("versioning.write_range"))
+        {
+            const size_t sizes[] = { 1 << 10, 1 << 20, 16 << 20 };
+            const long long WRITES = 2000;
+            for (size_t size : sizes)
             {
-                if (prev == nullptr)
+                FileVersioning history;
+                history.addVersion(string(size, 'v'), false);
+                mt19937 rng(11);
+                time("versioning.write_range", (long long)size, WRITES, 0, [&]()
+                    {
+                        for (long long i = 0; i < WRITES; i++)
+                            history.addVersion(history.latest()->write(rng() % (size - 16), "sixteen bytes!!!"), false);
+                        sink = history.getVersionCount();
+                    });
+            }
+        }
+
+        // Scattered edits to a text built separately, so no extents are shared and every
+        // line is tokenized: the cost should grow with the size, not its square
+        if (selected("versioning.diff") || selected("versioning.merge"))
+        {
+            const int lineCounts[] = { 1000, 100000 };
+            const int EDITS = 20;
+            for (int lines : lineCounts)
+            {
+                string base, ours, theirs;
+                mt19937 rng(13);
+                for (int i = 0; i < lines; i++)
                 {
-                    table[index] = current->next;
+                    string line = "line " + to_string(i) + " of the benchmark text\n";
+                    base += line;
+                    ours += rng() % lines < (unsigned)EDITS ? "ours changed " + line : line;
+                    theirs += rng() % lines < (unsigned)EDITS ? "theirs changed " + line : line;
                 }
-                else
+                ContentRef baseRef = makeContent(base), oursRef = makeContent(ours), theirsRef = makeContent(theirs);
+                const long long RUNS = lines >= 100000 ? 5 : 200;
+                if (selected("versioning.diff"))
                 {
-                    prev->next = current->next;
+                    time("versioning.diff", lines, RUNS, 0, [&]()
+                        {
+                            size_t hunks = 0;
+                            for (long long i = 0; i < RUNS; i++)
+                                hunks += ContentDiff::diff(baseRef, oursRef).hunks.size();
+                            sink = (long long)hunks;
+                        });
+                }
+                if (selected("versioning.merge"))
+                {
+                    time("versioning.merge", lines, RUNS, 0, [&]()
+                        {
+                            size_t bytes = 0;
+                            for (long long i = 0; i < RUNS; i++)
+                                bytes += ContentDiff::merge(baseRef, oursRef, theirsRef).content->size();
+                            sink = (long long)bytes;
+                        });
                 }
-                delete current;
-                cout << "File removed from index.\n";
-                return;
             }
-            prev = current;
-            current = current->next;
         }
     }
 
-    void displayFileInfo(const string& filename) const
+    void hashTableCases()
     {
-        FileMetadata* file = lookup(filename);
-        if (file != nullptr)
+        const int COUNT = 20000;
+        vector<string> files = names("file", COUNT);
+        FileHashTable table;
+        if (selected("hashtable.insert"))
         {
-            cout << "\nFile Information:\n";
-            cout << "Name: " << file->name << endl;
-            cout << "Path: " << file->path << endl;
-            cout << "Owner: " << file->owner << endl;
-            cout << "Type: " << file->type << endl;
-            cout << "Size: " << file->size << " bytes" << endl;
-            cout << "Created: " << file->creationDate << endl;
+            time("hashtable.insert", COUNT, COUNT, 0, [&]()
+                {
+                    for (int i = 0; i < COUNT; i++)
+                        table.insert(files[i], "Root", "bench", "txt", 1, "2024-01-01 00:00:00");
+                });
         }
         else
         {
-            cout << "File not found in index.\n";
+            for (int i = 0; i < COUNT; i++)
+                table.insert(files[i], "Root", "bench", "txt", 1, "2024-01-01 00:00:00");
+        }
+        if (selected("hashtable.lookup"))
+        {
+            time("hashtable.lookup", COUNT, COUNT, 0, [&]()
+                {
+                    long long found = 0;
+                    for (int i = 0; i < COUNT; i++)
+                        found += table.lookup(files[i]) != nullptr;
+                    sink = found;
+                });
+        }
+    }
+
+    void compressionCases()
+    {
+        const int SIZE = 4 << 20;
+        string input(SIZE, 'a');
+        mt19937 rng(3);
+        for (int i = 0; i < SIZE; )
+        {
+            int run = 1 + rng() % 16;
+            char c = 'a' + rng() % 26;
+            for (int j = 0; j < run && i < SIZE; j++)
+                input[i++] = c;
+        }
+        string encoded = FileCompression::encodeRLE(input);
+        if (selected("rle.encode"))
+        {
+            time("rle.encode", SIZE, 1, SIZE, [&]()
+                {
+                    sink = FileCompression::encodeRLE(input).size();
+                });
+        }
+        if (selected("rle.decode"))
+        {
+            time("rle.decode", SIZE, 1, SIZE, [&]()
+                {
+                    sink = FileCompression::decodeRLE(encoded).size();
+                });
+        }
+    }
+
+    void cloudSyncCases()
+    {
+        if (!selected("cloudsync.enqueue_drain"))
+            return;
+        const int TASKS = 100000;
+        ContentRef content = makeContent(string(256, 'c'));
+        CloudSync cloud;
+        time("cloudsync.enqueue_drain", TASKS, TASKS, 0, [&]()
+            {
+                for (int i = 0; i < TASKS; i++)
+                    cloud.addSyncTask("upload", "file.txt", content);
+            });
+    }
+
+    void graphCases()
+    {
+        if (!selected("graph.share"))
+            return;
+        UserSystem users;
+        for (int i = 0; i < MAX_USERS; i++)
+            users.users[users.userCount++] = { "u" + to_string(i), "", "", "", EDITOR };
+        const int ROUNDS = 20000;
+        time("graph.share", MAX_USERS, (long long)ROUNDS * 2, 0, [&]()
+            {
+                for (int i = 0; i < ROUNDS; i++)
+                {
+                    int from = i % MAX_USERS, to = (i * 7 + 3) % MAX_USERS;
+                    users.shareFile(users.users[from].username, users.users[to].username);
+                    users.unshareFile(users.users[from].username, users.users[to].username);
+                }
+            });
+    }
+
+public:
+    MicroBenchmark(const string& f) : filter(f), sink(0) {}
+
+    void runAll()
+    {
+        folderCases();
+        versioningCases();
+        hashTableCases();
+        compressionCases();
+        cloudSyncCases();
+        graphCases();
+    }
+
+    void printJson(ostream& out) const
+    {
+        out << "{\"benchmarks\":[";
+        for (size_t i = 0; i < results.size(); i++)
+        {
+            const Result& r = results[i];
+            out << (i ? ",\n" : "\n") << "  {\"name\":\"" << r.name << "\",\"param\":" << r.param << ",\"ops\":" << r.ops
+                << fixed << setprecision(1) << ",\"ns_per_op\":" << r.seconds * 1e9 / r.ops
+                << ",\"ops_per_sec\":" << r.ops / r.seconds;
+            if (r.bytes > 0)
+                out << ",\"mb_per_sec\":" << r.bytes / r.seconds / (1 << 20);
+            out << "}";
         }
+        out << "\n]}" << endl;
+        out.unsetf(ios::fixed);
     }
 };
 
-void showMenu()
+void runMicroBenchmarks(const string& filter)
 {
-    cout << "\n--- Folder & File Versioning System Menu ---" << endl;
-    cout << "1. Create Folder" << endl;
-    cout << "2. Create File" << endl;
-    cout << "3. Update File" << endl;
-    cout << "4. View File Version History" << endl;
-    cout << "5. Rollback File to Specific Version" << endl;
-    cout << "6. Navigate to Folder" << endl;
-    cout << "7. Navigate Up" << endl;
-    cout << "8. List Current Folder Contents" << endl;
-    cout << "9. List All Folders" << endl;
-    cout << "10. Access File (Add to Recent)" << endl;
-    cout << "11. Delete File (Move to Recycle Bin)" << endl;
-    cout << "12. View Recent Files" << endl;
-    cout << "13. View Recycle Bin" << endl;
-    cout << "14. Empty Recycle Bin" << endl;
-    cout << "15. Logout" << endl;
-    cout << "16. Share File to Another User" << endl;
-    cout << "17. View Who Can Access My Files (Graph)" << endl;
-    cout << "18. Search File" << endl;
-    cout << "19. Restore File from Recycle Bin" << endl;
-    cout << "20. Delete Folder" << endl;
-    cout << "21. Display All Users" << endl;
-    cout << "22. Forgot Password" << endl;
-    cout << "23. View File Metadata (Hash Table)" << endl;
-    cout << "24. Compress File" << endl;
-    cout << "25. Decompress File" << endl;
-    cout << "26. Add File to Cloud Sync Queue" << endl;
-    cout << "27. Process Cloud Sync Queue" << endl;
-    cout << "28. Optimize File System Structure (AVL + Garbage Collection)" << endl;
-    cout << "0. Exit\n";
+    // Timings should measure the data structures, not the terminal
+    LogMode previous = engineLog.getMode();
+    engineLog.setMode(LOG_OFF);
+    MicroBenchmark bench(filter);
+    bench.runAll();
+    engineLog.setMode(previous);
+    bench.printJson(cout);
 }
 
-string getCurrentTimestamp()
+// Menu-side create: offers to update the file instead when the name is taken
+void createFileOrUpdate(Folder& drive, const string& name, string bytes)
 {
-    time_t now = time(0);
-    tm ltm;
-    localtime_s(&ltm, &now);
-    stringstream ss;
-    ss << 1900 + ltm.tm_year << "-"
-        << setw(2) << setfill('0') << 1 + ltm.tm_mon << "-"
-        << setw(2) << setfill('0') << ltm.tm_mday << " "
-        << setw(2) << setfill('0') << ltm.tm_hour << ":"
-        << setw(2) << setfill('0') << ltm.tm_min << ":"
-        << setw(2) << setfill('0') << ltm.tm_sec;
-    return ss.str();
+    ContentRef content = makeContent(move(bytes)); // one blob, whichever call keeps it
+    if (drive.createFile(name, content) != STATUS_EXISTS)
+        return;
+    cout << "Would you like to update its content? If yes then enter(Y/y), otherwise anything: ";
+    char choice;
+    cin >> choice;
+    cin.ignore();
+    if (choice == 'y' || choice == 'Y')
+        drive.updateFile(name, content);
 }
 
-
-int main()
+int main(int argc, char* argv[])
 {
+    if (argc > 1 && string(argv[1]) == "--bench-auth")
+    {
+        runAuthBenchmark();
+        return 0;
+    }
+    if (argc > 1 && string(argv[1]) == "--bench")
+    {
+        runMicroBenchmarks(argc > 2 ? argv[2] : "");
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--workload")
+    {
+        WorkloadConfig config;
+        if (argc > 3)
+            config.ops = atoll(argv[3]);
+        if (argc > 4)
+            config.seed = (unsigned)atoi(argv[4]);
+        ofstream trace(argv[2], ios::trunc);
+        if (!trace)
+        {
+            cerr << "Cannot write '" << argv[2] << "'." << endl;
+            return 2;
+        }
+        WorkloadGenerator(config).generate(trace);
+        return 0;
+    }
+    if (argc > 2 && string(argv[1]) == "--load")
+    {
+#ifdef __linux__
+        int connections = argc > 3 ? max(1, atoi(argv[3])) : 64;
+        long long perConnection = argc > 4 ? max(1LL, atoll(argv[4])) : 1000;
+        int pipeline = argc > 5 ? max(1, atoi(argv[5])) : 8;
+        string error;
+        LoadClient client(argv[2], connections, perConnection, pipeline);
+        if (!client.run(cout, error))
+        {
+            cerr << "Load run failed: " << error << endl;
+            return 2;
+        }
+        return 0;
+#else
+        cerr << "The load client needs Linux (epoll)." << endl;
+        return 2;
+#endif
+    }
+    string scriptPath, replayPath, recordPath, serveAddress;
+    int replayThreads = 1;
+    int serveWorkers = max(1, (int)thread::hardware_concurrency());
+    bool scripted = false;
+    for (int i = 1; i < argc; i++)
+    {
+        string arg = argv[i];
+        if (arg == "--quiet")
+            engineLog.setMode(LOG_OFF);
+        else if (arg == "--log-async")
+            engineLog.setMode(LOG_ASYNC);
+        else if (arg == "--replay" && i + 1 < argc)
+        {
+            replayPath = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                replayThreads = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--record" && i + 1 < argc)
+            recordPath = argv[++i];
+        else if (arg == "--serve" && i + 1 < argc)
+        {
+            serveAddress = argv[++i];
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                serveWorkers = max(1, atoi(argv[++i]));
+        }
+        else if (arg == "--script")
+        {
+            scripted = true;
+            if (i + 1 < argc && argv[i + 1][0] != '-')
+                scriptPath = argv[++i];
+        }
+    }
+
     Folder drive("Root");
     RecycleBin recycle;
     RecentFiles recent;
     UserSystem userSystem;
+    AccessControl access(userSystem);
+    drive.setRecentCache(&recent);
+    QuotaManager quotas;
+    drive.setQuotaManager(&quotas);
+    GarbageCollector gc(drive, recycle);
+
+    if (!replayPath.empty())
+    {
+        ifstream trace(replayPath);
+        if (!trace)
+        {
+            cerr << "Cannot open trace '" << replayPath << "'." << endl;
+            return 2;
+        }
+        vector<string> lines;
+        string line;
+        while (getline(trace, line))
+            lines.push_back(line);
+        engineLog.setMode(LOG_OFF);
+        ReplayHarness harness(drive, recycle, userSystem, access, gc);
+        harness.run(lines, replayThreads, cout);
+        return 0;
+    }
+
+    if (!serveAddress.empty())
+    {
+#ifdef __linux__
+        engineLog.setMode(LOG_OFF);
+        DriveServer server(drive, recycle, userSystem, access, gc);
+        string error;
+        if (!server.listen(serveAddress, error))
+        {
+            cerr << "Cannot listen on '" << serveAddress << "': " << error << endl;
+            return 2;
+        }
+        cerr << "Serving on " << serveAddress << " with " << serveWorkers << " worker(s); Ctrl+C stops." << endl;
+        server.run(serveWorkers);
+        return 0;
+#else
+        cerr << "Server mode needs Linux (epoll)." << endl;
+        return 2;
+#endif
+    }
+
+    TraceRecorder recorder;
+    if (!recordPath.empty() && !recorder.open(recordPath))
+        cerr << "Cannot write trace '" << recordPath << "'; recording is off." << endl;
+
+    if (scripted)
+    {
+        // Script output is JSON lines only; engine messages would interleave with it
+        engineLog.setMode(LOG_OFF);
+        ScriptRunner runner(drive, recycle, userSystem, access, gc);
+        int failures;
+        if (scriptPath.empty() || scriptPath == "-")
+            failures = runner.run(cin, cout);
+        else
+        {
+            ifstream script(scriptPath);
+            if (!script)
+            {
+                cerr << "Cannot open script '" << scriptPath << "'." << endl;
+                return 2;
+            }
+            failures = runner.run(script, cout);
+        }
+        return failures == 0 ? 0 : 1;
+    }
+
     string uname, pass, secQ, ans, logoutTime;
     string name, content;
     int versionNumber = 0;
@@ -1579,9 +9333,6 @@ int main()
     cin >> authChoice;
     cin.ignore();
 
-    system("cls"); 
-
-
     if (authChoice == 1)
     {
         char another;
@@ -1621,25 +9372,34 @@ int main()
         } while (another == 'y' || another == 'Y');
     }
 
-    system("cls");
-
     cout << "Login to continue..." << endl;
     cout << "Username: ";
     getline(cin, uname);
     cout << "Password: ";
     getline(cin, pass);
-    if (!userSystem.login(uname, pass))
+    string session = userSystem.login(uname, pass);
+    if (session.empty())
     {
-        system("pause");
         return 0;
     }
 
     while (!exit)
     {
-        system("cls");
+        // With --log-async the last command's messages may still be queued
+        engineLog.flush();
         showMenu();
         // drive.getCurrentPath();
 
+        int currentUser = userSystem.sessionUser(session);
+        if (currentUser == -1)
+        {
+            cout << "Session expired. Please log in again." << endl;
+            break;
+        }
+        drive.setActingUser(currentUser);
+        // Background reclamation between commands, bounded by a small time slice
+        gc.step();
+
         int choice;
         cout << "Enter your choice: ";
         cin >> choice;
@@ -1647,364 +9407,1123 @@ int main()
 
         if (cin.fail())
         {
-            cout << "Invalid input. Please enter a number between 1 and 28." << endl;
-            cin.clear();
-            cin.ignore(10000, '\n');
-            choice = -1; // force the loop to continue
-            continue;
+            cout << "Invalid input. Please enter a number between 1 and 46." << endl;
+            cin.clear();
+            cin.ignore(10000, '\n');
+            choice = -1; // force the loop to continue
+            continue;
+        }
+
+        switch (choice)
+        {
+        case 1:
+        {
+            if (!access.canAccess(currentUser, drive.currentfolder, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot create folders here." << endl;
+                break;
+            }
+            cout << "Enter folder name: ";
+            getline(cin, name);
+            recorder.record("mkdir " + name);
+            drive.createFolder(name);
+            break;
+        }
+        case 2:
+        {
+            if (!access.canAccess(currentUser, drive.currentfolder, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot create files here." << endl;
+                break;
+            }
+            cout << "Enter file name: ";
+            getline(cin, name);
+            cout << "Enter content: ";
+            getline(cin, content);
+            recorder.record("put " + name + " " + content);
+            createFileOrUpdate(drive, name, move(content));
+            break;
+        }
+        case 3:
+        {
+            cout << "Enter file name: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, target ? target : drive.currentfolder, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot update this file." << endl;
+                break;
+            }
+            cout << "Enter new content: ";
+            getline(cin, content);
+            recorder.record("update " + name + " " + content);
+            drive.updateFile(name, move(content));
+            break;
+        }
+        case 4:
+        {
+            cout << "Enter file name: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, target ? target : drive.currentfolder, PERM_READ))
+            {
+                cout << "Permission denied: You cannot read this file." << endl;
+                break;
+            }
+            drive.viewFileHistory(name);
+            break;
+        }
+        case 5:
+        {
+            cout << "Enter file name: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, target ? target : drive.currentfolder, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot rollback this file." << endl;
+                break;
+            }
+            cout << "Enter version number to rollback to: ";
+            cin >> versionNumber;
+            cin.ignore();
+            recorder.record("rollback " + name + " " + to_string(versionNumber));
+            drive.rollbackFile(name, versionNumber);
+            break;
+        }
+        case 6:
+        {
+            cout << "Enter folder name to navigate: ";
+            getline(cin, name);
+            if (drive.navigateToFolder(name))
+                recorder.record("cd " + name);
+            break;
+        }
+        case 7:
+        {
+            if (drive.navigateUp())
+                recorder.record("cd ..");
+            break;
+        }
+        case 8:
+        {
+            recorder.record("ls");
+            drive.listCurrent();
+            break;
+        }
+        case 9:
+        {
+            drive.listAllFolders();
+            break;
+        }
+        case 10:
+        {
+            cout << "Enter file name to access: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, target ? target : drive.currentfolder, PERM_READ))
+            {
+                cout << "Permission denied: You cannot read this file." << endl;
+                break;
+            }
+            recorder.record("cat " + name);
+            drive.accessFile(name, recent);
+            break;
+        }
+        case 11:
+        {
+            cout << "Enter file name to delete: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, target ? target : drive.currentfolder, PERM_DELETE))
+            {
+                cout << "Permission denied: You cannot delete this file." << endl;
+                break;
+            }
+            recorder.record("rm " + name);
+            drive.deleteFile(name, recycle);
+            break;
+        }
+        case 12:
+        {
+            recent.viewRecentFiles();
+            break;
         }
-
-        switch (choice)
+        case 13:
         {
-        case 1:
+            recycle.viewRecycleBin();
+            break;
+        }
+        case 14:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            if (userSystem.users[currentUser].role != ADMIN)
             {
-                cout << "Permission denied: Viewers cannot create folders." << endl;
+                cout << "Only Admin can empty recycle bin." << endl;
                 break;
             }
-            cout << "Enter folder name: ";
-            getline(cin, name);
-            drive.createFolder(name);
+            recycle.emptyRecycleBin();
             break;
         }
-        case 2:
+        case 15:
+        {
+            cout << "Enter username: ";
+            getline(cin, uname);
+            logoutTime = getCurrentTimestamp();
+            userSystem.logout(uname, logoutTime);
+            userSystem.endSession(session);
+            exit = true;
+            break;
+        }
+        case 16:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            if (!access.canAccess(currentUser, drive.currentfolder, PERM_SHARE))
             {
-                cout << "Permission denied: Viewers cannot create files." << endl;
+                cout << "Permission denied: You cannot share files from this folder." << endl;
                 break;
             }
-            cout << "Enter file name: ";
+            cout << "Enter sender username: ";
+            getline(cin, uname);
+            cout << "Enter receiver username: ";
             getline(cin, name);
-            cout << "Enter content: ";
-            getline(cin, content);
-            drive.createFile(name, content);
+            cout << "Enter file name to share (just for confirmation/logging purpose): ";
+            string sharedFile;
+            getline(cin, sharedFile);
+            userSystem.shareFile(uname, name);
+            cout << "Shared file: " << sharedFile << " from " << uname << " to " << name << endl;
             break;
         }
-        case 3:
+        case 17:
         {
-            Role role = userSystem.getCurrentUserRole(uname);
-            if (role == VIEWER)
+            cout << "Enter username to view sharing connections and update a file: ";
+            getline(cin, uname);
+            userSystem.showSharingAccess(uname);
+            if (access.canAccess(currentUser, drive.currentfolder, PERM_WRITE))
             {
-                cout << "Permission denied: Viewers cannot update files." << endl;
-                break;
+                cout << "\nYou have permission to update a file." << endl;
+                cout << "Enter file name to update: ";
+                getline(cin, name);
+                treenode* target = drive.findChildByName(drive.currentfolder, name);
+                if (target != nullptr && !access.canAccess(currentUser, target, PERM_WRITE))
+                {
+                    cout << "Permission denied: You cannot update this file." << endl;
+                    break;
+                }
+                cout << "Enter new content: ";
+                getline(cin, content);
+                drive.updateFile(name, content);
             }
-            cout << "Enter file name: ";
-            getline(cin, name);
-            cout << "Enter new content: ";
-            getline(cin, content);
-            drive.updateFile(name, content);
             break;
         }
-        case 4:
+        case 18:
         {
-            cout << "Enter file name: ";
+            cout << "Enter file name to search: ";
             getline(cin, name);
-            drive.viewFileHistory(name);
+            recorder.record("search " + name);
+            drive.searchFile(name);
             break;
         }
-        case 5:
+        case 19:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            if (!access.canAccess(currentUser, drive.currentfolder, PERM_WRITE))
             {
-                cout << "Permission denied: Viewers cannot rollback files.";
+                cout << "Permission denied: You cannot restore files here." << endl;
                 break;
             }
-            cout << "Enter file name: ";
+            cout << "Enter file name to restore: ";
             getline(cin, name);
-            cout << "Enter version number to rollback to: ";
-            cin >> versionNumber;
-            cin.ignore();
-            drive.rollbackFile(name, versionNumber);
+            recorder.record("restore " + name);
+            drive.restoreFile(name, recycle);
             break;
         }
-        case 6:
+        case 20:
         {
-            cout << "Enter folder name to navigate: ";
+            cout << "Enter folder name to delete: ";
             getline(cin, name);
-            drive.navigateToFolder(name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, target ? target : drive.currentfolder, PERM_DELETE))
+            {
+                cout << "Permission denied: You cannot delete this folder." << endl;
+                break;
+            }
+            recorder.record("rm " + name);
+            drive.deleteFolder(name);
             break;
         }
-        case 7:
+        case 21:
         {
-            drive.navigateUp();
+            userSystem.displayAllUsers();
             break;
         }
-        case 8:
+        case 22:
         {
-            drive.listCurrent();
+            cout << "Enter username: ";
+            getline(cin, uname);
+            cout << "Enter security answer: ";
+            getline(cin, ans);
+            userSystem.forgotPassword(uname, ans);
             break;
         }
-        case 9:
+        case 23:
         {
-            drive.listAllFolders();
+            FileHashTable fileIndex;
+            cout << "Enter file name to view metadata: ";
+            getline(cin, name);
+
+            // Find the file in current directory
+            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
+            if (fileNode != nullptr && !fileNode->isFolder)
+            {
+                // Add file to hash table if not already present
+                fileIndex.insert(name, drive.getCurrentPath(), uname,
+                    name.substr(name.find_last_of(".") + 1), // Get file extension as type
+                    fileNode->fileVersion->getLatestSize(), // Content length as size
+                    getCurrentTimestamp());
+
+                // Display the metadata
+                fileIndex.displayFileInfo(name);
+            }
+            else
+            {
+                cout << "File not found in current directory." << endl;
+            }
             break;
         }
-        case 10:
+
+        case 24:
         {
-            cout << "Enter file name to access: ";
+            cout << "Enter file name to compress: ";
             getline(cin, name);
-            drive.accessFile(name, recent);
+
+            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
+            int userIdx = currentUser;
+            if (!access.canAccess(userIdx, drive.currentfolder, PERM_WRITE) ||
+                (fileNode != nullptr && !access.canAccess(userIdx, fileNode, PERM_READ)))
+            {
+                cout << "Permission denied: You cannot compress this file here." << endl;
+                break;
+            }
+            if (fileNode != nullptr && !fileNode->isFolder && fileNode->fileVersion != nullptr)
+            {
+                ContentRef content = fileNode->fileVersion->latest();
+                string compressed = FileCompression::compressFile(content->str(), true); // Use RLE
+
+                // Create a new compressed file
+                string compressedName = name + ".compressed";
+                cout << "File compressed using RLE." << endl;
+                createFileOrUpdate(drive, compressedName, move(compressed));
+                cout << "File compressed and saved as '" << compressedName << endl;
+            }
+            else
+            {
+                cout << "File not found in current directory." << endl;
+            }
             break;
         }
-        case 11:
+
+        case 25:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            cout << "Enter compressed file name: ";
+            getline(cin, name);
+
+            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
+            int userIdx = currentUser;
+            if (!access.canAccess(userIdx, drive.currentfolder, PERM_WRITE) ||
+                (fileNode != nullptr && !access.canAccess(userIdx, fileNode, PERM_READ)))
             {
-                cout << "Permission denied: Viewers cannot delete files." << endl;
+                cout << "Permission denied: You cannot decompress this file here." << endl;
                 break;
             }
-            cout << "Enter file name to delete: ";
+            if (fileNode != nullptr && !fileNode->isFolder && fileNode->fileVersion != nullptr)
+            {
+                ContentRef compressed = fileNode->fileVersion->latest();
+                string decompressed = FileCompression::decodeRLE(compressed->str());
+
+                // Create a new decompressed file
+                string decompressedName = name;
+                int pos = static_cast<int>(decompressedName.find(".compressed"));
+
+                if (pos != static_cast<int>(string::npos))
+                {
+                    decompressedName.erase(pos, 11); // 11 characters in ".compressed"
+                }
+
+                cout << "File decompressed from RLE." << endl;
+                createFileOrUpdate(drive, decompressedName, move(decompressed));
+                cout << "File decompressed and saved as '" << decompressedName << "'." << endl;
+            }
+            else
+            {
+                cout << "File not found in current directory." << endl;
+            }
+            break;
+        }
+
+        case 26:
+        {
+            CloudSync cloudSync;
+            cout << "Enter file name to add to sync queue: ";
             getline(cin, name);
-            drive.deleteFile(name, recycle);
+
+            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
+            if (!access.canAccess(currentUser, fileNode ? fileNode : drive.currentfolder, PERM_SHARE))
+            {
+                cout << "Permission denied: You cannot sync this file." << endl;
+                break;
+            }
+            if (fileNode != nullptr && !fileNode->isFolder && fileNode->fileVersion != nullptr)
+            {
+                recorder.record("sync " + name);
+                cloudSync.addSyncTask("upload", name, fileNode->fileVersion->latest());
+                cout << "File added to cloud sync queue." << endl;
+            }
+            else
+            {
+                cout << "File not found in current directory." << endl;
+            }
             break;
         }
-        case 12:
+
+        case 27:
         {
-            recent.viewRecentFiles();
+            if (userSystem.users[currentUser].role != ADMIN)
+            {
+                cout << "Permission denied: Only Admins can manually process sync queue." << endl;
+                break;
+            }
+
+            CloudSync cloudSync;
+            cloudSync.startSync(); // Manually trigger sync
             break;
         }
-        case 13:
+        case 28:
         {
-            recycle.viewRecycleBin();
+            if (userSystem.users[currentUser].role != ADMIN)
+            {
+                cout << "Permission denied: Only Admins can optimize the file system." << endl;
+                break;
+            }
+            drive.optimizeStructure();
+            cout << "Keep how many versions per file (0 = keep all, current: "
+                << gc.getVersionRetention() << "): ";
+            int keep;
+            cin >> keep;
+            cin.ignore();
+            gc.setVersionRetention(keep);
+            cout << "Running garbage collection to optimize file system..." << endl;
+            const GarbageCollector::Report& report = gc.runFull();
+            cout << "Files visited: " << report.filesVisited << endl;
+            cout << "Old versions dropped: " << report.versionsPruned << " (" << report.versionBytes << " bytes)" << endl;
+            cout << "Expired Recycle Bin entries: " << report.recycleBytes << " bytes" << endl;
+            cout << "Compaction: " << report.compactedBytes << " bytes" << endl;
+            cout << "Garbage collection completed. " << report.total() << " bytes reclaimed." << endl;
+            break;
+        }
+        case 29:
+        {
+            if (!access.canAccess(currentUser, drive.root, PERM_SHARE))
+            {
+                cout << "Permission denied: You cannot manage sharing groups." << endl;
+                break;
+            }
+            cout << "1. Create Group  2. Add Member  3. Remove Member  4. Share With Group  5. Expand Group" << endl;
+            cout << "Choose: ";
+            int groupChoice;
+            cin >> groupChoice;
+            cin.ignore();
+            string gname;
+            cout << "Enter group name: ";
+            getline(cin, gname);
+            switch (groupChoice)
+            {
+            case 1:
+                userSystem.createGroup(gname);
+                break;
+            case 2:
+                cout << "Enter username to add: ";
+                getline(cin, name);
+                userSystem.addUserToGroup(gname, name);
+                break;
+            case 3:
+                cout << "Enter username to remove: ";
+                getline(cin, name);
+                userSystem.removeUserFromGroup(gname, name);
+                break;
+            case 4:
+                userSystem.shareWithGroup(userSystem.users[currentUser].username, gname);
+                break;
+            case 5:
+                userSystem.expandGroup(gname);
+                break;
+            default:
+                cout << "Invalid choice." << endl;
+            }
+            break;
+        }
+        case 30:
+        {
+            cout << "Enter file owner username: ";
+            getline(cin, name);
+            cout << "Enter username to check: ";
+            string viewer;
+            getline(cin, viewer);
+            if (userSystem.hasTransitiveAccess(name, viewer))
+                cout << viewer << " can access " << name << "'s files." << endl;
+            else
+                cout << viewer << " cannot access " << name << "'s files." << endl;
+            break;
+        }
+        case 31:
+        {
+            cout << "Enter file/folder name (leave empty for current folder): ";
+            getline(cin, name);
+            treenode* target = name.empty() ? drive.currentfolder : drive.findChildByName(drive.currentfolder, name);
+            if (target == nullptr)
+            {
+                cout << "File or folder not found in current directory." << endl;
+                break;
+            }
+            if (!access.canAccess(currentUser, target, PERM_SHARE))
+            {
+                cout << "Permission denied: You cannot change permissions here." << endl;
+                break;
+            }
+            access.showPermissions(target);
+            cout << "Enter username to change (leave empty to cancel): ";
+            string who;
+            getline(cin, who);
+            if (who.empty())
+                break;
+            int whoIdx = userSystem.findUserIndex(who);
+            if (whoIdx == -1)
+            {
+                cout << "User not found." << endl;
+                break;
+            }
+            cout << "Enter permissions as letters r/w/d/s, or '-' to clear explicit entry: ";
+            string perms;
+            getline(cin, perms);
+            if (perms == "-")
+            {
+                access.clearPermission(target, whoIdx);
+                cout << "Explicit permissions cleared; '" << target->name << "' now inherits for " << who << "." << endl;
+                break;
+            }
+            unsigned char mask = 0;
+            for (char c : perms)
+            {
+                if (c == 'r') mask |= PERM_READ;
+                else if (c == 'w') mask |= PERM_WRITE;
+                else if (c == 'd') mask |= PERM_DELETE;
+                else if (c == 's') mask |= PERM_SHARE;
+            }
+            access.setPermission(target, whoIdx, mask);
+            cout << "Permissions updated for " << who << " on '" << target->name << "'." << endl;
+            break;
+        }
+        case 32:
+        {
+            if (userSystem.users[currentUser].role != ADMIN)
+            {
+                cout << "Permission denied: Only Admins can change the password work factor." << endl;
+                break;
+            }
+            cout << "Current work factor: " << userSystem.hashIterations << " iterations" << endl;
+            cout << "Enter new number of iterations: ";
+            int iterations;
+            cin >> iterations;
+            cin.ignore();
+            try
+            {
+                userSystem.setHashIterations(iterations);
+                cout << "Work factor updated. Existing hashes upgrade on next login." << endl;
+            }
+            catch (const exception& e)
+            {
+                cout << "Error: " << e.what() << endl;
+            }
             break;
         }
-        case 14:
+        case 33:
         {
-            if (userSystem.getCurrentUserRole(uname) != ADMIN)
+            if (userSystem.users[currentUser].role != ADMIN)
             {
-                cout << "Only Admin can empty recycle bin." << endl;
+                cout << "Permission denied: Only Admins can change Recycle Bin retention." << endl;
                 break;
             }
-            recycle.emptyRecycleBin();
+            long maxAge;
+            size_t maxBytes;
+            cout << "Keep deleted files for how many seconds (0 = forever): ";
+            cin >> maxAge;
+            cout << "Maximum Recycle Bin size in bytes (0 = unlimited): ";
+            cin >> maxBytes;
+            cin.ignore();
+            recycle.setRetention(maxAge, maxBytes);
+            cout << "Retention updated. Recycle Bin now holds " << recycle.size() << " file(s)." << endl;
             break;
         }
-        case 15:
+        case 34:
         {
-            cout << "Enter username: ";
-            getline(cin, uname);
-            logoutTime = getCurrentTimestamp();
-            userSystem.logout(uname, logoutTime);
-            exit = true;
+            cout << "Current: capacity " << recent.getCapacity() << ", policy "
+                << (recent.getPolicy() == POLICY_LFU ? "LFU" : "LRU") << endl;
+            cout << "Enter capacity: ";
+            int cap;
+            cin >> cap;
+            cout << "Enter policy (1-LRU, 2-LFU): ";
+            int policyInput;
+            cin >> policyInput;
+            cin.ignore();
+            recent.setPolicy(policyInput == 2 ? POLICY_LFU : POLICY_LRU);
+            recent.setCapacity(cap);
+            cout << "Recent files now keep up to " << recent.getCapacity() << " file(s)." << endl;
             break;
         }
-        case 16:
+        case 35:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            cout << "1. Names in a range  2. Page of listing" << endl;
+            cout << "Choose: ";
+            int listChoice;
+            cin >> listChoice;
+            cin.ignore();
+            if (listChoice == 1)
             {
-                cout << "Permission denied: Viewers cannot share files." << endl;
-                break;
+                string from, to;
+                cout << "From name: ";
+                getline(cin, from);
+                cout << "To name (names starting with it are included): ";
+                getline(cin, to);
+                drive.listRange(from, to);
+            }
+            else
+            {
+                int page, pageSize;
+                cout << "Page number: ";
+                cin >> page;
+                cout << "Entries per page: ";
+                cin >> pageSize;
+                cin.ignore();
+                drive.listPage(page, pageSize);
             }
-            cout << "Enter sender username: ";
-            getline(cin, uname);
-            cout << "Enter receiver username: ";
-            getline(cin, name);
-            cout << "Enter file name to share (just for confirmation/logging purpose): ";
-            string sharedFile;
-            getline(cin, sharedFile);
-            userSystem.shareFile(uname, name);
-            cout << "Shared file: " << sharedFile << " from " << uname << " to " << name << endl;
             break;
         }
-        case 17:
+        case 36:
         {
-            cout << "Enter username to view sharing connections and update a file: ";
-            getline(cin, uname);
-            userSystem.showSharingAccess(uname);
-            if (userSystem.getCurrentUserRole(uname) != VIEWER)
+            if (userSystem.users[currentUser].role != ADMIN)
             {
-                cout << "\nYou have permission to update a file." << endl;
-                cout << "Enter file name to update: ";
-                getline(cin, name);
-                cout << "Enter new content: ";
-                getline(cin, content);
-                drive.updateFile(name, content);
+                cout << "Permission denied: Only Admins can view memory usage." << endl;
+                break;
             }
+            cout << "1. Table  2. JSON dump" << endl;
+            cout << "Choose: ";
+            int format;
+            cin >> format;
+            cin.ignore();
+            printMemoryReport(drive, format == 2);
             break;
         }
-        case 18:
+        case 37:
         {
-            cout << "Enter file name to search: ";
-            getline(cin, name);
-            drive.searchFile(name);
+            drive.showUsage();
             break;
         }
-        case 19:
+        case 38:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            cout << "1. My Usage  2. Set User Quota  3. Set Quota on Current Folder" << endl;
+            cout << "Choose: ";
+            int quotaChoice;
+            cin >> quotaChoice;
+            cin.ignore();
+            if (quotaChoice == 1)
             {
-                cout << "Permission denied: Viewers cannot restore files." << endl;
+                const QuotaManager::Usage& u = quotas.getUsage(currentUser);
+                const QuotaLimits& l = quotas.getLimits(currentUser);
+                cout << "Files: " << u.files << " (soft " << l.softFiles << ", hard " << l.hardFiles << ")" << endl;
+                cout << "Versions: " << u.versions << " (soft " << l.softVersions << ", hard " << l.hardVersions << ")" << endl;
+                cout << "Bytes: " << u.bytes << " (soft " << l.softBytes << ", hard " << l.hardBytes << ")" << endl;
+                cout << "(0 = unlimited)" << endl;
                 break;
             }
-            cout << "Enter file name to restore: ";
-            getline(cin, name);
-            drive.restoreFile(name, recycle);
+            if (userSystem.users[currentUser].role != ADMIN)
+            {
+                cout << "Permission denied: Only Admins can set quotas." << endl;
+                break;
+            }
+            int target = currentUser;
+            if (quotaChoice == 2)
+            {
+                cout << "Enter username: ";
+                getline(cin, name);
+                target = userSystem.findUserIndex(name);
+                if (target == -1)
+                {
+                    cout << "User not found." << endl;
+                    break;
+                }
+            }
+            QuotaLimits limits;
+            cout << "Soft / hard byte limit (0 = unlimited): ";
+            cin >> limits.softBytes >> limits.hardBytes;
+            cout << "Soft / hard version limit: ";
+            cin >> limits.softVersions >> limits.hardVersions;
+            cout << "Soft / hard file limit: ";
+            cin >> limits.softFiles >> limits.hardFiles;
+            cin.ignore();
+            if (quotaChoice == 2)
+            {
+                quotas.setLimits(target, limits);
+                cout << "Quota set for " << name << "." << endl;
+            }
+            else
+            {
+                if (drive.currentfolder->quota == nullptr)
+                    drive.currentfolder->quota = new QuotaLimits();
+                *drive.currentfolder->quota = limits;
+                cout << "Quota set on " << drive.getCurrentPath() << "." << endl;
+            }
             break;
         }
-        case 20:
+        case 39:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            cout << "1. Move  2. Rename  3. Copy" << endl;
+            cout << "Choose: ";
+            int moveChoice;
+            cin >> moveChoice;
+            cin.ignore();
+            string from, to;
+            cout << (moveChoice == 2 ? "Enter current name: " : "Enter source path: ");
+            getline(cin, from);
+            cout << (moveChoice == 2 ? "Enter new name: " : "Enter destination path: ");
+            getline(cin, to);
+            treenode* source = moveChoice == 2 ? drive.findChildByName(drive.currentfolder, from) : drive.resolvePath(from);
+            if (source != nullptr && !access.canAccess(currentUser, source, moveChoice == 3 ? PERM_READ : PERM_WRITE))
             {
-                cout << "Permission denied: Viewers cannot delete folders." << endl;
+                cout << "Permission denied: You cannot " << (moveChoice == 3 ? "copy" : "move") << " '" << from << "'." << endl;
                 break;
             }
-            cout << "Enter folder name to delete: ";
-            getline(cin, name);
-            drive.deleteFolder(name);
+            treenode* destination;
+            string destName;
+            // A destination that doesn't resolve is left for moveNode/copyNode to report
+            if (source != nullptr && (moveChoice == 1 || moveChoice == 3) &&
+                drive.destinationOf(to, source->name, destination, destName).empty() &&
+                !access.canAccess(currentUser, destination, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot write to the destination folder." << endl;
+                break;
+            }
+            if (moveChoice == 1)
+            {
+                // Inherited permissions may differ under the new parent
+                recorder.record("mv " + from + " " + to);
+                if (drive.moveNode(from, to))
+                    access.invalidate();
+            }
+            else if (moveChoice == 2)
+                drive.renameNode(from, to);
+            else if (moveChoice == 3)
+                drive.copyNode(from, to);
+            else
+                cout << "Invalid choice." << endl;
             break;
         }
-        case 21:
+        case 40:
         {
-            userSystem.displayAllUsers();
+            if (!access.canAccess(currentUser, drive.currentfolder, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot write to this folder." << endl;
+                break;
+            }
+            cout << "Conflict policy (1 = fail, 2 = skip, 3 = overwrite): ";
+            int policy;
+            cin >> policy;
+            cin.ignore();
+            if (policy < CONFLICT_FAIL || policy > CONFLICT_OVERWRITE)
+            {
+                cout << "Invalid policy." << endl;
+                break;
+            }
+            cout << "Enter one op per line (mkdir <path> | create <path> <content> | update <path> <content> |" << endl;
+            cout << "delete <path> | move <src> <dst>), then 'end':" << endl;
+            vector<BatchOp> ops;
+            string line;
+            while (getline(cin, line) && line != "end")
+            {
+                BatchOp op;
+                if (line.empty())
+                    continue;
+                if (parseBatchLine(line, op))
+                    ops.push_back(op);
+                else
+                    cout << "Ignored malformed line: " << line << endl;
+            }
+            vector<size_t> origin;
+            vector<BatchError> denied = authorizeBatch(drive, access, currentUser, ops, origin);
+            BatchResult result = drive.applyBatch(ops, (ConflictPolicy)policy, recycle);
+            // Moves may have changed inherited permissions
+            access.invalidate();
+            for (size_t i = 0; i < result.errors.size(); i++)
+                result.errors[i].index = origin[result.errors[i].index];
+            result.errors.insert(result.errors.end(), denied.begin(), denied.end());
+            sort(result.errors.begin(), result.errors.end(),
+                [](const BatchError& x, const BatchError& y) { return x.index < y.index; });
+            cout << "Batch finished: " << result.applied << " applied, " << result.skipped << " skipped, "
+                << result.errors.size() << " failed, " << result.foldersCreated << " folder(s) created." << endl;
+            if (result.softWarnings > 0)
+                cout << "Warning: " << result.softWarnings << " op(s) exceeded a soft quota." << endl;
+            for (size_t i = 0; i < result.errors.size(); i++)
+                cout << "  #" << result.errors[i].index + 1 << " " << result.errors[i].path << ": " << result.errors[i].reason << endl;
             break;
         }
-        case 22:
+        case 41:
         {
-            cout << "Enter username: ";
-            getline(cin, uname);
-            cout << "Enter security answer: ";
-            getline(cin, ans);
-            userSystem.forgotPassword(uname, ans);
+            if (userSystem.users[currentUser].role != ADMIN)
+            {
+                cout << "Permission denied: Only Admins can access the host file system." << endl;
+                break;
+            }
+            cout << "1. Import directory into current folder  2. Export current folder to directory" << endl;
+            cout << "Choose: ";
+            int transferChoice;
+            cin >> transferChoice;
+            cin.ignore();
+            string diskDir;
+            cout << "Enter disk directory: ";
+            getline(cin, diskDir);
+            cout << "Include version history (<name>.history directories)? (Y/N): ";
+            char historyChoice;
+            cin >> historyChoice;
+            cin.ignore();
+            bool withHistory = historyChoice == 'y' || historyChoice == 'Y';
+            DiskTransfer transfer(drive);
+            DiskTransfer::Report report;
+            if (transferChoice == 1)
+            {
+                report = transfer.importTree(diskDir, "", withHistory, CONFLICT_OVERWRITE, recycle);
+                access.invalidate();
+                cout << "Imported ";
+            }
+            else if (transferChoice == 2)
+            {
+                report = transfer.exportTree("", diskDir, withHistory);
+                cout << "Exported ";
+            }
+            else
+            {
+                cout << "Invalid choice." << endl;
+                break;
+            }
+            cout << report.files << " file(s), " << report.versions << " version(s), " << report.folders
+                << " folder(s), " << report.bytes << " bytes in " << fixed << setprecision(3) << report.seconds << "s";
+            if (report.seconds > 0)
+                cout << " (" << setprecision(1) << report.bytes / report.seconds / (1 << 20) << " MB/s)";
+            cout << endl;
+            cout.unsetf(ios::fixed);
+            for (size_t i = 0; i < report.errors.size(); i++)
+                cout << "  " << report.errors[i] << endl;
             break;
         }
-        case 23:
+        case 42:
         {
-            FileHashTable fileIndex;
-            cout << "Enter file name to view metadata: ";
-            getline(cin, name);
-
-            // Find the file in current directory
-            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
-            if (fileNode != nullptr && !fileNode->isFolder)
-            {
-                // Add file to hash table if not already present
-                fileIndex.insert(name, drive.getCurrentPath(), uname,
-                    name.substr(name.find_last_of(".") + 1), // Get file extension as type
-                    fileNode->fileVersion->getLatestContent().length(), // Content length as size
-                    getCurrentTimestamp());
-
-                // Display the metadata
-                fileIndex.displayFileInfo(name);
-            }
+            cout << "1. Normal  2. Async (background writer)  3. Quiet (engine messages off)" << endl;
+            cout << "Choose: ";
+            int modeChoice;
+            cin >> modeChoice;
+            cin.ignore();
+            if (modeChoice == 1)
+                engineLog.setMode(LOG_SYNC);
+            else if (modeChoice == 2)
+                engineLog.setMode(LOG_ASYNC);
+            else if (modeChoice == 3)
+                engineLog.setMode(LOG_OFF);
             else
             {
-                cout << "File not found in current directory." << endl;
+                cout << "Invalid choice." << endl;
+                break;
             }
+            cout << "Engine output mode updated." << endl;
             break;
         }
-
-        case 24:
+        case 43:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            if (userSystem.users[currentUser].role != ADMIN)
             {
-                cout << "Permission denied: Viewers cannot compress files." << endl;
+                cout << "Permission denied: Only Admins can view operation stats." << endl;
                 break;
             }
-
-            cout << "Enter file name to compress: ";
-            getline(cin, name);
-
-            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
-            if (fileNode != nullptr && !fileNode->isFolder && fileNode->fileVersion != nullptr)
+            cout << "1. Table  2. JSON dump  3. Reset  4. " << (opMetrics.enabled() ? "Disable" : "Enable") << " timing" << endl;
+            cout << "Choose: ";
+            int statsChoice;
+            cin >> statsChoice;
+            cin.ignore();
+            if (statsChoice == 1 || statsChoice == 2)
+                opMetrics.dump(cout, statsChoice == 2);
+            else if (statsChoice == 3)
             {
-                string content = fileNode->fileVersion->getLatestContent();
-                string compressed = FileCompression::compressFile(content, true); // Use RLE
-
-                // Create a new compressed file
-                string compressedName = name + ".compressed";
-                drive.createFile(compressedName, compressed);
-                cout << "File compressed and saved as '" << compressedName << endl;
+                opMetrics.reset();
+                cout << "Operation stats cleared." << endl;
             }
-            else
+            else if (statsChoice == 4)
             {
-                cout << "File not found in current directory." << endl;
+                opMetrics.setEnabled(!opMetrics.enabled());
+                cout << "Operation timing " << (opMetrics.enabled() ? "enabled." : "disabled.") << endl;
             }
+            else
+                cout << "Invalid choice." << endl;
             break;
         }
-
-        case 25:
+        case 44:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            cout << "Enter file name: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (target == nullptr || target->isFolder)
             {
-                cout << "Permission denied: Viewers cannot decompress files." << endl;
+                cout << "File not found in current directory." << endl;
                 break;
             }
-
-            cout << "Enter compressed file name: ";
-            getline(cin, name);
-
-            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
-            if (fileNode != nullptr && !fileNode->isFolder && fileNode->fileVersion != nullptr)
+            cout << "1. Read range  2. Write at offset  3. Append" << endl;
+            cout << "Choose: ";
+            int rangeChoice;
+            cin >> rangeChoice;
+            cin.ignore();
+            if (rangeChoice == 1)
             {
-                string compressed = fileNode->fileVersion->getLatestContent();
-                string decompressed = FileCompression::decodeRLE(compressed);
-
-                // Create a new decompressed file
-                string decompressedName = name;
-                int pos = static_cast<int>(decompressedName.find(".compressed"));
-
-                if (pos != static_cast<int>(string::npos))
+                if (!access.canAccess(currentUser, target, PERM_READ))
                 {
-                    decompressedName.erase(pos, 11); // 11 characters in ".compressed"
+                    cout << "Permission denied: You cannot read this file." << endl;
+                    break;
                 }
-
-                drive.createFile(decompressedName, decompressed);
-                cout << "File decompressed and saved as '" << decompressedName << "'." << endl;
+                size_t offset, len;
+                cout << "Offset and length: ";
+                cin >> offset >> len;
+                cin.ignore();
+                string bytes;
+                drive.readRange(name, offset, len, bytes);
+                recorder.record("read " + name + " " + to_string(offset) + " " + to_string(len));
+                cout << "Bytes " << offset << "-" << offset + bytes.size() << ": " << bytes << endl;
             }
-            else
+            else if (rangeChoice == 2 || rangeChoice == 3)
             {
-                cout << "File not found in current directory." << endl;
+                if (!access.canAccess(currentUser, target, PERM_WRITE))
+                {
+                    cout << "Permission denied: You cannot update this file." << endl;
+                    break;
+                }
+                size_t offset = 0;
+                if (rangeChoice == 2)
+                {
+                    cout << "Offset: ";
+                    cin >> offset;
+                    cin.ignore();
+                }
+                cout << "Bytes to write: ";
+                getline(cin, content);
+                OpStatus status = drive.writeRange(name, offset, content, rangeChoice == 3);
+                if (status == STATUS_OK)
+                {
+                    recorder.record(rangeChoice == 3 ? "append " + name + " " + content
+                        : "write " + name + " " + to_string(offset) + " " + content);
+                    cout << "File '" << name << "' is now version " << target->fileVersion->getCurrentVersionNumber()
+                        << ", " << target->fileVersion->getLatestSize() << " bytes." << endl;
+                }
+                else if (status == STATUS_INVALID)
+                    cout << "Offset is past the end of the file." << endl;
+                else
+                    cout << "File '" << name << "' was not updated (" << statusName(status) << ")." << endl;
             }
+            else
+                cout << "Invalid choice." << endl;
             break;
         }
-
-        case 26:
+        case 45:
         {
-            if (userSystem.getCurrentUserRole(uname) == VIEWER)
+            cout << "Enter file name: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (target == nullptr || target->isFolder)
             {
-                cout << "Permission denied: Viewers cannot add sync tasks." << endl;
+                cout << "File not found in current directory." << endl;
                 break;
             }
-
-            CloudSync cloudSync;
-            cout << "Enter file name to add to sync queue: ";
-            getline(cin, name);
-
-            treenode* fileNode = drive.findChildByName(drive.currentfolder, name);
-            if (fileNode != nullptr && !fileNode->isFolder && fileNode->fileVersion != nullptr)
+            cout << "1. Compare two versions  2. Merge two versions" << endl;
+            cout << "Choose: ";
+            int compareChoice;
+            cin >> compareChoice;
+            cin.ignore();
+            if (compareChoice == 1)
             {
-                string content = fileNode->fileVersion->getLatestContent();
-                cloudSync.addSyncTask("upload", name, content);
-                cout << "File added to cloud sync queue." << endl;
+                if (!access.canAccess(currentUser, target, PERM_READ))
+                {
+                    cout << "Permission denied: You cannot read this file." << endl;
+                    break;
+                }
+                int from, to;
+                cout << "From version and to version: ";
+                cin >> from >> to;
+                cin.ignore();
+                ContentDiff::Result changes;
+                if (drive.diffVersions(name, from, to, changes) != STATUS_OK)
+                {
+                    cout << "Version not found." << endl;
+                    break;
+                }
+                recorder.record("diff " + name + " " + to_string(from) + " " + to_string(to));
+                cout << "--- version " << from << "\n+++ version " << to << endl;
+                cout << ContentDiff::unified(changes);
+                cout << "+" << changes.added << " -" << changes.removed << (changes.binary ? " bytes" : " lines") << endl;
             }
-            else
+            else if (compareChoice == 2)
             {
-                cout << "File not found in current directory." << endl;
+                if (!access.canAccess(currentUser, target, PERM_WRITE))
+                {
+                    cout << "Permission denied: You cannot update this file." << endl;
+                    break;
+                }
+                int base, ours, theirs;
+                cout << "Base, ours and theirs versions: ";
+                cin >> base >> ours >> theirs;
+                cin.ignore();
+                size_t conflicts = 0;
+                OpStatus status = drive.mergeVersions(name, base, ours, theirs, conflicts);
+                if (status == STATUS_OK)
+                {
+                    recorder.record("merge " + name + " " + to_string(base) + " " + to_string(ours) + " " + to_string(theirs));
+                    cout << "Merged into version " << target->fileVersion->getCurrentVersionNumber();
+                    if (conflicts > 0)
+                        cout << " with " << conflicts << " conflict(s) marked";
+                    cout << "." << endl;
+                }
+                else if (status == STATUS_NOT_FOUND)
+                    cout << "Version not found." << endl;
+                else if (status == STATUS_INVALID)
+                    cout << "Binary content conflicts; nothing was merged." << endl;
+                else
+                    cout << "File '" << name << "' was not updated (" << statusName(status) << ")." << endl;
             }
+            else
+                cout << "Invalid choice." << endl;
             break;
         }
-
-        case 27:
+        case 46:
         {
-            if (userSystem.getCurrentUserRole(uname) != ADMIN)
+            cout << "Enter file name: ";
+            getline(cin, name);
+            treenode* target = drive.findChildByName(drive.currentfolder, name);
+            if (target == nullptr || target->isFolder)
             {
-                cout << "Permission denied: Only Admins can manually process sync queue." << endl;
+                cout << "File not found in current directory." << endl;
                 break;
             }
-
-            CloudSync cloudSync;
-            cloudSync.startSync(); // Manually trigger sync
-            break;
-        }
-        case 28:
-        {
-            if (userSystem.getCurrentUserRole(uname) != ADMIN)
+            cout << "1. List branches  2. Create branch  3. Switch branch  4. Merge branch into current" << endl;
+            cout << "5. Delete branch  6. Common ancestor of two versions" << endl;
+            cout << "Choose: ";
+            int branchChoice;
+            cin >> branchChoice;
+            cin.ignore();
+            if (branchChoice == 1 || branchChoice == 6)
             {
-                cout << "Permission denied: Only Admins can optimize the file system." << endl;
+                if (!access.canAccess(currentUser, target, PERM_READ))
+                {
+                    cout << "Permission denied: You cannot read this file." << endl;
+                    break;
+                }
+                if (branchChoice == 1)
+                {
+                    Folder::DirLatch dir(drive, target->parent, false);
+                    for (const pair<string, int>& tip : target->fileVersion->branchTips())
+                    {
+                        cout << (tip.first == target->fileVersion->getCurrentBranch() ? "* " : "  ")
+                            << tip.first << " -> version " << tip.second << endl;
+                    }
+                    break;
+                }
+                int first, second, ancestor = 0;
+                cout << "Two version numbers: ";
+                cin >> first >> second;
+                cin.ignore();
+                if (drive.commonAncestor(name, first, second, ancestor) == STATUS_OK)
+                    cout << "Versions " << first << " and " << second << " both descend from version " << ancestor << "." << endl;
+                else
+                    cout << "No common ancestor found." << endl;
                 break;
             }
-            drive.optimizeStructure();
+            if (branchChoice < 2 || branchChoice > 5)
+            {
+                cout << "Invalid choice." << endl;
+                break;
+            }
+            if (!access.canAccess(currentUser, target, PERM_WRITE))
+            {
+                cout << "Permission denied: You cannot update this file." << endl;
+                break;
+            }
+            string branch;
+            cout << "Branch name: ";
+            getline(cin, branch);
+            if (branchChoice == 2)
+            {
+                int fromVersion;
+                cout << "Start at version (0 for the current one): ";
+                cin >> fromVersion;
+                cin.ignore();
+                OpStatus status = drive.createBranch(name, branch, fromVersion);
+                if (status == STATUS_OK)
+                {
+                    recorder.record("branch " + name + " " + branch + " " + to_string(fromVersion));
+                    cout << "Branch '" << branch << "' created." << endl;
+                }
+                else if (status == STATUS_EXISTS)
+                    cout << "Branch '" << branch << "' already exists." << endl;
+                else
+                    cout << "Version not found." << endl;
+            }
+            else if (branchChoice == 3)
+            {
+                if (drive.switchBranch(name, branch) == STATUS_OK)
+                {
+                    recorder.record("checkout " + name + " " + branch);
+                    cout << "Switched to branch '" << branch << "' at version " << target->fileVersion->getCurrentVersionNumber() << "." << endl;
+                }
+                else
+                    cout << "Branch '" << branch << "' not found." << endl;
+            }
+            else if (branchChoice == 4)
+            {
+                size_t conflicts = 0;
+                string outcome;
+                OpStatus status = drive.mergeBranch(name, branch, conflicts, outcome);
+                if (status == STATUS_OK)
+                {
+                    recorder.record("mergebranch " + name + " " + branch);
+                    if (outcome == "up_to_date")
+                        cout << "Already up to date." << endl;
+                    else if (outcome == "fast_forward")
+                        cout << "Fast-forwarded to version " << target->fileVersion->getCurrentVersionNumber() << "." << endl;
+                    else
+                    {
+                        cout << "Merged into version " << target->fileVersion->getCurrentVersionNumber();
+                        if (conflicts > 0)
+                            cout << " with " << conflicts << " conflict(s) marked";
+                        cout << "." << endl;
+                    }
+                }
+                else if (status == STATUS_NOT_FOUND)
+                    cout << "Branch '" << branch << "' not found." << endl;
+                else if (status == STATUS_INVALID)
+                    cout << "Cannot merge that branch here (it is the current branch, or binary content conflicts)." << endl;
+                else
+                    cout << "File '" << name << "' was not updated (" << statusName(status) << ")." << endl;
+            }
+            else
+            {
+                OpStatus status = drive.deleteBranch(name, branch);
+                if (status == STATUS_OK)
+                {
+                    recorder.record("rmbranch " + name + " " + branch);
+                    cout << "Branch '" << branch << "' deleted." << endl;
+                }
+                else if (status == STATUS_INVALID)
+                    cout << "The current branch cannot be deleted." << endl;
+                else
+                    cout << "Branch '" << branch << "' not found." << endl;
+            }
             break;
         }
         case 0:
@@ -2016,6 +10535,5 @@ int main()
         }
     }
 
-    system("pause");
     return 0;
 }
\ No newline at end of file
@@ -0,0 +1,63 @@
+// Checks ContentDiff on inputs whose extents line up in awkward places. Build and run from
+// the repository root:
+//   g++ -std=c++17 -O2 tests/diff_check.cpp -o diff_check -pthread && ./diff_check
+#define main file_system_main
+#include "../Google Drive.cpp"
+#undef main
+
+int failures = 0;
+
+// Applying the hunks to 'from' must give 'to', and every hunk must cover whole lines
+void check(const string& name, ContentRef from, ContentRef to)
+{
+    string a = from->str(), b = to->str();
+    ContentDiff::Result r = ContentDiff::diff(from, to);
+    string rebuilt;
+    size_t pos = 0;
+    bool wholeLines = true;
+    for (size_t i = 0; i < r.hunks.size(); i++)
+    {
+        const ContentDiff::Hunk& h = r.hunks[i];
+        rebuilt += a.substr(pos, h.oldOffset - pos);
+        rebuilt += b.substr(h.newOffset, h.newLength);
+        pos = h.oldOffset + h.oldLength;
+        if (r.binary)
+            continue;
+        size_t oldEnd = h.oldOffset + h.oldLength, newEnd = h.newOffset + h.newLength;
+        if ((h.oldOffset > 0 && a[h.oldOffset - 1] != '\n') || (h.newOffset > 0 && b[h.newOffset - 1] != '\n') ||
+            (oldEnd > 0 && oldEnd < a.size() && a[oldEnd - 1] != '\n') || (newEnd > 0 && newEnd < b.size() && b[newEnd - 1] != '\n'))
+            wholeLines = false;
+    }
+    rebuilt += a.substr(pos);
+    if (rebuilt != b || !wholeLines)
+    {
+        cout << "FAIL " << name << (rebuilt != b ? ": hunks don't rebuild the new version" : ": hunk cuts a line") << endl;
+        failures++;
+    }
+    else
+        cout << "ok   " << name << endl;
+}
+
+int main()
+{
+    const size_t EXTENT = ContentBlob::EXTENT_SIZE;
+
+    check("single line edit", makeContent("a\nb\nc\n"), makeContent("a\nB\nc\n"));
+    check("append past last line", makeContent("a\nb"), makeContent("a\nbc\nd"));
+
+    // The first extent ends in a line break that the edit replaces; the second extent
+    // is shared, so the diff starts widening from the extent boundary
+    string text(EXTENT - 1, 'x');
+    text += '\n';
+    text += "tail line\nlast\n";
+    ContentRef broken = makeContent(text);
+    check("line break replaced at extent end", broken, broken->write(EXTENT - 1, "Z"));
+
+    // And the reverse: a line break appears where the old version had none
+    string joined(EXTENT, 'y');
+    joined += "tail line\n";
+    ContentRef plain = makeContent(joined);
+    check("line break added at extent end", plain, plain->write(EXTENT - 1, "\n"));
+
+    return failures == 0 ? 0 : 1;
+}